@@ -0,0 +1,703 @@
+#include <math.h>
+
+#include <obs.h>
+#include <util/threading.h>
+
+#include "AudioAnalyzer.h"
+#include "AudioDetection.h"
+#include "AudioFilter.h"
+#include "AudioRing.h"
+#include "JsonWriter.h"
+#include "RealFft.h"
+#include "VideoFilter.h"
+#include "WSServer.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// Milliseconds between two passes over the rings
+#define AUDIO_ANALYZER_INTERVAL 5
+// Floor of the spectrum levels in dB
+#define SPECTRUM_FLOOR -120.0
+
+AudioAnalyzer* AudioAnalyzer::Instance = nullptr;
+
+AudioAnalyzer::AudioAnalyzer()
+	: _nextSyncId(0),
+	  _stopping(0)
+{
+	start();
+}
+
+AudioAnalyzer::~AudioAnalyzer()
+{
+	_stopping.store(1);
+	QMutexLocker locker(&_mutex);
+	_wake.wakeAll();
+	locker.unlock();
+	wait();
+
+	for (sync_measurement* measurement : _syncs)
+		delete measurement;
+	for (audio_analysis* analysis : _analyses)
+	{
+		delete analysis->fft;
+		delete analysis->tracker;
+		delete analysis->envelope;
+		delete analysis;
+	}
+}
+
+// Called with _mutex held
+audio_analysis* AudioAnalyzer::analysis(ostws_audiofilter* filter)
+{
+	audio_analysis*& analysis = _analyses[filter];
+	if (!analysis)
+	{
+		analysis = new audio_analysis();
+		analysis->filter = filter;
+	}
+	return analysis;
+}
+
+// Creates the ring on first use and tells the audio thread whether to
+// fill it. The ring stays until the filter is destroyed, so the audio
+// thread never sees it freed.
+void AudioAnalyzer::updateRing(audio_analysis* analysis)
+{
+	ostws_audiofilter* filter = analysis->filter;
+	bool enabled = analysis->spectrum.enabled
+		|| analysis->rhythm.onsets || analysis->rhythm.beats
+		|| analysis->sync_users > 0;
+
+	if (enabled && !filter->ring)
+	{
+		int channels = (int)get_audio_channels(filter->oai.speakers);
+		filter->ring = new AudioRing(channels > 0 ? channels : 1,
+			AUDIO_RING_FRAMES, filter->oai.samples_per_sec);
+	}
+	os_atomic_set_bool(&filter->ring_enabled, enabled);
+}
+
+void AudioAnalyzer::configure_spectrum(ostws_audiofilter* filter,
+	const audio_spectrum_config& config)
+{
+	QMutexLocker locker(&_mutex);
+	audio_analysis* analysis = this->analysis(filter);
+	analysis->spectrum = config;
+	delete analysis->fft;
+	analysis->fft = nullptr;
+
+	if (config.enabled)
+	{
+		int size = config.size;
+		analysis->fft = new RealFft(size);
+		analysis->samples.resize(size);
+		analysis->power.resize(size / 2 + 1);
+
+		// Hann window
+		analysis->window.resize(size);
+		double sum = 0.0;
+		for (int i = 0; i < size; i++)
+		{
+			analysis->window[i] = (float)(0.5 - 0.5 * cos(2.0 * M_PI * i / size));
+			sum += analysis->window[i];
+		}
+		analysis->amplitude_scale = (float)(2.0 / sum);
+
+		// Log-spaced bands, narrow low bands fall back to their nearest bin
+		double binWidth = (double)filter->oai.samples_per_sec / size;
+		double maxFrequency = fmin(config.max_frequency,
+			filter->oai.samples_per_sec / 2.0);
+		double ratio = maxFrequency / config.min_frequency;
+		int lastBin = size / 2;
+		analysis->band_first.resize(config.bands);
+		analysis->band_last.resize(config.bands);
+		for (int band = 0; band < config.bands; band++)
+		{
+			double low = config.min_frequency * pow(ratio, (double)band / config.bands);
+			double high = config.min_frequency * pow(ratio, (double)(band + 1) / config.bands);
+			int first = qBound(1, (int)ceil(low / binWidth), lastBin);
+			int last = qBound(1, (int)ceil(high / binWidth) - 1, lastBin);
+			if (first > last)
+				first = last = qBound(1, (int)lround(sqrt(low * high) / binWidth), lastBin);
+			analysis->band_first[band] = first;
+			analysis->band_last[band] = last;
+		}
+		analysis->next_spectrum = 0;
+	}
+
+	updateRing(analysis);
+	_wake.wakeAll();
+}
+
+void AudioAnalyzer::configure_rhythm(ostws_audiofilter* filter,
+	const audio_rhythm_config& config)
+{
+	QMutexLocker locker(&_mutex);
+	audio_analysis* analysis = this->analysis(filter);
+	analysis->rhythm = config;
+	delete analysis->tracker;
+	analysis->tracker = nullptr;
+
+	if (config.onsets || config.beats)
+	{
+		analysis->tracker = new BeatTracker(filter->oai.samples_per_sec, config);
+		analysis->rhythm_frame.resize(RHYTHM_FRAME_SIZE);
+		analysis->next_rhythm = 0;
+	}
+
+	updateRing(analysis);
+	_wake.wakeAll();
+}
+
+void AudioAnalyzer::configure_detection(ostws_audiofilter* filter,
+	bool enabled)
+{
+	QMutexLocker locker(&_mutex);
+	audio_analysis* analysis = this->analysis(filter);
+	analysis->detection = enabled;
+	_wake.wakeAll();
+}
+
+void AudioAnalyzer::remove(ostws_audiofilter* filter)
+{
+	QMutexLocker locker(&_mutex);
+	for (sync_measurement* measurement : _syncs.values())
+	{
+		if (measurement->reference == filter || measurement->target == filter)
+			releaseSync(measurement);
+	}
+
+	audio_analysis* analysis = _analyses.take(filter);
+	if (analysis)
+	{
+		os_atomic_set_bool(&filter->ring_enabled, false);
+		delete analysis->fft;
+		delete analysis->tracker;
+		delete analysis->envelope;
+		delete analysis;
+	}
+}
+
+// Called with _mutex held
+void AudioAnalyzer::addSyncUser(ostws_audiofilter* filter, int users)
+{
+	audio_analysis* analysis = this->analysis(filter);
+	analysis->sync_users += users;
+	if (analysis->sync_users > 0 && !analysis->envelope)
+	{
+		analysis->envelope = new SyncEnvelope();
+		analysis->envelope_block.resize(
+			qMax((int)(filter->oai.samples_per_sec / SYNC_SLOTS_PER_SECOND), 1));
+		analysis->next_envelope = 0;
+	}
+	else if (analysis->sync_users <= 0)
+	{
+		delete analysis->envelope;
+		analysis->envelope = nullptr;
+	}
+	updateRing(analysis);
+}
+
+// Called with _mutex held, deletes the measurement
+void AudioAnalyzer::releaseSync(sync_measurement* measurement)
+{
+	_syncs.remove(measurement->id);
+	addSyncUser(measurement->reference, -1);
+	if (measurement->target)
+		addSyncUser(measurement->target, -1);
+	if (measurement->video_filter)
+		os_atomic_dec_long(&measurement->video_filter->sync_users);
+	delete measurement;
+}
+
+int AudioAnalyzer::start_sync(uint64_t owner, ostws_audiofilter* reference,
+	ostws_audiofilter* target, ostws_filter* video_filter,
+	uint32_t rectangle_id, double window, int max_offset)
+{
+	QMutexLocker locker(&_mutex);
+	auto measurement = new sync_measurement();
+	measurement->id = ++_nextSyncId;
+	measurement->owner = owner;
+	measurement->reference = reference;
+	measurement->target = target;
+	measurement->video_filter = video_filter;
+	measurement->rectangle_id = rectangle_id;
+	measurement->window = (int)lround(window * SYNC_SLOTS_PER_SECOND);
+	measurement->max_lag = (int)ceil(max_offset * 1000000.0 / SYNC_SLOT_NS);
+	_syncs.insert(measurement->id, measurement);
+
+	addSyncUser(reference, 1);
+	if (target)
+		addSyncUser(target, 1);
+	if (video_filter)
+		os_atomic_inc_long(&video_filter->sync_users);
+
+	_wake.wakeAll();
+	return measurement->id;
+}
+
+sync_stop_result AudioAnalyzer::stop_sync(int id, uint64_t owner)
+{
+	QMutexLocker locker(&_mutex);
+	sync_measurement* measurement = _syncs.value(id);
+	if (!measurement)
+		return sync_not_found;
+	if (measurement->owner != owner)
+		return sync_not_owner;
+
+	releaseSync(measurement);
+	return sync_stopped;
+}
+
+void AudioAnalyzer::release_client(uint64_t owner)
+{
+	QMutexLocker locker(&_mutex);
+	for (sync_measurement* measurement : _syncs.values())
+	{
+		if (measurement->owner == owner)
+			releaseSync(measurement);
+	}
+}
+
+void AudioAnalyzer::remove_video(ostws_filter* filter)
+{
+	QMutexLocker locker(&_mutex);
+	for (sync_measurement* measurement : _syncs.values())
+	{
+		if (measurement->video_filter == filter)
+			releaseSync(measurement);
+	}
+
+	QMutexLocker videoLocker(&_videoMutex);
+	for (int i = _videoChanges.count() - 1; i >= 0; i--)
+	{
+		if (_videoChanges[i].filter == filter)
+			_videoChanges.removeAt(i);
+	}
+}
+
+void AudioAnalyzer::video_state_changed(ostws_filter* filter,
+	uint32_t rectangle_id, bool state, uint64_t timestamp)
+{
+	QMutexLocker locker(&_videoMutex);
+	_videoChanges.append({filter, rectangle_id, state, timestamp});
+}
+
+void AudioAnalyzer::run()
+{
+	QMutexLocker locker(&_mutex);
+	while (!_stopping.load())
+	{
+		bool active = false;
+		for (audio_analysis* analysis : _analyses)
+		{
+			if (analyze(analysis))
+				active = true;
+		}
+		if (!_syncs.isEmpty())
+		{
+			processVideoChanges();
+			sendSyncOffsets();
+		}
+
+		if (!active)
+		{
+			_wake.wait(&_mutex);
+			continue;
+		}
+
+		locker.unlock();
+		QThread::msleep(AUDIO_ANALYZER_INTERVAL);
+		locker.relock();
+	}
+}
+
+// Returns whether any analysis of the filter is enabled
+bool AudioAnalyzer::analyze(audio_analysis* analysis)
+{
+	bool active = false;
+	if (analysis->detection)
+	{
+		sendDetections(analysis);
+		active = true;
+	}
+
+	AudioRing* ring = analysis->filter->ring;
+	if (!ring)
+		return active;
+
+	if (analysis->spectrum.enabled)
+	{
+		sendSpectrum(analysis, ring);
+		active = true;
+	}
+	if (analysis->tracker)
+	{
+		sendRhythm(analysis, ring);
+		active = true;
+	}
+	if (analysis->envelope)
+	{
+		updateEnvelope(analysis, ring);
+		active = true;
+	}
+	return active;
+}
+
+void AudioAnalyzer::sendSpectrum(audio_analysis* analysis, AudioRing* ring)
+{
+	const audio_spectrum_config& config = analysis->spectrum;
+	uint64_t end = ring->written();
+	if (end < analysis->next_spectrum || end < (uint64_t)config.size)
+		return;
+
+	// Overrun while copying, the next pass reads newer frames
+	float* samples = analysis->samples.data();
+	if (!ring->readMono(end - config.size, config.size, samples))
+		return;
+
+	uint64_t interval = ring->sampleRate() / config.rate;
+	analysis->next_spectrum += interval;
+	if (analysis->next_spectrum <= end)
+		analysis->next_spectrum = end + interval;
+
+	for (int i = 0; i < config.size; i++)
+		samples[i] *= analysis->window[i];
+	float* power = analysis->power.data();
+	analysis->fft->powerSpectrum(samples, power);
+
+	obs_source_t* parent = obs_filter_get_parent(analysis->filter->context);
+	const char* source_name = parent ? obs_source_get_name(parent) : "";
+	uint64_t timestamp = ring->timestamp(end - 1);
+
+	// Each band is its loudest bin, in dB relative to a full scale sine
+	float levels[SPECTRUM_MAX_BANDS];
+	for (int band = 0; band < config.bands; band++)
+	{
+		float peak = 0.0f;
+		for (int bin = analysis->band_first[band]; bin <= analysis->band_last[band]; bin++)
+			peak = fmaxf(peak, power[bin]);
+
+		double amplitude = sqrt(peak) * analysis->amplitude_scale;
+		levels[band] = amplitude > 0.0
+			? (float)fmax(20.0 * log10(amplitude), SPECTRUM_FLOOR)
+			: (float)SPECTRUM_FLOOR;
+	}
+
+	bool cbor = WSServer::Instance->has_cbor_clients();
+	JsonWriter& writer = JsonWriter::Begin("SpectrumUpdate", cbor);
+	writer.writeString("source", source_name);
+	writer.writeInt("timestamp", timestamp);
+	writer.beginArray("bands");
+	for (int band = 0; band < config.bands; band++)
+		writer.writeFixed(nullptr, levels[band], 1);
+	writer.endArray();
+	broadcast_message message = json_message(writer, spectrum, bulk,
+		QString::fromUtf8(source_name));
+
+	if (WSServer::Instance->has_compact_clients())
+	{
+		JsonWriter& compact = JsonWriter::Begin("SpectrumUpdate", cbor);
+		compact.writeInt("filter-id", analysis->filter->id);
+		compact.writeInt("timestamp", timestamp);
+		compact.beginArray("bands");
+		for (int band = 0; band < config.bands; band++)
+			compact.writeFixed(nullptr, levels[band], 1);
+		compact.endArray();
+		set_compact_form(message, compact);
+	}
+
+	WSServer::Instance->broadcast_thread_safe(message);
+}
+
+static JsonWriter& rhythm_json(const rhythm_event& event, AudioRing* ring,
+	const char* key, const char* source, uint32_t filter_id, bool cbor)
+{
+	JsonWriter& writer = JsonWriter::Begin(
+		event.type == rhythm_beat ? "AudioBeat" : "AudioOnset", cbor);
+	if (source)
+		writer.writeString(key, source);
+	else
+		writer.writeInt(key, filter_id);
+	writer.writeInt("timestamp", ring->timestamp(event.position));
+	if (event.type == rhythm_beat)
+	{
+		writer.writeFixed("bpm", event.bpm, 2);
+		writer.writeFixed("confidence", event.confidence, 2);
+		writer.writeInt("next", ring->timestamp(event.next_position));
+	}
+	else
+	{
+		writer.writeFixed("strength", event.strength, 3);
+	}
+	return writer;
+}
+
+// Feeds every hop written since the last pass to the beat tracker
+void AudioAnalyzer::sendRhythm(audio_analysis* analysis, AudioRing* ring)
+{
+	BeatTracker* tracker = analysis->tracker;
+	uint64_t end = ring->written();
+
+	// Start over at the newest frames when the worker fell behind
+	if (!analysis->next_rhythm || end > analysis->next_rhythm + AUDIO_RING_FRAMES / 2)
+	{
+		analysis->next_rhythm = end > RHYTHM_FRAME_SIZE ? end : RHYTHM_FRAME_SIZE;
+		tracker->reset(analysis->next_rhythm - RHYTHM_FRAME_SIZE / 2);
+	}
+
+	QVector<rhythm_event> events;
+	float* frame = analysis->rhythm_frame.data();
+	while (analysis->next_rhythm <= end)
+	{
+		if (!ring->readMono(analysis->next_rhythm - RHYTHM_FRAME_SIZE,
+			RHYTHM_FRAME_SIZE, frame))
+		{
+			analysis->next_rhythm = 0;
+			break;
+		}
+		tracker->process(frame, events);
+		analysis->next_rhythm += RHYTHM_HOP;
+	}
+	if (events.isEmpty())
+		return;
+
+	obs_source_t* parent = obs_filter_get_parent(analysis->filter->context);
+	const char* source_name = parent ? obs_source_get_name(parent) : "";
+	bool compact = WSServer::Instance->has_compact_clients();
+	bool cbor = WSServer::Instance->has_cbor_clients();
+
+	// Timing events, control priority so they are flushed at once and
+	// never dropped for slow clients
+	QList<broadcast_message> messages;
+	for (const rhythm_event& event : events)
+	{
+		broadcast_message message = json_message(
+			rhythm_json(event, ring, "source", source_name, 0, cbor),
+			event.type == rhythm_beat ? beat : onset, control,
+			QString::fromUtf8(source_name));
+		message.timestamp = ring->timestamp(event.position);
+		if (compact)
+			set_compact_form(message, rhythm_json(event, ring, "filter-id",
+				nullptr, analysis->filter->id, cbor));
+		messages << message;
+	}
+	WSServer::Instance->broadcast_thread_safe(messages);
+}
+
+static void write_level(JsonWriter& writer, float level)
+{
+	if (isfinite(level))
+		writer.writeFixed("level", level, 1);
+	else
+		writer.writeNull("level");
+}
+
+// Records a state change in the listing of GetAudioFilters. Returns the
+// rule or detector, null if it was removed meanwhile.
+template <typename T>
+static T* record_state(QList<T>& rules, const detection_event& event)
+{
+	for (T& rule : rules)
+	{
+		if (rule.id != event.id)
+			continue;
+		rule.state = event.state;
+		rule.stateTimestamp = event.timestamp;
+		return &rule;
+	}
+	return nullptr;
+}
+
+// AudioThreshold or AudioTone, in compact form when `source` is null
+static JsonWriter& detection_json(const detection_event& event,
+	const char* source, const char* name, double frequency,
+	uint32_t filter_id, bool cbor)
+{
+	bool tone = event.type == detection_tone;
+	JsonWriter& writer = JsonWriter::Begin(
+		tone ? "AudioTone" : "AudioThreshold", cbor);
+	if (source)
+	{
+		writer.writeString("source", source);
+		writer.writeString("name", name);
+	}
+	else
+	{
+		writer.writeInt("filter-id", filter_id);
+		writer.writeInt("id", event.id);
+	}
+	writer.writeBool("state", event.state);
+	writer.writeBool("lastState", !event.state);
+	if (tone && source)
+		writer.writeDouble("frequency", frequency);
+	write_level(writer, event.level);
+	writer.writeInt("timestamp", event.timestamp);
+	return writer;
+}
+
+// Sends the state changes the audio thread queued since the last pass
+void AudioAnalyzer::sendDetections(audio_analysis* analysis)
+{
+	ostws_audiofilter* filter = analysis->filter;
+	uint32_t dropped = filter->detection->takeDropped();
+	if (dropped)
+		blog(LOG_WARNING, "audio filter %u dropped %u detection events",
+			filter->id, dropped);
+
+	obs_source_t* parent = obs_filter_get_parent(filter->context);
+	const char* source_name = parent ? obs_source_get_name(parent) : "";
+	bool compact = WSServer::Instance->has_compact_clients();
+	bool cbor = WSServer::Instance->has_cbor_clients();
+
+	QList<broadcast_message> messages;
+	detection_event event;
+	while (filter->detection->pop(&event))
+	{
+		QByteArray name;
+		QString name_string;
+		double frequency = 0.0;
+		bool found = false;
+		pthread_mutex_lock(&filter->detection_mutex);
+		if (event.type == detection_tone)
+		{
+			tone_detector* tone = record_state(*filter->tones, event);
+			if (tone)
+			{
+				name = tone->name;
+				name_string = tone->name_string;
+				frequency = tone->frequency;
+				found = true;
+			}
+		}
+		else
+		{
+			audio_threshold* threshold = record_state(*filter->thresholds, event);
+			if (threshold)
+			{
+				name = threshold->name;
+				name_string = threshold->name_string;
+				found = true;
+			}
+		}
+		pthread_mutex_unlock(&filter->detection_mutex);
+		if (!found)
+			continue;
+
+		broadcast_message message = json_message(
+			detection_json(event, source_name, name.constData(), frequency,
+				0, cbor),
+			event.type == detection_tone ? tone_state : threshold_state,
+			control, QString::fromUtf8(source_name), QString(), name_string);
+		message.timestamp = event.timestamp;
+		if (compact)
+			set_compact_form(message, detection_json(event, nullptr,
+				nullptr, 0.0, filter->id, cbor));
+		messages << message;
+	}
+	if (!messages.isEmpty())
+		WSServer::Instance->broadcast_thread_safe(messages);
+}
+
+// Adds the level of every slot written since the last pass
+void AudioAnalyzer::updateEnvelope(audio_analysis* analysis, AudioRing* ring)
+{
+	uint32_t block = (uint32_t)analysis->envelope_block.count();
+	uint64_t end = ring->written();
+	if (!analysis->next_envelope || end > analysis->next_envelope + AUDIO_RING_FRAMES / 2)
+		analysis->next_envelope = end;
+
+	float* samples = analysis->envelope_block.data();
+	while (analysis->next_envelope + block <= end)
+	{
+		if (!ring->readMono(analysis->next_envelope, block, samples))
+		{
+			analysis->next_envelope = 0;
+			break;
+		}
+
+		float sum, peak;
+		audio_sum_squares_peak(samples, block, &sum, &peak);
+		float level = sum > 0.0f ? 10.0f * log10f(sum / block) : -INFINITY;
+		int64_t slot = (int64_t)(ring->timestamp(analysis->next_envelope + block / 2)
+			/ SYNC_SLOT_NS);
+		analysis->envelope->addLevel(slot, level);
+		analysis->next_envelope += block;
+	}
+}
+
+void AudioAnalyzer::processVideoChanges()
+{
+	QList<video_state_change> changes;
+	QMutexLocker locker(&_videoMutex);
+	changes.swap(_videoChanges);
+	locker.unlock();
+
+	for (const video_state_change& change : changes)
+	{
+		if (!change.state)
+			continue;
+		for (sync_measurement* measurement : _syncs)
+		{
+			if (measurement->video_filter == change.filter
+				&& measurement->rectangle_id == change.rectangle_id)
+				measurement->flashes.addEdge(
+					(int64_t)(change.timestamp / SYNC_SLOT_NS));
+		}
+	}
+}
+
+// Correlates every measurement once per second of reference audio
+void AudioAnalyzer::sendSyncOffsets()
+{
+	QList<broadcast_message> messages;
+	for (sync_measurement* measurement : _syncs)
+	{
+		audio_analysis* reference = _analyses.value(measurement->reference);
+		audio_analysis* target = measurement->target
+			? _analyses.value(measurement->target) : nullptr;
+		if (!reference || !reference->envelope
+			|| (measurement->target && (!target || !target->envelope)))
+			continue;
+
+		// Video edges are only sent on changes, the reference tells how
+		// far the measurement got
+		const SyncEnvelope& referenceEnvelope = *reference->envelope;
+		const SyncEnvelope& targetEnvelope = target
+			? *target->envelope : measurement->flashes;
+		int64_t end = target
+			? qMin(referenceEnvelope.latest(), targetEnvelope.latest())
+			: referenceEnvelope.latest();
+		if (end < 0)
+			continue;
+		if (measurement->next_report < 0)
+			measurement->next_report = end + SYNC_SLOTS_PER_SECOND;
+		if (end < measurement->next_report)
+			continue;
+		measurement->next_report = end + SYNC_SLOTS_PER_SECOND;
+
+		sync_result result;
+		if (!sync_correlate(referenceEnvelope, targetEnvelope, end,
+			measurement->window, measurement->max_lag, &result))
+			continue;
+
+		obs_source_t* parent = obs_filter_get_parent(measurement->reference->context);
+		const char* source_name = parent ? obs_source_get_name(parent) : "";
+
+		JsonWriter& writer = JsonWriter::Begin("SyncOffset",
+			WSServer::Instance->has_cbor_clients());
+		writer.writeInt("measurement-id", measurement->id);
+		writer.writeFixed("offset", result.offset, 1);
+		writer.writeFixed("confidence", result.confidence, 2);
+		writer.writeInt("timestamp", result.end * SYNC_SLOT_NS);
+		broadcast_message message = json_message(writer, sync_offset, bulk,
+			QString::fromUtf8(source_name));
+		message.recipient = measurement->owner;
+		messages << message;
+	}
+	if (!messages.isEmpty())
+		WSServer::Instance->broadcast_thread_safe(messages);
+}
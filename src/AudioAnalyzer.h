@@ -0,0 +1,181 @@
+#ifndef AUDIOANALYZER_H
+#define AUDIOANALYZER_H
+
+#include <stdint.h>
+#include <QAtomicInt>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QThread>
+#include <QVector>
+#include <QWaitCondition>
+
+#include "BeatTracker.h"
+#include "SyncCorrelator.h"
+
+struct ostws_audiofilter;
+struct ostws_filter;
+class AudioRing;
+class RealFft;
+
+// Frames kept per channel for the worker, twice the largest FFT
+#define AUDIO_RING_FRAMES 16384
+#define SPECTRUM_MAX_SIZE (AUDIO_RING_FRAMES / 2)
+#define SPECTRUM_MIN_SIZE 256
+#define SPECTRUM_MAX_BANDS 256
+#define SPECTRUM_MAX_RATE 60
+#define SYNC_MAX_WINDOW 15
+#define SYNC_MAX_OFFSET 2000
+
+// Spectrum settings of an audio filter
+struct audio_spectrum_config
+{
+	bool enabled = false;
+	int bands = 32;
+	int rate = 30;
+	// FFT size in frames, a power of two
+	int size = 2048;
+	double min_frequency = 20.0;
+	double max_frequency = 20000.0;
+};
+
+// Worker state of one audio filter
+struct audio_analysis
+{
+	ostws_audiofilter* filter = nullptr;
+
+	// Whether the filter has threshold rules or tone detectors, whose state
+	// changes the worker sends
+	bool detection = false;
+
+	audio_spectrum_config spectrum;
+	RealFft* fft = nullptr;
+	QVector<float> window;
+	// Scales a bin magnitude to the amplitude of a sine in that bin
+	float amplitude_scale = 0.0f;
+	QVector<float> samples;
+	QVector<float> power;
+	// Bins of every band, both inclusive
+	QVector<int> band_first;
+	QVector<int> band_last;
+	// Ring position the next spectrum is due at
+	uint64_t next_spectrum = 0;
+
+	audio_rhythm_config rhythm;
+	BeatTracker* tracker = nullptr;
+	QVector<float> rhythm_frame;
+	// Ring position the next rhythm frame ends at, 0 to start over
+	uint64_t next_rhythm = 0;
+
+	// Level envelope while sync measurements use the filter
+	int sync_users = 0;
+	SyncEnvelope* envelope = nullptr;
+	QVector<float> envelope_block;
+	// Ring position of the next envelope slot, 0 to start over
+	uint64_t next_envelope = 0;
+};
+
+// A/V sync measurement of a target against a reference audio filter, the
+// target being another audio filter or the flashes of a video rectangle
+struct sync_measurement
+{
+	int id = 0;
+	// Id of the client_config that started it
+	uint64_t owner = 0;
+	ostws_audiofilter* reference = nullptr;
+	ostws_audiofilter* target = nullptr;
+	ostws_filter* video_filter = nullptr;
+	uint32_t rectangle_id = 0;
+	// Rising edges of the rectangle state
+	SyncEnvelope flashes;
+	// In slots
+	int window = 0;
+	int max_lag = 0;
+	int64_t next_report = -1;
+};
+
+enum sync_stop_result
+{
+	sync_stopped,
+	sync_not_found,
+	sync_not_owner
+};
+
+struct video_state_change
+{
+	ostws_filter* filter;
+	uint32_t rectangle_id;
+	bool state;
+	uint64_t timestamp;
+};
+
+/**
+ * Worker thread for the audio analyses too expensive for the audio thread.
+ * Filters with an analysis enabled copy their buffers into an AudioRing
+ * and nothing else; the worker wakes every few milliseconds, reads the
+ * rings and broadcasts the results. It also sends the state changes the
+ * audio thread queues in the AudioDetection of the filters, so that the
+ * audio thread never serializes or broadcasts. It sleeps while nothing is
+ * enabled.
+ */
+class AudioAnalyzer : public QThread
+{
+public:
+	AudioAnalyzer();
+	~AudioAnalyzer();
+
+	void configure_spectrum(ostws_audiofilter* filter,
+		const audio_spectrum_config& config);
+	void configure_rhythm(ostws_audiofilter* filter,
+		const audio_rhythm_config& config);
+	void configure_detection(ostws_audiofilter* filter, bool enabled);
+	// Once this returns the worker doesn't use the filter anymore
+	void remove(ostws_audiofilter* filter);
+
+	// Returns the id of the measurement, `target` or `video_filter` is set.
+	// `window` is in seconds, `max_offset` in ms. `owner` is the id of the
+	// client_config, only that client can stop it.
+	int start_sync(uint64_t owner, ostws_audiofilter* reference,
+		ostws_audiofilter* target, ostws_filter* video_filter,
+		uint32_t rectangle_id, double window, int max_offset);
+	sync_stop_result stop_sync(int id, uint64_t owner);
+	// Ends the measurements of a client that disconnected
+	void release_client(uint64_t owner);
+	// Ends the measurements of a video filter being destroyed
+	void remove_video(ostws_filter* filter);
+	// Called by the video thread for filters with sync users
+	void video_state_changed(ostws_filter* filter, uint32_t rectangle_id,
+		bool state, uint64_t timestamp);
+
+	static AudioAnalyzer* Instance;
+
+protected:
+	void run() override;
+
+private:
+	audio_analysis* analysis(ostws_audiofilter* filter);
+	void updateRing(audio_analysis* analysis);
+	bool analyze(audio_analysis* analysis);
+	void sendSpectrum(audio_analysis* analysis, AudioRing* ring);
+	void sendRhythm(audio_analysis* analysis, AudioRing* ring);
+	void sendDetections(audio_analysis* analysis);
+	void addSyncUser(ostws_audiofilter* filter, int users);
+	void releaseSync(sync_measurement* measurement);
+	void updateEnvelope(audio_analysis* analysis, AudioRing* ring);
+	void processVideoChanges();
+	void sendSyncOffsets();
+
+	// Guards _analyses and everything in them
+	QMutex _mutex;
+	QWaitCondition _wake;
+	QHash<ostws_audiofilter*, audio_analysis*> _analyses;
+	QHash<int, sync_measurement*> _syncs;
+	int _nextSyncId;
+	QAtomicInt _stopping;
+
+	// Guards _videoChanges only, so the video thread never waits on a pass
+	QMutex _videoMutex;
+	QList<video_state_change> _videoChanges;
+};
+
+#endif // AUDIOANALYZER_H
@@ -0,0 +1,109 @@
+#include "AudioDetection.h"
+
+static void free_sets(audio_detection_set* set)
+{
+	while (set)
+	{
+		audio_detection_set* next = set->next;
+		delete set;
+		set = next;
+	}
+}
+
+AudioDetection::AudioDetection()
+	: _pending(nullptr),
+	  _current(new audio_detection_set()),
+	  _retired(nullptr),
+	  _head(0),
+	  _tail(0),
+	  _dropped(0)
+{
+}
+
+AudioDetection::~AudioDetection()
+{
+	delete _pending.load();
+	delete _current;
+	free_sets(_retired.load());
+}
+
+void AudioDetection::publish(audio_detection_set* set)
+{
+	free_sets(_retired.exchange(nullptr));
+	// Replaced before the audio thread saw it
+	delete _pending.exchange(set);
+}
+
+// Rules keep their id across updates as long as their name stays. The
+// sets are built by settings updates, so the vectors aren't shared and
+// writing to them doesn't allocate.
+template <typename T>
+static void carry_state(const QVector<T>& from, QVector<T>& to)
+{
+	// data() of an empty vector allocates
+	if (to.isEmpty())
+		return;
+
+	const T* previous = from.constData();
+	T* rules = to.data();
+	for (int i = 0; i < to.count(); i++)
+	{
+		for (int j = 0; j < from.count(); j++)
+		{
+			if (previous[j].id != rules[i].id)
+				continue;
+			rules[i].state = previous[j].state;
+			rules[i].stateTimestamp = previous[j].stateTimestamp;
+			break;
+		}
+	}
+}
+
+void AudioDetection::carryState(const audio_detection_set* from,
+	audio_detection_set* to)
+{
+	carry_state(from->thresholds, to->thresholds);
+	carry_state(from->tones, to->tones);
+}
+
+audio_detection_set* AudioDetection::acquire()
+{
+	audio_detection_set* set = _pending.exchange(nullptr);
+	if (!set)
+		return _current;
+
+	carryState(_current, set);
+	audio_detection_set* retired = _current;
+	retired->next = _retired.load();
+	while (!_retired.compare_exchange_weak(retired->next, retired))
+		;
+	_current = set;
+	return set;
+}
+
+void AudioDetection::push(const detection_event& event)
+{
+	uint32_t head = _head.load(std::memory_order_relaxed);
+	if (head - _tail.load(std::memory_order_acquire) == DETECTION_QUEUE_SIZE)
+	{
+		_dropped.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+	_events[head % DETECTION_QUEUE_SIZE] = event;
+	_head.store(head + 1, std::memory_order_release);
+}
+
+bool AudioDetection::pop(detection_event* event)
+{
+	uint32_t tail = _tail.load(std::memory_order_relaxed);
+	if (tail == _head.load(std::memory_order_acquire))
+		return false;
+	*event = _events[tail % DETECTION_QUEUE_SIZE];
+	_tail.store(tail + 1, std::memory_order_release);
+	return true;
+}
+
+uint32_t AudioDetection::takeDropped()
+{
+	return _dropped.exchange(0, std::memory_order_relaxed);
+}
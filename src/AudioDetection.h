@@ -0,0 +1,91 @@
+#ifndef AUDIODETECTION_H
+#define AUDIODETECTION_H
+
+#include <atomic>
+#include <stdint.h>
+#include <QVector>
+
+#include "AudioThreshold.h"
+#include "ToneDetector.h"
+
+// Rules and tone detectors of an audio filter as the audio thread runs
+// them, replaced as a whole by settings updates
+struct audio_detection_set
+{
+	QVector<audio_threshold> thresholds;
+	QVector<tone_detector> tones;
+
+	// Retired sets waiting to be freed
+	audio_detection_set* next = nullptr;
+};
+
+enum detection_event_type
+{
+	detection_threshold,
+	detection_tone
+};
+
+// State change of a rule, as queued by the audio thread
+struct detection_event
+{
+	detection_event_type type;
+	uint32_t id;
+	bool state;
+	float level;
+	uint64_t timestamp;
+};
+
+// A power of two
+#define DETECTION_QUEUE_SIZE 256
+
+/**
+ * Hands the rules and tone detectors of an audio filter to the audio
+ * thread and their state changes back, without either side ever waiting on
+ * the other.
+ *
+ * Settings updates publish() a complete rule set. The audio thread picks
+ * it up with acquire() at the start of its next buffer, carries the state
+ * of the rules that kept their id over and retires the set it ran until
+ * then; retired sets are freed by the next publish(), the audio thread
+ * being done with them.
+ *
+ * State changes go through a single producer, single consumer queue to the
+ * AudioAnalyzer worker, which sends the events. When the worker falls
+ * DETECTION_QUEUE_SIZE changes behind, further ones are dropped and
+ * counted.
+ */
+class AudioDetection
+{
+public:
+	AudioDetection();
+	~AudioDetection();
+
+	// Settings updates, one at a time. Takes ownership of `set`.
+	void publish(audio_detection_set* set);
+	// Audio thread: the set to run the buffer with, never null
+	audio_detection_set* acquire();
+
+	// Audio thread
+	void push(const detection_event& event);
+	// Worker thread, returns false when the queue is empty
+	bool pop(detection_event* event);
+	// Worker thread, changes dropped since the last call
+	uint32_t takeDropped();
+
+private:
+	static void carryState(const audio_detection_set* from,
+		audio_detection_set* to);
+
+	std::atomic<audio_detection_set*> _pending;
+	// Audio thread only
+	audio_detection_set* _current;
+	std::atomic<audio_detection_set*> _retired;
+
+	detection_event _events[DETECTION_QUEUE_SIZE];
+	// Positions of the next event written and read
+	std::atomic<uint32_t> _head;
+	std::atomic<uint32_t> _tail;
+	std::atomic<uint32_t> _dropped;
+};
+
+#endif // AUDIODETECTION_H
@@ -20,6 +20,8 @@ along with this program; If not, see <https://www.gnu.org/licenses/>
 #include <Windows.h>
 #endif
 
+#include <string.h>
+
 #include <obs-module.h>
 #include <obs-frontend-api.h>
 #include <util/platform.h>
@@ -29,6 +31,9 @@ along with this program; If not, see <https://www.gnu.org/licenses/>
 #include <media-io/audio-resampler.h>
 #include "WSServer.h"
 #include "AudioFilter.h"
+#include "AudioAnalyzer.h"
+#include "AudioDetection.h"
+#include "AudioRing.h"
 
 #define CLAMP(x, min, max) ((x) < min ? min : ((x) > max ? max : (x)))
 
@@ -43,6 +48,57 @@ static inline float db_to_mul(const float db)
 	return isfinite((double)db) ? powf(10.0f, db / 20.0f) : 0.0f;
 }
 
+static inline long float_to_bits(float value)
+{
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	return (long)bits;
+}
+
+static inline float bits_to_float(long value)
+{
+	uint32_t bits = (uint32_t)value;
+	float result;
+	memcpy(&result, &bits, sizeof(result));
+	return result;
+}
+
+static void atomic_max_float(volatile long* target, float value)
+{
+	long current = os_atomic_load_long(target);
+	while (value > bits_to_float(current))
+	{
+		if (os_atomic_compare_swap_long(target, current, float_to_bits(value)))
+			break;
+		current = os_atomic_load_long(target);
+	}
+}
+
+struct ostws_audio_levels ostws_audiofilter_take_levels(struct ostws_audiofilter* s)
+{
+	struct ostws_audio_levels levels;
+	levels.magnitude = bits_to_float(
+		os_atomic_exchange_long(&s->magnitude, float_to_bits(AUDIO_MIN)));
+	levels.peak = bits_to_float(
+		os_atomic_exchange_long(&s->peak, float_to_bits(AUDIO_MIN)));
+	levels.true_peak = bits_to_float(
+		os_atomic_exchange_long(&s->true_peak, float_to_bits(AUDIO_MIN)));
+	for (int i = 0; i < MAX_AUDIO_CHANNELS; i++)
+	{
+		levels.channel_magnitude[i] = bits_to_float(os_atomic_exchange_long(
+			&s->channel_magnitude[i], float_to_bits(AUDIO_MIN)));
+		levels.channel_peak[i] = bits_to_float(os_atomic_exchange_long(
+			&s->channel_peak[i], float_to_bits(AUDIO_MIN)));
+	}
+	levels.mul = bits_to_float(os_atomic_load_long(&s->mul));
+	levels.nr_channels = (int)os_atomic_load_long(&s->nr_channels);
+	levels.momentary = bits_to_float(os_atomic_load_long(&s->momentary));
+	levels.short_term = bits_to_float(os_atomic_load_long(&s->short_term));
+	levels.integrated = bits_to_float(os_atomic_load_long(&s->integrated));
+	levels.loudness_range = bits_to_float(os_atomic_load_long(&s->loudness_range));
+	return levels;
+}
+
 const char* ostws_audiofilter_getname(void* data)
 {
 	UNUSED_PARAMETER(data);
@@ -53,13 +109,45 @@ void ostws_audiofilter_update(void* data, obs_data_t* settings);
 
 void ostws_audiofilter_getdefaults(obs_data_t* defaults)
 {
+	audio_spectrum_config spectrum;
+	obs_data_set_default_bool(defaults, "spectrum", false);
+	obs_data_set_default_int(defaults, "spectrumBands", spectrum.bands);
+	obs_data_set_default_int(defaults, "spectrumRate", spectrum.rate);
+	obs_data_set_default_int(defaults, "spectrumSize", spectrum.size);
+	obs_data_set_default_double(defaults, "spectrumMinFrequency", spectrum.min_frequency);
+	obs_data_set_default_double(defaults, "spectrumMaxFrequency", spectrum.max_frequency);
+
+	audio_rhythm_config rhythm;
+	obs_data_set_default_bool(defaults, "onsets", false);
+	obs_data_set_default_bool(defaults, "beats", false);
+	obs_data_set_default_double(defaults, "onsetThreshold", rhythm.threshold);
+	obs_data_set_default_double(defaults, "beatMinBpm", rhythm.min_bpm);
+	obs_data_set_default_double(defaults, "beatMaxBpm", rhythm.max_bpm);
 }
 
 void* ostws_filter_create_audioonly(obs_data_t* settings, obs_source_t* source)
 {
+	static volatile long next_audio_filter_id = 0;
+
 	auto s = (struct ostws_audiofilter*)bzalloc(sizeof(struct ostws_audiofilter));
 	s->is_audioonly = true;
 	s->context = source;
+	s->id = (uint32_t)os_atomic_inc_long(&next_audio_filter_id);
+	s->magnitude = float_to_bits(AUDIO_MIN);
+	s->peak = float_to_bits(AUDIO_MIN);
+	s->true_peak = float_to_bits(AUDIO_MIN);
+	for (int i = 0; i < MAX_AUDIO_CHANNELS; i++)
+	{
+		s->channel_magnitude[i] = float_to_bits(AUDIO_MIN);
+		s->channel_peak[i] = float_to_bits(AUDIO_MIN);
+	}
+	s->momentary = float_to_bits(-INFINITY);
+	s->short_term = float_to_bits(-INFINITY);
+	s->integrated = float_to_bits(-INFINITY);
+	s->detection = new AudioDetection();
+	s->thresholds = new QList<audio_threshold>();
+	s->tones = new QList<tone_detector>();
+	pthread_mutex_init(&s->detection_mutex, NULL);
 
 	obs_get_audio_info(&s->oai);
 
@@ -72,15 +160,28 @@ void* ostws_filter_create_audioonly(obs_data_t* settings, obs_source_t* source)
 void ostws_filter_destroy_audioonly(void* data)
 {
 	auto s = (struct ostws_audiofilter*)data;
+	AudioAnalyzer::Instance->remove(s);
 	WSServer::Instance->remove_audio_filter(s);
+	delete s->ring;
+	delete s->detection;
+	delete s->thresholds;
+	delete s->tones;
+	pthread_mutex_destroy(&s->detection_mutex);
 	bfree(s);
 }
 
-float process_magnitude(const struct obs_audio_data* data, int nr_channels)
+// Raises the level accumulators with one buffer, scaled by the source volume.
+// Returns the levels of the buffer alone in `buffer_magnitude` and
+// `buffer_peak`.
+static void process_levels(struct ostws_audiofilter* s,
+	const struct obs_audio_data* data, int nr_channels, float mul,
+	float* buffer_magnitude, float* buffer_peak)
 {
 	size_t nr_samples = data->frames;
 
-	float magnitude = AUDIO_MIN;
+	float magnitude = 0.0f;
+	float peak = 0.0f;
+	float true_peak = 0.0f;
 
 	int channel_nr = 0;
 	for (int plane_nr = 0; channel_nr < nr_channels; plane_nr++)
@@ -91,19 +192,55 @@ float process_magnitude(const struct obs_audio_data* data, int nr_channels)
 			continue;
 		}
 
-		float sum = 0.0;
-		for (size_t i = 0; i < nr_samples; i++)
-		{
-			float sample = samples[i];
-			sum += sample * sample;
-		}
+		float sum, channel_peak;
+		audio_sum_squares_peak(samples, nr_samples, &sum, &channel_peak);
 		float yx = sqrtf(sum / nr_samples);
 		magnitude = fmax(magnitude, yx);
+		peak = fmax(peak, channel_peak);
+		true_peak = fmax(true_peak, audio_true_peak(samples, nr_samples,
+			s->true_peak_history[channel_nr]));
+
+		atomic_max_float(&s->channel_magnitude[channel_nr], mul_to_db(yx * mul));
+		atomic_max_float(&s->channel_peak[channel_nr], mul_to_db(channel_peak * mul));
 
 		channel_nr++;
 	}
 
-	return magnitude;
+	*buffer_magnitude = mul_to_db(magnitude * mul);
+	*buffer_peak = mul_to_db(peak * mul);
+	atomic_max_float(&s->magnitude, *buffer_magnitude);
+	atomic_max_float(&s->peak, *buffer_peak);
+	// The interpolated signal never peaks below its samples
+	atomic_max_float(&s->true_peak, mul_to_db(fmax(true_peak, peak) * mul));
+}
+
+static_assert(LOUDNESS_MAX_CHANNELS >= MAX_AUDIO_CHANNELS,
+	"the loudness meter must take every channel of a source");
+
+// Feeds the R128 meter, restarting it on request and on format changes
+static void process_loudness(struct ostws_audiofilter* s, float* const* planes,
+	uint32_t frames, int nr_channels, float mul)
+{
+	struct loudness_meter* meter = &s->loudness;
+	bool updated = false;
+	// os_atomic_set_bool returns the previous value
+	if (os_atomic_set_bool(&s->loudness_reset, false) ||
+		meter->sample_rate != s->oai.samples_per_sec ||
+		meter->nr_channels != nr_channels)
+	{
+		loudness_reset(meter, s->oai.samples_per_sec, nr_channels);
+		updated = true;
+	}
+
+	if (loudness_process(meter, planes, frames, mul))
+		updated = true;
+	if (!updated)
+		return;
+
+	os_atomic_set_long(&s->momentary, float_to_bits(meter->values.momentary));
+	os_atomic_set_long(&s->short_term, float_to_bits(meter->values.short_term));
+	os_atomic_set_long(&s->integrated, float_to_bits(meter->values.integrated));
+	os_atomic_set_long(&s->loudness_range, float_to_bits(meter->values.range));
 }
 
 static int get_nr_channels_from_audio_data(const struct obs_audio_data* data)
@@ -117,6 +254,112 @@ static int get_nr_channels_from_audio_data(const struct obs_audio_data* data)
 	return CLAMP(nr_channels, 0, MAX_AUDIO_CHANNELS);
 }
 
+// Queues the state changes of the rules for the AudioAnalyzer worker, which
+// sends the AudioThreshold events
+static void process_thresholds(struct ostws_audiofilter* s,
+	audio_detection_set* rules, float magnitude, float peak,
+	uint64_t timestamp, uint32_t frames)
+{
+	// data() of an empty vector allocates
+	if (rules->thresholds.isEmpty())
+		return;
+	uint64_t length = s->oai.samples_per_sec
+		? (uint64_t)frames * 1000000000ULL / s->oai.samples_per_sec : 0;
+
+	audio_threshold* thresholds = rules->thresholds.data();
+	for (int i = 0; i < rules->thresholds.count(); i++)
+	{
+		audio_threshold& threshold = thresholds[i];
+		if (!audio_threshold_process(&threshold, magnitude, peak, timestamp, length))
+			continue;
+
+		detection_event event;
+		event.type = detection_threshold;
+		event.id = threshold.id;
+		event.state = threshold.state;
+		event.level = threshold.meter == threshold_peak ? peak : magnitude;
+		event.timestamp = threshold.stateTimestamp;
+		s->detection->push(event);
+	}
+}
+
+// Channel average of the frames from `start` on
+static void mix_channels(float* const* planes, int nr_channels, size_t start,
+	size_t count, float* mix)
+{
+	float scale = 1.0f / nr_channels;
+	for (size_t i = 0; i < count; i++)
+		mix[i] = planes[0][start + i];
+	for (int channel = 1; channel < nr_channels; channel++)
+	{
+		for (size_t i = 0; i < count; i++)
+			mix[i] += planes[channel][start + i];
+	}
+	for (size_t i = 0; i < count; i++)
+		mix[i] *= scale;
+}
+
+// Runs the tone detectors over one buffer, block by block, on a channel
+// average mixed once for all of them, and queues their state changes for
+// the AudioAnalyzer worker, which sends the AudioTone events
+static void process_tones(struct ostws_audiofilter* s,
+	audio_detection_set* rules, float* const* planes, int nr_channels,
+	uint32_t frames, uint64_t timestamp)
+{
+	uint32_t sample_rate = s->oai.samples_per_sec;
+	// data() of an empty vector allocates
+	if (rules->tones.isEmpty() || nr_channels <= 0 || !sample_rate)
+		return;
+
+	tone_detector* tones = rules->tones.data();
+	for (int i = 0; i < rules->tones.count(); i++)
+	{
+		if (tones[i].sample_rate != sample_rate)
+			tone_detector_reset(&tones[i], sample_rate);
+	}
+
+	for (uint32_t start = 0; start < frames; start += TONE_MIX_FRAMES)
+	{
+		size_t count = qMin(frames - start, (uint32_t)TONE_MIX_FRAMES);
+		uint64_t mix_timestamp = timestamp
+			+ (uint64_t)start * 1000000000ULL / sample_rate;
+		mix_channels(planes, nr_channels, start, count, s->tone_mix);
+
+		for (int i = 0; i < rules->tones.count(); i++)
+		{
+			tone_detector& tone = tones[i];
+			size_t offset = 0;
+			while (offset < count)
+			{
+				bool changed;
+				offset += tone_detector_process(&tone, s->tone_mix, offset,
+					count, mix_timestamp, &changed);
+				if (!changed)
+					continue;
+
+				detection_event event;
+				event.type = detection_tone;
+				event.id = tone.id;
+				event.state = tone.state;
+				event.level = tone.level;
+				event.timestamp = tone.stateTimestamp;
+				s->detection->push(event);
+			}
+		}
+	}
+}
+
+static void get_planes_from_audio_data(const struct obs_audio_data* data,
+	int nr_channels, float** planes)
+{
+	int channel_nr = 0;
+	for (int plane_nr = 0; channel_nr < nr_channels; plane_nr++)
+	{
+		if (data->data[plane_nr])
+			planes[channel_nr++] = (float *)data->data[plane_nr];
+	}
+}
+
 struct obs_audio_data* ostws_filter_asyncaudio(void* data, struct obs_audio_data* audio_data)
 {
 	auto s = (struct ostws_audiofilter*)data;
@@ -126,20 +369,168 @@ struct obs_audio_data* ostws_filter_asyncaudio(void* data, struct obs_audio_data
 	obs_source* parentSource = obs_filter_get_parent(s->context);
 	int nr_channels = get_nr_channels_from_audio_data(audio_data);
 	float mul = obs_source_muted(parentSource) ? 0.0f : obs_source_get_volume(parentSource);
-	float magnitude = mul_to_db(process_magnitude(audio_data, nr_channels) * mul);
-
-	s->source_name = obs_source_get_name(parentSource);
-	s->magnitude = fmax(s->magnitude, magnitude);
-	s->mul = mul;
-	s->nr_channels = nr_channels;
+	float* planes[MAX_AUDIO_CHANNELS];
+	get_planes_from_audio_data(audio_data, nr_channels, planes);
+
+	// Analyses on the worker thread only cost a copy here
+	if (os_atomic_load_bool(&s->ring_enabled))
+		s->ring->write(planes, nr_channels, audio_data->frames,
+			audio_data->timestamp);
+
+	float magnitude, peak;
+	process_levels(s, audio_data, nr_channels, mul, &magnitude, &peak);
+	audio_detection_set* rules = s->detection->acquire();
+	process_thresholds(s, rules, magnitude, peak, audio_data->timestamp,
+		audio_data->frames);
+	process_tones(s, rules, planes, nr_channels, audio_data->frames,
+		audio_data->timestamp);
+	process_loudness(s, planes, audio_data->frames, nr_channels, mul);
+
+	os_atomic_set_long(&s->mul, float_to_bits(mul));
+	os_atomic_set_long(&s->nr_channels, nr_channels);
 
 	return audio_data;
 }
 
+static int power_of_two_at_most(int value)
+{
+	int power = 1;
+	while (power * 2 <= value)
+		power *= 2;
+	return power;
+}
+
+// Fills `rules` and the listing the worker names the events from, called
+// with detection_mutex held. The audio thread gets its own copy, so that
+// writing the states never detaches a vector shared with the listing.
+static void update_thresholds(struct ostws_audiofilter* s,
+	obs_data_t* settings, audio_detection_set* rules)
+{
+	// Rules that keep their name keep their id and state
+	QHash<QByteArray, audio_threshold> previous;
+	for (const audio_threshold& threshold : *s->thresholds)
+		previous.insert(threshold.name, threshold);
+	s->thresholds->clear();
+
+	OBSDataArrayAutoRelease thresholds = obs_data_get_array(settings, "thresholds");
+	for (size_t i = 0; i < obs_data_array_count(thresholds); i++)
+	{
+		OBSDataAutoRelease item = obs_data_array_item(thresholds, i);
+		audio_threshold threshold;
+		threshold.name = obs_data_get_string(item, "name");
+		threshold.name_string = QString::fromUtf8(threshold.name);
+
+		auto kept = previous.find(threshold.name);
+		if (kept != previous.end())
+		{
+			threshold.id = kept->id;
+			threshold.state = kept->state;
+			threshold.stateTimestamp = kept->stateTimestamp;
+			previous.erase(kept);
+		}
+		else
+		{
+			threshold.id = ++s->next_threshold_id;
+		}
+
+		threshold.meter = strcmp(obs_data_get_string(item, "meter"), "peak") == 0
+			? threshold_peak : threshold_magnitude;
+		if (obs_data_has_user_value(item, "level"))
+			threshold.level = (float)obs_data_get_double(item, "level");
+		threshold.below = obs_data_get_bool(item, "below");
+		threshold.hysteresis = (float)fmax(obs_data_get_double(item, "hysteresis"), 0.0);
+		threshold.duration = (uint64_t)qMax(obs_data_get_int(item, "duration"), 0LL) * 1000000;
+		s->thresholds->append(threshold);
+		rules->thresholds.append(threshold);
+	}
+}
+
+// Like update_thresholds
+static void update_tones(struct ostws_audiofilter* s, obs_data_t* settings,
+	audio_detection_set* rules)
+{
+	// Detectors that keep their name keep their id and state
+	QHash<QByteArray, tone_detector> previous;
+	for (const tone_detector& tone : *s->tones)
+		previous.insert(tone.name, tone);
+	s->tones->clear();
+
+	OBSDataArrayAutoRelease tones = obs_data_get_array(settings, "tones");
+	for (size_t i = 0; i < obs_data_array_count(tones); i++)
+	{
+		OBSDataAutoRelease item = obs_data_array_item(tones, i);
+		tone_detector tone;
+		tone.name = obs_data_get_string(item, "name");
+		tone.name_string = QString::fromUtf8(tone.name);
+
+		auto kept = previous.find(tone.name);
+		if (kept != previous.end())
+		{
+			tone.id = kept->id;
+			tone.state = kept->state;
+			tone.stateTimestamp = kept->stateTimestamp;
+			previous.erase(kept);
+		}
+		else
+		{
+			tone.id = ++s->next_tone_id;
+		}
+
+		double nyquist = s->oai.samples_per_sec / 2.0;
+		if (obs_data_has_user_value(item, "frequency"))
+			tone.frequency = CLAMP(obs_data_get_double(item, "frequency"), 1.0, nyquist);
+		// At least 5 ms blocks
+		if (obs_data_has_user_value(item, "bandwidth"))
+			tone.bandwidth = CLAMP(obs_data_get_double(item, "bandwidth"), 1.0, 200.0);
+		if (obs_data_has_user_value(item, "threshold"))
+			tone.threshold = (float)obs_data_get_double(item, "threshold");
+		if (obs_data_has_user_value(item, "hysteresis"))
+			tone.hysteresis = (float)fmax(obs_data_get_double(item, "hysteresis"), 0.0);
+		tone.duration = (uint64_t)qMax(obs_data_get_int(item, "duration"), 0LL) * 1000000;
+		tone_detector_reset(&tone, s->oai.samples_per_sec);
+		s->tones->append(tone);
+		rules->tones.append(tone);
+	}
+}
+
 void ostws_audiofilter_update(void* data, obs_data_t* settings)
 {
-	UNUSED_PARAMETER(settings);
 	auto s = (struct ostws_audiofilter*)data;
+	auto rules = new audio_detection_set();
+	pthread_mutex_lock(&s->detection_mutex);
+	update_thresholds(s, settings, rules);
+	update_tones(s, settings, rules);
+	bool detecting = !rules->thresholds.isEmpty() || !rules->tones.isEmpty();
+	s->detection->publish(rules);
+	pthread_mutex_unlock(&s->detection_mutex);
+	AudioAnalyzer::Instance->configure_detection(s, detecting);
+
+	audio_spectrum_config spectrum;
+	spectrum.enabled = obs_data_get_bool(settings, "spectrum");
+	spectrum.bands = CLAMP((int)obs_data_get_int(settings, "spectrumBands"),
+		1, SPECTRUM_MAX_BANDS);
+	spectrum.rate = CLAMP((int)obs_data_get_int(settings, "spectrumRate"),
+		1, SPECTRUM_MAX_RATE);
+	spectrum.size = power_of_two_at_most(CLAMP(
+		(int)obs_data_get_int(settings, "spectrumSize"),
+		SPECTRUM_MIN_SIZE, SPECTRUM_MAX_SIZE));
+	spectrum.min_frequency = CLAMP(
+		obs_data_get_double(settings, "spectrumMinFrequency"), 1.0, 96000.0);
+	spectrum.max_frequency = CLAMP(
+		obs_data_get_double(settings, "spectrumMaxFrequency"),
+		spectrum.min_frequency, 96000.0);
+	AudioAnalyzer::Instance->configure_spectrum(s, spectrum);
+
+	audio_rhythm_config rhythm;
+	rhythm.onsets = obs_data_get_bool(settings, "onsets");
+	rhythm.beats = obs_data_get_bool(settings, "beats");
+	rhythm.threshold = CLAMP(obs_data_get_double(settings, "onsetThreshold"),
+		1.0, 10.0);
+	rhythm.min_bpm = CLAMP(obs_data_get_double(settings, "beatMinBpm"),
+		30.0, 300.0);
+	rhythm.max_bpm = CLAMP(obs_data_get_double(settings, "beatMaxBpm"),
+		rhythm.min_bpm, 300.0);
+	AudioAnalyzer::Instance->configure_rhythm(s, rhythm);
 }
 
 struct obs_source_info create_ostws_audiofilter_info()
@@ -1,21 +1,93 @@
 #ifndef AUDIOFILTER_H
 #define AUDIOFILTER_H
 #include <obs.h>
+#include <util/threading.h>
+#include <QList>
+
+#include "AudioKernels.h"
+#include "AudioThreshold.h"
+#include "Loudness.h"
+#include "ToneDetector.h"
+
+class AudioDetection;
+class AudioRing;
 
 #define AUDIO_MIN -10000000
+// Frames of the channel average the tone detectors run on at a time
+#define TONE_MIX_FRAMES 1024
 
+/**
+ * Written by the audio thread, read by the audio broadcast cycle. Levels are
+ * float bits in atomics: the audio thread raises them with a compare-and-swap
+ * max and the cycle takes and resets them with one exchange, so neither side
+ * ever waits on the other and no peak between two cycles is lost.
+ */
 struct ostws_audiofilter
 {
 	obs_source_t* context;
 	struct obs_audio_info oai;
+	// Identifies the source in compact AudioUpdates (see GetAudioFilters)
+	uint32_t id;
 
 	bool is_audioonly;
 
-	const char* source_name;
+	volatile long magnitude;
+	volatile long peak;
+	volatile long true_peak;
+	volatile long channel_magnitude[MAX_AUDIO_CHANNELS];
+	volatile long channel_peak[MAX_AUDIO_CHANNELS];
+	volatile long mul;
+	volatile long nr_channels;
+	// Latest EBU R128 values, see loudness_values
+	volatile long momentary;
+	volatile long short_term;
+	volatile long integrated;
+	volatile long loudness_range;
+	// Set by ResetLoudness, the audio thread starts a new measurement
+	volatile bool loudness_reset;
+
+	// Input of the worker thread analyses (see AudioAnalyzer), filled by
+	// the audio thread while ring_enabled is set
+	AudioRing* ring;
+	volatile bool ring_enabled;
+
+	// Hands the threshold rules and tone detectors to the audio thread and
+	// their state changes to the AudioAnalyzer worker, see AudioDetection
+	AudioDetection* detection;
+	// Rules and detectors as listed by GetAudioFilters and named in the
+	// events, with the state the worker last sent. Never touched by the
+	// audio thread.
+	pthread_mutex_t detection_mutex;
+	QList<audio_threshold>* thresholds;
+	uint32_t next_threshold_id;
+	QList<tone_detector>* tones;
+	uint32_t next_tone_id;
+
+	// Audio thread only, last samples of each channel for the true peak
+	float true_peak_history[MAX_AUDIO_CHANNELS][AUDIO_TRUE_PEAK_HISTORY];
+	// Audio thread only, channel average for the tone detectors
+	float tone_mix[TONE_MIX_FRAMES];
+	struct loudness_meter loudness;
+};
+
+// Levels in dB, `magnitude` is the RMS of the loudest channel
+struct ostws_audio_levels
+{
 	float magnitude;
 	float peak;
+	float true_peak;
+	float channel_magnitude[MAX_AUDIO_CHANNELS];
+	float channel_peak[MAX_AUDIO_CHANNELS];
 	float mul;
 	int nr_channels;
+	// LUFS and LU, not reset by taking them
+	float momentary;
+	float short_term;
+	float integrated;
+	float loudness_range;
 };
 
+// Levels since the previous call, the maxima start over from AUDIO_MIN
+struct ostws_audio_levels ostws_audiofilter_take_levels(struct ostws_audiofilter* s);
+
 #endif // AUDIOFILTER_H
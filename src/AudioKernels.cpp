@@ -0,0 +1,380 @@
+#include <math.h>
+#include <string.h>
+
+#include "AudioKernels.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define AUDIO_KERNELS_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+// MSVC compiles AVX intrinsics without a per-function target
+#define AUDIO_KERNELS_AVX_TARGET
+#else
+#define AUDIO_KERNELS_AVX_TARGET __attribute__((target("avx")))
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64) || defined(__ARM_NEON)
+#define AUDIO_KERNELS_NEON
+#include <arm_neon.h>
+#endif
+
+typedef void (*sum_squares_peak_func)(const float* samples, size_t count,
+	float* sum_squares, float* peak);
+
+static void sum_squares_peak_scalar(const float* samples, size_t count,
+	float* sum_squares, float* peak)
+{
+	float sum = 0.0f;
+	float max = 0.0f;
+	for (size_t i = 0; i < count; i++)
+	{
+		float sample = samples[i];
+		sum += sample * sample;
+		max = fmaxf(max, fabsf(sample));
+	}
+	*sum_squares = sum;
+	*peak = max;
+}
+
+#ifdef AUDIO_KERNELS_X86
+static void reduce_sse(__m128 sum, __m128 max, float* sum_squares,
+	float* peak)
+{
+	float sums[4];
+	float maxs[4];
+	_mm_storeu_ps(sums, sum);
+	_mm_storeu_ps(maxs, max);
+	*sum_squares = (sums[0] + sums[1]) + (sums[2] + sums[3]);
+	*peak = fmaxf(fmaxf(maxs[0], maxs[1]), fmaxf(maxs[2], maxs[3]));
+}
+
+// Two independent accumulators hide the add latency
+static void sum_squares_peak_sse2(const float* samples, size_t count,
+	float* sum_squares, float* peak)
+{
+	const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+	__m128 sum0 = _mm_setzero_ps();
+	__m128 sum1 = _mm_setzero_ps();
+	__m128 max0 = _mm_setzero_ps();
+	__m128 max1 = _mm_setzero_ps();
+
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		__m128 a = _mm_loadu_ps(samples + i);
+		__m128 b = _mm_loadu_ps(samples + i + 4);
+		sum0 = _mm_add_ps(sum0, _mm_mul_ps(a, a));
+		sum1 = _mm_add_ps(sum1, _mm_mul_ps(b, b));
+		max0 = _mm_max_ps(max0, _mm_and_ps(a, abs_mask));
+		max1 = _mm_max_ps(max1, _mm_and_ps(b, abs_mask));
+	}
+
+	float tail_sum, tail_peak;
+	sum_squares_peak_scalar(samples + i, count - i, &tail_sum, &tail_peak);
+	reduce_sse(_mm_add_ps(sum0, sum1), _mm_max_ps(max0, max1),
+		sum_squares, peak);
+	*sum_squares += tail_sum;
+	*peak = fmaxf(*peak, tail_peak);
+}
+
+AUDIO_KERNELS_AVX_TARGET
+static void sum_squares_peak_avx(const float* samples, size_t count,
+	float* sum_squares, float* peak)
+{
+	const __m256 abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF));
+	__m256 sum0 = _mm256_setzero_ps();
+	__m256 sum1 = _mm256_setzero_ps();
+	__m256 max0 = _mm256_setzero_ps();
+	__m256 max1 = _mm256_setzero_ps();
+
+	size_t i = 0;
+	for (; i + 16 <= count; i += 16)
+	{
+		__m256 a = _mm256_loadu_ps(samples + i);
+		__m256 b = _mm256_loadu_ps(samples + i + 8);
+		sum0 = _mm256_add_ps(sum0, _mm256_mul_ps(a, a));
+		sum1 = _mm256_add_ps(sum1, _mm256_mul_ps(b, b));
+		max0 = _mm256_max_ps(max0, _mm256_and_ps(a, abs_mask));
+		max1 = _mm256_max_ps(max1, _mm256_and_ps(b, abs_mask));
+	}
+	sum0 = _mm256_add_ps(sum0, sum1);
+	max0 = _mm256_max_ps(max0, max1);
+
+	__m128 sum = _mm_add_ps(_mm256_castps256_ps128(sum0),
+		_mm256_extractf128_ps(sum0, 1));
+	__m128 max = _mm_max_ps(_mm256_castps256_ps128(max0),
+		_mm256_extractf128_ps(max0, 1));
+	_mm256_zeroupper();
+
+	float tail_sum, tail_peak;
+	sum_squares_peak_scalar(samples + i, count - i, &tail_sum, &tail_peak);
+	reduce_sse(sum, max, sum_squares, peak);
+	*sum_squares += tail_sum;
+	*peak = fmaxf(*peak, tail_peak);
+}
+
+static bool cpu_has_avx()
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 1);
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	bool avx = (info[2] & (1 << 28)) != 0;
+	// The OS must also save the YMM registers on context switches
+	return osxsave && avx && (_xgetbv(0) & 6) == 6;
+#else
+	return __builtin_cpu_supports("avx");
+#endif
+}
+#endif
+
+#ifdef AUDIO_KERNELS_NEON
+static void sum_squares_peak_neon(const float* samples, size_t count,
+	float* sum_squares, float* peak)
+{
+	float32x4_t sum0 = vdupq_n_f32(0.0f);
+	float32x4_t sum1 = vdupq_n_f32(0.0f);
+	float32x4_t max0 = vdupq_n_f32(0.0f);
+	float32x4_t max1 = vdupq_n_f32(0.0f);
+
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8)
+	{
+		float32x4_t a = vld1q_f32(samples + i);
+		float32x4_t b = vld1q_f32(samples + i + 4);
+		sum0 = vmlaq_f32(sum0, a, a);
+		sum1 = vmlaq_f32(sum1, b, b);
+		max0 = vmaxq_f32(max0, vabsq_f32(a));
+		max1 = vmaxq_f32(max1, vabsq_f32(b));
+	}
+	sum0 = vaddq_f32(sum0, sum1);
+	max0 = vmaxq_f32(max0, max1);
+
+	float sums[4];
+	float maxs[4];
+	vst1q_f32(sums, sum0);
+	vst1q_f32(maxs, max0);
+
+	float tail_sum, tail_peak;
+	sum_squares_peak_scalar(samples + i, count - i, &tail_sum, &tail_peak);
+	*sum_squares = (sums[0] + sums[1]) + (sums[2] + sums[3]) + tail_sum;
+	*peak = fmaxf(fmaxf(fmaxf(maxs[0], maxs[1]), fmaxf(maxs[2], maxs[3])),
+		tail_peak);
+}
+#endif
+
+// Polyphase form of the 48 tap filter, one row per output phase
+static const float true_peak_coefficients[4][AUDIO_TRUE_PEAK_HISTORY + 1] = {
+	{ 0.0017089843750f, 0.0109863281250f, -0.0196533203125f,
+	  0.0332031250000f, -0.0594482421875f, 0.1373291015625f,
+	  0.9721679687500f, -0.1022949218750f, 0.0476074218750f,
+	  -0.0266113281250f, 0.0148925781250f, -0.0083007812500f },
+	{ -0.0291748046875f, 0.0292968750000f, -0.0517578125000f,
+	  0.0891113281250f, -0.1665039062500f, 0.4650878906250f,
+	  0.7797851562500f, -0.2003173828125f, 0.1015625000000f,
+	  -0.0582275390625f, 0.0330810546875f, -0.0189208984375f },
+	{ -0.0189208984375f, 0.0330810546875f, -0.0582275390625f,
+	  0.1015625000000f, -0.2003173828125f, 0.7797851562500f,
+	  0.4650878906250f, -0.1665039062500f, 0.0891113281250f,
+	  -0.0517578125000f, 0.0292968750000f, -0.0291748046875f },
+	{ -0.0083007812500f, 0.0148925781250f, -0.0266113281250f,
+	  0.0476074218750f, -0.1022949218750f, 0.9721679687500f,
+	  0.1373291015625f, -0.0594482421875f, 0.0332031250000f,
+	  -0.0196533203125f, 0.0109863281250f, 0.0017089843750f },
+};
+
+#define TRUE_PEAK_TAPS (AUDIO_TRUE_PEAK_HISTORY + 1)
+
+// Input sample n - tap, reaching back into the previous buffer
+static inline float true_peak_input(const float* samples, const float* history,
+	size_t n, int tap)
+{
+	return (size_t)tap <= n
+		? samples[n - tap]
+		: history[AUDIO_TRUE_PEAK_HISTORY - (tap - n)];
+}
+
+// Outputs for the first samples, whose taps partly lie in `history`
+static float true_peak_head(const float* samples, size_t count,
+	const float* history, size_t* done)
+{
+	float max = 0.0f;
+	size_t head = count < AUDIO_TRUE_PEAK_HISTORY ? count : AUDIO_TRUE_PEAK_HISTORY;
+	for (size_t n = 0; n < head; n++)
+	{
+		for (int phase = 0; phase < 4; phase++)
+		{
+			float sum = 0.0f;
+			for (int tap = 0; tap < TRUE_PEAK_TAPS; tap++)
+				sum += true_peak_coefficients[phase][tap] *
+					true_peak_input(samples, history, n, tap);
+			max = fmaxf(max, fabsf(sum));
+		}
+	}
+	*done = head;
+	return max;
+}
+
+static void true_peak_keep_history(const float* samples, size_t count,
+	float* history)
+{
+	float previous[AUDIO_TRUE_PEAK_HISTORY];
+	memcpy(previous, history, sizeof(previous));
+	for (int i = 0; i < AUDIO_TRUE_PEAK_HISTORY; i++)
+	{
+		// Sample i of the last AUDIO_TRUE_PEAK_HISTORY, oldest first
+		size_t back = AUDIO_TRUE_PEAK_HISTORY - i;
+		history[i] = back <= count
+			? samples[count - back]
+			: previous[AUDIO_TRUE_PEAK_HISTORY - (back - count)];
+	}
+}
+
+static float true_peak_scalar(const float* samples, size_t count,
+	float* history)
+{
+	size_t n;
+	float max = true_peak_head(samples, count, history, &n);
+	for (; n < count; n++)
+	{
+		for (int phase = 0; phase < 4; phase++)
+		{
+			float sum = 0.0f;
+			for (int tap = 0; tap < TRUE_PEAK_TAPS; tap++)
+				sum += true_peak_coefficients[phase][tap] * samples[n - tap];
+			max = fmaxf(max, fabsf(sum));
+		}
+	}
+	true_peak_keep_history(samples, count, history);
+	return max;
+}
+
+// The four phases of one input sample fill one vector: each tap multiplies
+// the broadcast input by the column of coefficients for that tap
+#ifdef AUDIO_KERNELS_X86
+static float true_peak_sse2(const float* samples, size_t count,
+	float* history)
+{
+	const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+	__m128 columns[TRUE_PEAK_TAPS];
+	for (int tap = 0; tap < TRUE_PEAK_TAPS; tap++)
+		columns[tap] = _mm_setr_ps(true_peak_coefficients[0][tap],
+			true_peak_coefficients[1][tap], true_peak_coefficients[2][tap],
+			true_peak_coefficients[3][tap]);
+
+	size_t n;
+	float head = true_peak_head(samples, count, history, &n);
+	__m128 max = _mm_setzero_ps();
+	for (; n < count; n++)
+	{
+		__m128 sum = _mm_setzero_ps();
+		for (int tap = 0; tap < TRUE_PEAK_TAPS; tap++)
+			sum = _mm_add_ps(sum, _mm_mul_ps(columns[tap],
+				_mm_set1_ps(samples[n - tap])));
+		max = _mm_max_ps(max, _mm_and_ps(sum, abs_mask));
+	}
+
+	float maxs[4];
+	_mm_storeu_ps(maxs, max);
+	true_peak_keep_history(samples, count, history);
+	return fmaxf(head, fmaxf(fmaxf(maxs[0], maxs[1]), fmaxf(maxs[2], maxs[3])));
+}
+#endif
+
+#ifdef AUDIO_KERNELS_NEON
+static float true_peak_neon(const float* samples, size_t count,
+	float* history)
+{
+	float32x4_t columns[TRUE_PEAK_TAPS];
+	for (int tap = 0; tap < TRUE_PEAK_TAPS; tap++)
+	{
+		float column[4] = { true_peak_coefficients[0][tap],
+			true_peak_coefficients[1][tap], true_peak_coefficients[2][tap],
+			true_peak_coefficients[3][tap] };
+		columns[tap] = vld1q_f32(column);
+	}
+
+	size_t n;
+	float head = true_peak_head(samples, count, history, &n);
+	float32x4_t max = vdupq_n_f32(0.0f);
+	for (; n < count; n++)
+	{
+		float32x4_t sum = vdupq_n_f32(0.0f);
+		for (int tap = 0; tap < TRUE_PEAK_TAPS; tap++)
+			sum = vmlaq_n_f32(sum, columns[tap], samples[n - tap]);
+		max = vmaxq_f32(max, vabsq_f32(sum));
+	}
+
+	float maxs[4];
+	vst1q_f32(maxs, max);
+	true_peak_keep_history(samples, count, history);
+	return fmaxf(head, fmaxf(fmaxf(maxs[0], maxs[1]), fmaxf(maxs[2], maxs[3])));
+}
+#endif
+
+static sum_squares_peak_func select_sum_squares_peak()
+{
+#if defined(AUDIO_KERNELS_X86)
+	return cpu_has_avx() ? sum_squares_peak_avx : sum_squares_peak_sse2;
+#elif defined(AUDIO_KERNELS_NEON)
+	return sum_squares_peak_neon;
+#else
+	return sum_squares_peak_scalar;
+#endif
+}
+
+void audio_sum_squares_peak(const float* samples, size_t count,
+	float* sum_squares, float* peak)
+{
+	static const sum_squares_peak_func kernel = select_sum_squares_peak();
+	kernel(samples, count, sum_squares, peak);
+}
+
+size_t audio_sum_squares_peak_kernels(
+	const audio_sum_squares_peak_kernel** kernels)
+{
+	static const audio_sum_squares_peak_kernel all[] = {
+		{ "scalar", sum_squares_peak_scalar },
+#if defined(AUDIO_KERNELS_X86)
+		{ "sse2", sum_squares_peak_sse2 },
+		{ "avx", sum_squares_peak_avx },
+#elif defined(AUDIO_KERNELS_NEON)
+		{ "neon", sum_squares_peak_neon },
+#endif
+	};
+
+	size_t count = sizeof(all) / sizeof(all[0]);
+#ifdef AUDIO_KERNELS_X86
+	// AVX is last
+	if (!cpu_has_avx())
+		count--;
+#endif
+	*kernels = all;
+	return count;
+}
+
+float audio_true_peak(const float* samples, size_t count, float* history)
+{
+#if defined(AUDIO_KERNELS_X86)
+	return true_peak_sse2(samples, count, history);
+#elif defined(AUDIO_KERNELS_NEON)
+	return true_peak_neon(samples, count, history);
+#else
+	return true_peak_scalar(samples, count, history);
+#endif
+}
+
+size_t audio_true_peak_kernels(const audio_true_peak_kernel** kernels)
+{
+	static const audio_true_peak_kernel all[] = {
+		{ "scalar", true_peak_scalar },
+#if defined(AUDIO_KERNELS_X86)
+		{ "sse2", true_peak_sse2 },
+#elif defined(AUDIO_KERNELS_NEON)
+		{ "neon", true_peak_neon },
+#endif
+	};
+
+	*kernels = all;
+	return sizeof(all) / sizeof(all[0]);
+}
@@ -0,0 +1,51 @@
+#ifndef AUDIOKERNELS_H
+#define AUDIOKERNELS_H
+
+#include <stddef.h>
+
+/**
+ * Sum of squares and largest absolute value of `count` samples, in a single
+ * pass. Runs on the widest vector unit available (AVX or SSE2 on x86, NEON
+ * on ARM), selected on first use, with a scalar fallback elsewhere.
+ */
+void audio_sum_squares_peak(const float* samples, size_t count,
+	float* sum_squares, float* peak);
+
+// One implementation of audio_sum_squares_peak
+struct audio_sum_squares_peak_kernel
+{
+	const char* name;
+	void (*func)(const float* samples, size_t count, float* sum_squares,
+		float* peak);
+};
+
+/**
+ * The implementations of audio_sum_squares_peak this build has and the CPU
+ * runs, the scalar one first, for comparing them in tests and benchmarks.
+ * Returns their number.
+ */
+size_t audio_sum_squares_peak_kernels(
+	const audio_sum_squares_peak_kernel** kernels);
+
+// Samples of the previous buffer the true peak filter still reads
+#define AUDIO_TRUE_PEAK_HISTORY 11
+
+/**
+ * Largest absolute value of the signal upsampled 4x with the interpolation
+ * filter of ITU-R BS.1770-4 Annex 2. `history` holds the last
+ * AUDIO_TRUE_PEAK_HISTORY samples of the channel (zeros before the first
+ * buffer) and is updated for the next call.
+ */
+float audio_true_peak(const float* samples, size_t count, float* history);
+
+// One implementation of audio_true_peak
+struct audio_true_peak_kernel
+{
+	const char* name;
+	float (*func)(const float* samples, size_t count, float* history);
+};
+
+// Like audio_sum_squares_peak_kernels, for audio_true_peak
+size_t audio_true_peak_kernels(const audio_true_peak_kernel** kernels);
+
+#endif // AUDIOKERNELS_H
@@ -0,0 +1,97 @@
+#include <string.h>
+
+#include "AudioRing.h"
+
+// Split so that days of audio don't overflow the multiplication
+static int64_t frames_to_ns(uint64_t frames, uint32_t sampleRate)
+{
+	return (int64_t)((frames / sampleRate) * 1000000000ULL +
+		(frames % sampleRate) * 1000000000ULL / sampleRate);
+}
+
+AudioRing::AudioRing(int channels, uint32_t capacity, uint32_t sampleRate)
+	: _channels(channels),
+	  _capacity(capacity),
+	  _sampleRate(sampleRate),
+	  _data(new float[(size_t)channels * capacity]()),
+	  _written(0),
+	  _writing(0),
+	  _timestampBase(0)
+{
+}
+
+AudioRing::~AudioRing()
+{
+	delete[] _data;
+}
+
+void AudioRing::write(float* const* planes, int channels, uint32_t frames,
+	uint64_t timestamp)
+{
+	uint64_t written = _written.load(std::memory_order_relaxed);
+	_timestampBase.store((int64_t)timestamp - frames_to_ns(written, _sampleRate),
+		std::memory_order_relaxed);
+
+	// Only the newest frames of an oversized buffer fit
+	uint32_t skipped = frames > _capacity ? frames - _capacity : 0;
+	uint32_t offset = (uint32_t)((written + skipped) & (_capacity - 1));
+	uint32_t count = frames - skipped;
+	uint32_t first = count < _capacity - offset ? count : _capacity - offset;
+
+	_writing.store(written + frames, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	if (channels > _channels)
+		channels = _channels;
+	for (int channel = 0; channel < channels; channel++)
+	{
+		const float* samples = planes[channel] + skipped;
+		float* ring = _data + (size_t)channel * _capacity;
+		memcpy(ring + offset, samples, first * sizeof(float));
+		memcpy(ring, samples + first, (count - first) * sizeof(float));
+	}
+
+	_written.store(written + frames, std::memory_order_release);
+}
+
+uint64_t AudioRing::written() const
+{
+	return _written.load(std::memory_order_acquire);
+}
+
+bool AudioRing::available(uint64_t position, uint32_t frames,
+	uint64_t written, uint64_t writing) const
+{
+	return position + frames <= written && writing - position <= _capacity;
+}
+
+bool AudioRing::readMono(uint64_t position, uint32_t frames, float* mono) const
+{
+	uint64_t end = written();
+	if (!available(position, frames, end, end))
+		return false;
+
+	memset(mono, 0, frames * sizeof(float));
+	for (int channel = 0; channel < _channels; channel++)
+	{
+		const float* ring = _data + (size_t)channel * _capacity;
+		for (uint32_t i = 0; i < frames; i++)
+			mono[i] += ring[(position + i) & (_capacity - 1)];
+	}
+
+	float scale = 1.0f / _channels;
+	for (uint32_t i = 0; i < frames; i++)
+		mono[i] *= scale;
+
+	// The writer may have started overwriting the frames while they
+	// were copied
+	std::atomic_thread_fence(std::memory_order_acquire);
+	return available(position, frames, end,
+		_writing.load(std::memory_order_relaxed));
+}
+
+uint64_t AudioRing::timestamp(uint64_t position) const
+{
+	return (uint64_t)(_timestampBase.load(std::memory_order_relaxed) +
+		frames_to_ns(position, _sampleRate));
+}
@@ -0,0 +1,53 @@
+#ifndef AUDIORING_H
+#define AUDIORING_H
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Single producer, single consumer ring of planar float samples. The audio
+ * thread only copies buffers in and never waits; the reader addresses
+ * frames by their absolute position and learns after copying whether the
+ * writer overran them meanwhile.
+ */
+class AudioRing
+{
+public:
+	// `capacity` in frames, a power of two
+	AudioRing(int channels, uint32_t capacity, uint32_t sampleRate);
+	~AudioRing();
+
+	// Audio thread: appends one buffer, planes beyond channels() are ignored
+	void write(float* const* planes, int channels, uint32_t frames,
+		uint64_t timestamp);
+
+	// Frames written so far, the position after the newest frame
+	uint64_t written() const;
+	// Copies `frames` frames from `position` on, averaged over the
+	// channels. Returns false if they aren't (or no longer) in the ring.
+	bool readMono(uint64_t position, uint32_t frames, float* mono) const;
+	// OBS timestamp of the frame at `position`
+	uint64_t timestamp(uint64_t position) const;
+
+	int channels() const { return _channels; }
+	uint32_t capacity() const { return _capacity; }
+	uint32_t sampleRate() const { return _sampleRate; }
+
+private:
+	bool available(uint64_t position, uint32_t frames, uint64_t written,
+		uint64_t writing) const;
+
+	int _channels;
+	uint32_t _capacity;
+	uint32_t _sampleRate;
+	// Channel c starts at c * _capacity
+	float* _data;
+	std::atomic<uint64_t> _written;
+	// Raised before a buffer is copied in, like the sequence of a seqlock
+	std::atomic<uint64_t> _writing;
+	// Timestamp of position 0, refreshed from every buffer
+	std::atomic<int64_t> _timestampBase;
+};
+
+#endif // AUDIORING_H
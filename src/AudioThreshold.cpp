@@ -0,0 +1,45 @@
+#include "AudioThreshold.h"
+
+bool audio_threshold_process(struct audio_threshold* threshold,
+	float magnitude, float peak, uint64_t timestamp, uint64_t length)
+{
+	float value = threshold->meter == threshold_peak ? peak : magnitude;
+
+	if (threshold->state)
+	{
+		bool released = threshold->below
+			? value > threshold->level + threshold->hysteresis
+			: value < threshold->level - threshold->hysteresis;
+		if (!released)
+			return false;
+
+		threshold->state = false;
+		threshold->stateTimestamp = timestamp;
+		return true;
+	}
+
+	bool past = threshold->below
+		? value <= threshold->level
+		: value >= threshold->level;
+	if (!past)
+	{
+		threshold->crossed = false;
+		return false;
+	}
+
+	if (!threshold->crossed)
+	{
+		threshold->crossed = true;
+		threshold->crossedTimestamp = timestamp;
+	}
+
+	// The level is only known per buffer, the state changes within the
+	// buffer the duration ends in
+	if (timestamp + length - threshold->crossedTimestamp < threshold->duration)
+		return false;
+
+	threshold->state = true;
+	threshold->crossed = false;
+	threshold->stateTimestamp = threshold->crossedTimestamp + threshold->duration;
+	return true;
+}
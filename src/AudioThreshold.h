@@ -0,0 +1,49 @@
+#ifndef AUDIOTHRESHOLD_H
+#define AUDIOTHRESHOLD_H
+
+#include <stdint.h>
+#include <QByteArray>
+#include <QString>
+
+enum audio_threshold_meter
+{
+	threshold_magnitude,
+	threshold_peak
+};
+
+/**
+ * Level rule of an audio filter, evaluated on every buffer by the audio
+ * thread. The state turns on once the level stayed at or past `level`
+ * (above it, or below it with `below`) for `duration`, and turns off as
+ * soon as it moves back by more than `hysteresis`. Levels are in dB after
+ * the source volume, like in AudioUpdate. Names are kept as UTF-8 for the
+ * serialized events and as QString for subscription matching, ids stay the
+ * same across settings updates for rules whose names don't change.
+ */
+struct audio_threshold
+{
+	QByteArray name;
+	QString name_string;
+	uint32_t id = 0;
+	audio_threshold_meter meter = threshold_magnitude;
+	float level = -40.0f;
+	bool below = false;
+	float hysteresis = 0.0f;
+	// In ns
+	uint64_t duration = 0;
+
+	bool state = false;
+	uint64_t stateTimestamp = 0;
+	// Whether the level is past `level` while the state is off, since the
+	// buffer starting at crossedTimestamp
+	bool crossed = false;
+	uint64_t crossedTimestamp = 0;
+};
+
+// Feeds the levels (dB) of one buffer starting at `timestamp` and lasting
+// `length` ns. Returns true when the state changed, stateTimestamp is then
+// the time it changed at.
+bool audio_threshold_process(struct audio_threshold* threshold,
+	float magnitude, float peak, uint64_t timestamp, uint64_t length);
+
+#endif // AUDIOTHRESHOLD_H
@@ -0,0 +1,270 @@
+#include <math.h>
+#include <string.h>
+
+#include "BeatTracker.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// Hops of flux the onset threshold averages
+#define ONSET_AVERAGE_HOPS 16
+// Flux onsets need whatever the average, for near silence
+#define ONSET_MIN_FLUX 0.01f
+// Shortest time between two onsets, in seconds
+#define ONSET_MIN_INTERVAL 0.05
+// Compression of the magnitudes, log(1 + C * magnitude)
+#define FLUX_COMPRESSION 100.0f
+// Beats within this share of the period of an onset get pulled towards it
+#define BEAT_TOLERANCE 0.15
+#define BEAT_CORRECTION 0.3
+// Comb phase further off than this share of the period replaces the beats
+#define BEAT_RESYNC 0.2
+#define BEAT_COMB_TEETH 4
+
+BeatTracker::BeatTracker(uint32_t sampleRate, const audio_rhythm_config& config)
+	: _config(config),
+	  _hopRate((double)sampleRate / RHYTHM_HOP),
+	  _fft(RHYTHM_FRAME_SIZE)
+{
+	_window.resize(RHYTHM_FRAME_SIZE);
+	double sum = 0.0;
+	for (int i = 0; i < RHYTHM_FRAME_SIZE; i++)
+	{
+		_window[i] = (float)(0.5 - 0.5 * cos(2.0 * M_PI * i / RHYTHM_FRAME_SIZE));
+		sum += _window[i];
+	}
+	_amplitudeScale = (float)(2.0 / sum);
+
+	_samples.resize(RHYTHM_FRAME_SIZE);
+	_power.resize(RHYTHM_FRAME_SIZE / 2 + 1);
+	_previous.resize(RHYTHM_FRAME_SIZE / 2 + 1);
+	_envelope.resize(RHYTHM_ENVELOPE_SIZE);
+	reset(0);
+}
+
+void BeatTracker::reset(uint64_t centre)
+{
+	_start = centre;
+	_hops = 0;
+	_lastOnset = INT64_MIN / 2;
+	_onset = -1;
+	_period = 0.0;
+	_confidence = 0.0;
+	_nextBeat = 0.0;
+	_beatAdjusted = false;
+	_previous.fill(0.0f);
+	_envelope.fill(0.0f);
+}
+
+float BeatTracker::envelope(int64_t hop) const
+{
+	if (hop < 0 || hop >= _hops || _hops - hop > RHYTHM_ENVELOPE_SIZE)
+		return 0.0f;
+	return _envelope[(int)(hop & (RHYTHM_ENVELOPE_SIZE - 1))];
+}
+
+uint64_t BeatTracker::position(double hop) const
+{
+	return _start + (uint64_t)llround(hop * RHYTHM_HOP);
+}
+
+void BeatTracker::process(const float* frame, QVector<rhythm_event>& events)
+{
+	float* samples = _samples.data();
+	for (int i = 0; i < RHYTHM_FRAME_SIZE; i++)
+		samples[i] = frame[i] * _window[i];
+	_fft.powerSpectrum(samples, _power.data());
+
+	// Rise of the compressed magnitudes, DC left out
+	float flux = 0.0f;
+	for (int bin = 1; bin <= RHYTHM_FRAME_SIZE / 2; bin++)
+	{
+		float compressed = logf(1.0f + FLUX_COMPRESSION
+			* sqrtf(_power[bin]) * _amplitudeScale);
+		float rise = compressed - _previous[bin];
+		if (rise > 0.0f)
+			flux += rise;
+		_previous[bin] = compressed;
+	}
+	// The first frame rises from nothing
+	if (_hops == 0)
+		flux = 0.0f;
+	_envelope[(int)(_hops & (RHYTHM_ENVELOPE_SIZE - 1))] = flux / (RHYTHM_FRAME_SIZE / 2);
+	_hops++;
+
+	detectOnset(events);
+	if (_hops % (int64_t)ceil(_hopRate) == 0)
+		updateTempo();
+	if (_config.beats)
+		trackBeats(events);
+}
+
+// Peak picking one hop behind, the peak has to beat both neighbours
+void BeatTracker::detectOnset(QVector<rhythm_event>& events)
+{
+	_onset = -1;
+	// Not before the average has a full window
+	int64_t candidate = _hops - 2;
+	if (candidate < ONSET_AVERAGE_HOPS)
+		return;
+
+	float flux = envelope(candidate);
+	if (flux <= envelope(candidate - 1) || flux < envelope(candidate + 1))
+		return;
+
+	float average = 0.0f;
+	for (int64_t hop = candidate - ONSET_AVERAGE_HOPS; hop < candidate; hop++)
+		average += envelope(hop);
+	average /= ONSET_AVERAGE_HOPS;
+
+	float threshold = fmaxf((float)(average * _config.threshold), ONSET_MIN_FLUX);
+	if (flux <= threshold || candidate - _lastOnset < ONSET_MIN_INTERVAL * _hopRate)
+		return;
+
+	_lastOnset = candidate;
+	_onset = candidate;
+	if (_config.onsets)
+	{
+		rhythm_event event = {};
+		event.type = rhythm_onset;
+		event.position = position((double)candidate);
+		event.strength = flux - threshold;
+		events.append(event);
+	}
+}
+
+void BeatTracker::updateTempo()
+{
+	int64_t count = _hops < RHYTHM_ENVELOPE_SIZE ? _hops : RHYTHM_ENVELOPE_SIZE;
+	int minLag = (int)floor(60.0 * _hopRate / _config.max_bpm);
+	int maxLag = (int)ceil(60.0 * _hopRate / _config.min_bpm);
+	if (minLag < 2)
+		minLag = 2;
+	// Several periods are needed for a meaningful autocorrelation
+	if (maxLag > count / 2)
+		maxLag = (int)(count / 2);
+	if (maxLag <= minLag + 1)
+		return;
+
+	float values[RHYTHM_ENVELOPE_SIZE];
+	int64_t first = _hops - count;
+	double mean = 0.0;
+	for (int64_t i = 0; i < count; i++)
+	{
+		values[i] = envelope(first + i);
+		mean += values[i];
+	}
+	mean /= count;
+	for (int64_t i = 0; i < count; i++)
+		values[i] -= (float)mean;
+
+	auto correlation = [&](int lag)
+	{
+		double sum = 0.0;
+		for (int64_t i = 0; i + lag < count; i++)
+			sum += values[i] * values[i + lag];
+		return sum / (count - lag);
+	};
+
+	double energy = correlation(0);
+	if (energy <= 0.0)
+	{
+		_period = 0.0;
+		return;
+	}
+
+	// Weighted towards 120 BPM by a log-Gaussian one octave wide, which
+	// keeps the tracker off half and double tempos
+	double preferred = 60.0 * _hopRate / 120.0;
+	QVector<double> lags(maxLag + 2);
+	int best = 0;
+	double bestScore = 0.0;
+	for (int lag = minLag - 1; lag <= maxLag + 1; lag++)
+	{
+		lags[lag] = correlation(lag);
+		if (lag < minLag || lag > maxLag)
+			continue;
+
+		double octaves = log2(lag / preferred);
+		double score = lags[lag] * exp(-0.5 * octaves * octaves);
+		if (score > bestScore)
+		{
+			bestScore = score;
+			best = lag;
+		}
+	}
+	if (!best)
+	{
+		_period = 0.0;
+		return;
+	}
+
+	// Parabolic interpolation between the neighbouring lags
+	double period = best;
+	double denominator = lags[best - 1] - 2.0 * lags[best] + lags[best + 1];
+	if (denominator < 0.0)
+		period += 0.5 * (lags[best - 1] - lags[best + 1]) / denominator;
+
+	_confidence = fmin(lags[best] / energy, 1.0);
+
+	// Phase of the comb of beats that collects the most flux
+	int phases = (int)ceil(period);
+	int bestPhase = 0;
+	double bestComb = -1.0;
+	for (int phase = 0; phase < phases; phase++)
+	{
+		double comb = 0.0;
+		for (int tooth = 0; tooth < BEAT_COMB_TEETH; tooth++)
+			comb += envelope(_hops - 1 - phase - (int64_t)llround(tooth * period));
+		if (comb > bestComb)
+		{
+			bestComb = comb;
+			bestPhase = phase;
+		}
+	}
+	double nextBeat = (double)(_hops - 1 - bestPhase) + period;
+
+	bool tracking = _period > 0.0;
+	_period = period;
+	if (tracking)
+	{
+		double offset = fmod(nextBeat - _nextBeat, period);
+		if (offset > period / 2)
+			offset -= period;
+		else if (offset < -period / 2)
+			offset += period;
+		if (fabs(offset) <= BEAT_RESYNC * period)
+			return;
+	}
+	_nextBeat = nextBeat;
+	_beatAdjusted = false;
+}
+
+void BeatTracker::trackBeats(QVector<rhythm_event>& events)
+{
+	if (_period <= 0.0)
+		return;
+
+	double tolerance = BEAT_TOLERANCE * _period;
+	if (_onset >= 0 && !_beatAdjusted && fabs(_onset - _nextBeat) <= tolerance)
+	{
+		_nextBeat += BEAT_CORRECTION * (_onset - _nextBeat);
+		_beatAdjusted = true;
+	}
+
+	// Onsets are known one hop late, wait until none can still move the beat
+	if (_hops - 2 <= _nextBeat + tolerance)
+		return;
+
+	rhythm_event event = {};
+	event.type = rhythm_beat;
+	event.position = position(_nextBeat);
+	event.bpm = 60.0 * _hopRate / _period;
+	event.confidence = _confidence;
+	event.next_position = position(_nextBeat + _period);
+	events.append(event);
+
+	_nextBeat += _period;
+	_beatAdjusted = false;
+}
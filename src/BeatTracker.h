@@ -0,0 +1,97 @@
+#ifndef BEATTRACKER_H
+#define BEATTRACKER_H
+
+#include <stdint.h>
+#include <QVector>
+
+#include "RealFft.h"
+
+// Analysis frames and the hop between them, in frames
+#define RHYTHM_FRAME_SIZE 1024
+#define RHYTHM_HOP 512
+// Hops of onset strength kept for the tempo, a power of two
+#define RHYTHM_ENVELOPE_SIZE 512
+
+// Onset and beat settings of an audio filter
+struct audio_rhythm_config
+{
+	bool onsets = false;
+	bool beats = false;
+	// Onsets need this many times the recent average spectral flux
+	double threshold = 1.5;
+	double min_bpm = 60.0;
+	double max_bpm = 200.0;
+};
+
+enum rhythm_event_type
+{
+	rhythm_onset,
+	rhythm_beat
+};
+
+// Positions are ring positions (see AudioRing)
+struct rhythm_event
+{
+	rhythm_event_type type;
+	uint64_t position;
+	// Onsets: spectral flux over the threshold
+	double strength;
+	// Beats
+	double bpm;
+	double confidence;
+	uint64_t next_position;
+};
+
+/**
+ * Onset detection and beat tracking over overlapping frames of mono
+ * samples, run on the AudioAnalyzer worker. Onsets are peaks of the
+ * spectral flux of the log-compressed magnitude spectrum over an adaptive
+ * threshold. The tempo is the strongest autocorrelation lag of the flux
+ * envelope within the BPM range, weighted towards 120 BPM and updated
+ * every second; beats are predicted from it, phase-aligned with a comb
+ * over the envelope and pulled towards the onsets they coincide with.
+ * Events come out one hop after the onset they belong to, or a few hops
+ * after a beat once its onset window has passed, with exact positions.
+ */
+class BeatTracker
+{
+public:
+	BeatTracker(uint32_t sampleRate, const audio_rhythm_config& config);
+
+	// Starts over, the next frame is centred on ring position `centre`
+	void reset(uint64_t centre);
+	// Feeds the RHYTHM_FRAME_SIZE samples of the next hop
+	void process(const float* frame, QVector<rhythm_event>& events);
+
+private:
+	float envelope(int64_t hop) const;
+	uint64_t position(double hop) const;
+	void detectOnset(QVector<rhythm_event>& events);
+	void updateTempo();
+	void trackBeats(QVector<rhythm_event>& events);
+
+	audio_rhythm_config _config;
+	double _hopRate;
+	RealFft _fft;
+	QVector<float> _window;
+	float _amplitudeScale;
+	QVector<float> _samples;
+	QVector<float> _power;
+	QVector<float> _previous;
+	QVector<float> _envelope;
+
+	uint64_t _start;
+	// Hops processed since the reset
+	int64_t _hops;
+	int64_t _lastOnset;
+	// Onset found in the last call, -1 if none
+	int64_t _onset;
+
+	// Beat period in hops, 0 while unknown
+	double _period;
+	double _confidence;
+	double _nextBeat;
+	bool _beatAdjusted;
+};
+
+#endif // BEATTRACKER_H
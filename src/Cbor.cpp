@@ -0,0 +1,485 @@
+#include <math.h>
+#include <string.h>
+
+#include "Cbor.h"
+
+// Nesting limit for incoming payloads, protects the recursive decoder
+#define CBOR_MAX_DEPTH 32
+
+int Cbor::EncodeHead(char* head, uint8_t major, uint64_t value)
+{
+	if (value < 24)
+	{
+		head[0] = (char)(major << 5 | value);
+		return 1;
+	}
+	if (value <= 0xFF)
+	{
+		head[0] = (char)(major << 5 | 24);
+		head[1] = (char)value;
+		return 2;
+	}
+	if (value <= 0xFFFF)
+	{
+		head[0] = (char)(major << 5 | 25);
+		head[1] = (char)(value >> 8);
+		head[2] = (char)value;
+		return 3;
+	}
+	if (value <= 0xFFFFFFFF)
+	{
+		head[0] = (char)(major << 5 | 26);
+		for (int i = 0; i < 4; i++)
+			head[1 + i] = (char)(value >> (24 - 8 * i));
+		return 5;
+	}
+
+	head[0] = (char)(major << 5 | 27);
+	for (int i = 0; i < 8; i++)
+		head[1 + i] = (char)(value >> (56 - 8 * i));
+	return 9;
+}
+
+void Cbor::WriteHead(QByteArray& output, uint8_t major, uint64_t value)
+{
+	char head[CBOR_MAX_HEAD_SIZE];
+	output.append(head, EncodeHead(head, major, value));
+}
+
+void Cbor::WriteText(QByteArray& output, const char* text, size_t length)
+{
+	WriteHead(output, CBOR_TEXT, length);
+	output.append(text, (int)length);
+}
+
+void Cbor::WriteInt(QByteArray& output, long long value)
+{
+	if (value >= 0)
+		WriteHead(output, CBOR_UINT, (uint64_t)value);
+	else
+		WriteHead(output, CBOR_NEGINT, (uint64_t)(-1 - value));
+}
+
+void Cbor::WriteDouble(QByteArray& output, double value)
+{
+	uint64_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+
+	char encoded[9];
+	encoded[0] = (char)(CBOR_SIMPLE << 5 | 27);
+	for (int i = 0; i < 8; i++)
+		encoded[1 + i] = (char)(bits >> (56 - 8 * i));
+	output.append(encoded, sizeof(encoded));
+}
+
+static void write_text(QByteArray& out, const char* text)
+{
+	Cbor::WriteText(out, text, text ? strlen(text) : 0);
+}
+
+static void write_array(QByteArray& out, obs_data_array_t* array)
+{
+	size_t count = obs_data_array_count(array);
+	Cbor::WriteHead(out, CBOR_ARRAY, count);
+	for (size_t i = 0; i < count; i++)
+	{
+		OBSDataAutoRelease item = obs_data_array_item(array, i);
+		Cbor::AppendData(out, item);
+	}
+}
+
+QByteArray Cbor::FromData(obs_data_t* data)
+{
+	QByteArray output;
+	output.reserve(256);
+	AppendData(output, data);
+	return output;
+}
+
+void Cbor::AppendData(QByteArray& output, obs_data_t* data)
+{
+	uint64_t count = 0;
+	for (obs_data_item_t* item = obs_data_first(data); item; obs_data_item_next(&item))
+	{
+		if (obs_data_item_has_user_value(item))
+			count++;
+	}
+
+	Cbor::WriteHead(output, CBOR_MAP, count);
+
+	for (obs_data_item_t* item = obs_data_first(data); item; obs_data_item_next(&item))
+	{
+		if (!obs_data_item_has_user_value(item))
+			continue;
+
+		write_text(output, obs_data_item_get_name(item));
+
+		switch (obs_data_item_gettype(item))
+		{
+		case OBS_DATA_STRING:
+			write_text(output, obs_data_item_get_string(item));
+			break;
+		case OBS_DATA_NUMBER:
+			if (obs_data_item_numtype(item) == OBS_DATA_NUM_DOUBLE)
+				Cbor::WriteDouble(output, obs_data_item_get_double(item));
+			else
+				Cbor::WriteInt(output, obs_data_item_get_int(item));
+			break;
+		case OBS_DATA_BOOLEAN:
+			Cbor::WriteHead(output, CBOR_SIMPLE,
+				obs_data_item_get_bool(item) ? CBOR_TRUE : CBOR_FALSE);
+			break;
+		case OBS_DATA_OBJECT:
+		{
+			OBSDataAutoRelease obj = obs_data_item_get_obj(item);
+			AppendData(output, obj);
+			break;
+		}
+		case OBS_DATA_ARRAY:
+		{
+			OBSDataArrayAutoRelease array = obs_data_item_get_array(item);
+			write_array(output, array);
+			break;
+		}
+		default:
+			Cbor::WriteHead(output, CBOR_SIMPLE, CBOR_NULL);
+			break;
+		}
+	}
+}
+
+struct cbor_reader
+{
+	const uint8_t* pos;
+	const uint8_t* end;
+};
+
+static bool read_head(cbor_reader& r, uint8_t& major, uint8_t& info, uint64_t& value)
+{
+	if (r.pos >= r.end)
+		return false;
+
+	major = *r.pos >> 5;
+	info = *r.pos & 0x1F;
+	r.pos++;
+
+	if (info < 24 || info == CBOR_INDEFINITE)
+	{
+		value = info;
+		return true;
+	}
+	if (info > 27)
+		return false;
+
+	int length = 1 << (info - 24);
+	if (r.end - r.pos < length)
+		return false;
+
+	value = 0;
+	for (int i = 0; i < length; i++)
+		value = value << 8 | r.pos[i];
+	r.pos += length;
+	return true;
+}
+
+static bool read_string(cbor_reader& r, uint8_t major, uint8_t info,
+	uint64_t length, QByteArray& out)
+{
+	if (info != CBOR_INDEFINITE)
+	{
+		if ((uint64_t)(r.end - r.pos) < length)
+			return false;
+		out.append((const char*)r.pos, (int)length);
+		r.pos += length;
+		return true;
+	}
+
+	// Indefinite length strings are a sequence of definite chunks
+	while (r.pos < r.end && *r.pos != CBOR_BREAK)
+	{
+		uint8_t chunkMajor, chunkInfo;
+		uint64_t chunkLength;
+		if (!read_head(r, chunkMajor, chunkInfo, chunkLength)
+			|| chunkMajor != major || chunkInfo == CBOR_INDEFINITE
+			|| !read_string(r, major, chunkInfo, chunkLength, out))
+			return false;
+	}
+	if (r.pos >= r.end)
+		return false;
+	r.pos++;
+	return true;
+}
+
+static double half_to_double(uint16_t half)
+{
+	int exponent = (half >> 10) & 0x1F;
+	int mantissa = half & 0x3FF;
+	double value;
+	if (exponent == 0)
+		value = ldexp(mantissa, -24);
+	else if (exponent != 31)
+		value = ldexp(mantissa + 1024, exponent - 25);
+	else
+		value = mantissa == 0 ? INFINITY : NAN;
+	return half & 0x8000 ? -value : value;
+}
+
+static bool read_map(cbor_reader& r, uint8_t info, uint64_t count,
+	obs_data_t* data, int depth);
+
+static bool at_end(cbor_reader& r, uint8_t info, uint64_t index, uint64_t count)
+{
+	if (info != CBOR_INDEFINITE)
+		return index >= count;
+
+	if (r.pos < r.end && *r.pos == CBOR_BREAK)
+	{
+		r.pos++;
+		return true;
+	}
+	return false;
+}
+
+// Reads one value and stores it into data under key
+static bool read_value(cbor_reader& r, obs_data_t* data, const char* key, int depth)
+{
+	uint8_t major, info;
+	uint64_t value;
+	if (depth > CBOR_MAX_DEPTH || !read_head(r, major, info, value))
+		return false;
+
+	while (major == CBOR_TAG)
+	{
+		if (!read_head(r, major, info, value))
+			return false;
+	}
+
+	switch (major)
+	{
+	case CBOR_UINT:
+		obs_data_set_int(data, key, (long long)value);
+		return true;
+	case CBOR_NEGINT:
+		obs_data_set_int(data, key, -1 - (long long)value);
+		return true;
+	case CBOR_BYTES:
+	case CBOR_TEXT:
+	{
+		QByteArray text;
+		if (!read_string(r, major, info, value, text))
+			return false;
+		obs_data_set_string(data, key, text.constData());
+		return true;
+	}
+	case CBOR_ARRAY:
+	{
+		OBSDataArrayAutoRelease array = obs_data_array_create();
+		for (uint64_t i = 0; !at_end(r, info, i, value); i++)
+		{
+			if (r.pos >= r.end)
+				return false;
+
+			// obs_data arrays only hold objects, other elements are dropped
+			if ((*r.pos >> 5) == CBOR_MAP)
+			{
+				uint8_t itemMajor, itemInfo;
+				uint64_t itemCount;
+				OBSDataAutoRelease item = obs_data_create();
+				if (!read_head(r, itemMajor, itemInfo, itemCount)
+					|| !read_map(r, itemInfo, itemCount, item, depth + 1))
+					return false;
+				obs_data_array_push_back(array, item);
+			}
+			else
+			{
+				OBSDataAutoRelease scratch = obs_data_create();
+				if (!read_value(r, scratch, "", depth + 1))
+					return false;
+			}
+		}
+		obs_data_set_array(data, key, array);
+		return true;
+	}
+	case CBOR_MAP:
+	{
+		OBSDataAutoRelease obj = obs_data_create();
+		if (!read_map(r, info, value, obj, depth + 1))
+			return false;
+		obs_data_set_obj(data, key, obj);
+		return true;
+	}
+	case CBOR_SIMPLE:
+		if (info == CBOR_FALSE || info == CBOR_TRUE)
+			obs_data_set_bool(data, key, info == CBOR_TRUE);
+		else if (info == 25)
+			obs_data_set_double(data, key, half_to_double((uint16_t)value));
+		else if (info == 26)
+		{
+			uint32_t bits = (uint32_t)value;
+			float f;
+			memcpy(&f, &bits, sizeof(f));
+			obs_data_set_double(data, key, f);
+		}
+		else if (info == 27)
+		{
+			double d;
+			memcpy(&d, &value, sizeof(d));
+			obs_data_set_double(data, key, d);
+		}
+		else if (info == CBOR_INDEFINITE)
+			return false;
+		return true;
+	}
+	return false;
+}
+
+static bool read_map(cbor_reader& r, uint8_t info, uint64_t count,
+	obs_data_t* data, int depth)
+{
+	for (uint64_t i = 0; !at_end(r, info, i, count); i++)
+	{
+		uint8_t major, keyInfo;
+		uint64_t length;
+		QByteArray key;
+		if (!read_head(r, major, keyInfo, length)
+			|| (major != CBOR_TEXT && major != CBOR_BYTES)
+			|| !read_string(r, major, keyInfo, length, key)
+			|| !read_value(r, data, key.constData(), depth))
+			return false;
+	}
+	return true;
+}
+
+obs_data_t* Cbor::ToData(const QByteArray& payload)
+{
+	cbor_reader r;
+	r.pos = (const uint8_t*)payload.constData();
+	r.end = r.pos + payload.size();
+
+	uint8_t major, info;
+	uint64_t count;
+	if (!read_head(r, major, info, count) || major != CBOR_MAP)
+		return nullptr;
+
+	obs_data_t* data = obs_data_create();
+	if (!read_map(r, info, count, data, 0))
+	{
+		obs_data_release(data);
+		return nullptr;
+	}
+	return data;
+}
+
+// Moves past one complete data item
+static bool skip_item(cbor_reader& r, int depth)
+{
+	uint8_t major, info;
+	uint64_t value;
+	if (depth > CBOR_MAX_DEPTH || !read_head(r, major, info, value))
+		return false;
+
+	switch (major)
+	{
+	case CBOR_BYTES:
+	case CBOR_TEXT:
+		if (info == CBOR_INDEFINITE)
+		{
+			while (r.pos < r.end && *r.pos != CBOR_BREAK)
+			{
+				if (!skip_item(r, depth + 1))
+					return false;
+			}
+			if (r.pos >= r.end)
+				return false;
+			r.pos++;
+			return true;
+		}
+		if ((uint64_t)(r.end - r.pos) < value)
+			return false;
+		r.pos += value;
+		return true;
+	case CBOR_ARRAY:
+	case CBOR_MAP:
+	{
+		uint64_t items = major == CBOR_MAP ? value * 2 : value;
+		for (uint64_t i = 0; !at_end(r, info, i, items); i++)
+		{
+			if (!skip_item(r, depth + 1))
+				return false;
+		}
+		return true;
+	}
+	case CBOR_TAG:
+		return skip_item(r, depth + 1);
+	case CBOR_SIMPLE:
+		return info != CBOR_INDEFINITE;
+	default:
+		return true;
+	}
+}
+
+// Replaces the head of the map at the start of `map` by one for `count`
+static void rewrite_map_head(QByteArray& map, int headSize, uint64_t count)
+{
+	char head[CBOR_MAX_HEAD_SIZE];
+	map.replace(0, headSize, head, Cbor::EncodeHead(head, CBOR_MAP, count));
+}
+
+bool Cbor::AppendMember(QByteArray& map, const char* key, long long value)
+{
+	cbor_reader r;
+	r.pos = (const uint8_t*)map.constData();
+	r.end = r.pos + map.size();
+
+	uint8_t major, info;
+	uint64_t count;
+	if (!read_head(r, major, info, count)
+		|| major != CBOR_MAP || info == CBOR_INDEFINITE)
+		return false;
+
+	rewrite_map_head(map, (int)(r.pos - (const uint8_t*)map.constData()),
+		count + 1);
+	write_text(map, key);
+	WriteInt(map, value);
+	return true;
+}
+
+bool Cbor::RemoveMember(QByteArray& map, const char* key)
+{
+	const uint8_t* begin = (const uint8_t*)map.constData();
+	cbor_reader r;
+	r.pos = begin;
+	r.end = begin + map.size();
+
+	uint8_t major, info;
+	uint64_t count;
+	if (!read_head(r, major, info, count)
+		|| major != CBOR_MAP || info == CBOR_INDEFINITE)
+		return false;
+	int headSize = (int)(r.pos - begin);
+
+	size_t length = strlen(key);
+	for (uint64_t i = 0; i < count; i++)
+	{
+		const uint8_t* member = r.pos;
+		uint8_t keyMajor, keyInfo;
+		uint64_t keyLength;
+		if (!read_head(r, keyMajor, keyInfo, keyLength))
+			return false;
+		bool match = keyMajor == CBOR_TEXT && keyInfo != CBOR_INDEFINITE
+			&& keyLength == length && (size_t)(r.end - r.pos) >= length
+			&& memcmp(r.pos, key, length) == 0;
+
+		r.pos = member;
+		if (!skip_item(r, 0) || !skip_item(r, 0))
+			return false;
+
+		if (match)
+		{
+			map.remove((int)(member - begin), (int)(r.pos - member));
+			rewrite_map_head(map, headSize, count - 1);
+			return true;
+		}
+	}
+	return false;
+}
@@ -0,0 +1,53 @@
+#ifndef CBOR_H
+#define CBOR_H
+
+#include <stdint.h>
+#include <QByteArray>
+#include <obs.hpp>
+
+#define CBOR_UINT 0
+#define CBOR_NEGINT 1
+#define CBOR_BYTES 2
+#define CBOR_TEXT 3
+#define CBOR_ARRAY 4
+#define CBOR_MAP 5
+#define CBOR_TAG 6
+#define CBOR_SIMPLE 7
+
+#define CBOR_FALSE 20
+#define CBOR_TRUE 21
+#define CBOR_NULL 22
+#define CBOR_INDEFINITE 31
+#define CBOR_BREAK 0xFF
+
+// Largest encoded head: initial byte and a 64-bit argument
+#define CBOR_MAX_HEAD_SIZE 9
+
+/**
+ * Binary (RFC 7049 CBOR) counterpart of obs_data_get_json and
+ * obs_data_create_from_json, used for clients that negotiated the binary
+ * encoding. Objects map to CBOR maps, arrays to arrays of maps and numbers
+ * keep their integer/double distinction.
+ */
+class Cbor
+{
+public:
+	static QByteArray FromData(obs_data_t* data);
+	static void AppendData(QByteArray& output, obs_data_t* data);
+	static obs_data_t* ToData(const QByteArray& payload);
+
+	// Shortest head for `value`, written to `head`. Returns its size.
+	static int EncodeHead(char* head, uint8_t major, uint64_t value);
+	static void WriteHead(QByteArray& output, uint8_t major, uint64_t value);
+	static void WriteText(QByteArray& output, const char* text, size_t length);
+	static void WriteInt(QByteArray& output, long long value);
+	static void WriteDouble(QByteArray& output, double value);
+
+	// Edits of an encoded top-level map, for members set after the message
+	// was serialized. Both return false if `map` isn't a definite-length
+	// map (or, for RemoveMember, doesn't have `key`).
+	static bool AppendMember(QByteArray& map, const char* key, long long value);
+	static bool RemoveMember(QByteArray& map, const char* key);
+};
+
+#endif // CBOR_H
@@ -24,6 +24,10 @@ with this program. If not, see <https://www.gnu.org/licenses/>
 #define SECTION_NAME "OstWS"
 #define PARAM_ENABLE "ServerEnabled"
 #define PARAM_PORT "ServerPort"
+#define PARAM_LOCAL_ENABLE "LocalSocketEnabled"
+#define PARAM_LOCAL_NAME "LocalSocketName"
+#define PARAM_COMPRESSION_LEVEL "CompressionLevel"
+#define PARAM_COMPRESSION_WINDOW "CompressionWindowBits"
 #define PARAM_DEBUG "DebugEnabled"
 #define PARAM_ALERT "AlertsEnabled"
 
@@ -37,6 +41,10 @@ Config* Config::_instance = new Config();
 Config::Config() :
     ServerEnabled(true),
     ServerPort(4445),
+    LocalSocketEnabled(false),
+    LocalSocketName("obs-ostws"),
+    CompressionLevel(3),
+    CompressionWindowBits(15),
     DebugEnabled(false),
     AlertsEnabled(false),
     SettingsLoaded(false)
@@ -48,12 +56,64 @@ Config::~Config() {
     
 }
 
-void Config::Load() {
-
+void Config::SetDefaults(config_t* obsConfig) {
+    config_set_default_bool(obsConfig, SECTION_NAME, PARAM_ENABLE, ServerEnabled);
+    config_set_default_uint(obsConfig, SECTION_NAME, PARAM_PORT, ServerPort);
+    config_set_default_bool(obsConfig, SECTION_NAME, PARAM_LOCAL_ENABLE,
+        LocalSocketEnabled);
+    config_set_default_string(obsConfig, SECTION_NAME, PARAM_LOCAL_NAME,
+        QT_TO_UTF8(LocalSocketName));
+    config_set_default_int(obsConfig, SECTION_NAME, PARAM_COMPRESSION_LEVEL,
+        CompressionLevel);
+    config_set_default_int(obsConfig, SECTION_NAME, PARAM_COMPRESSION_WINDOW,
+        CompressionWindowBits);
+    config_set_default_bool(obsConfig, SECTION_NAME, PARAM_DEBUG, DebugEnabled);
+    config_set_default_bool(obsConfig, SECTION_NAME, PARAM_ALERT, AlertsEnabled);
+}
 
+void Config::Load() {
+    config_t* obsConfig = obs_frontend_get_global_config();
+    if (!obsConfig)
+        return;
+
+    SetDefaults(obsConfig);
+
+    ServerEnabled = config_get_bool(obsConfig, SECTION_NAME, PARAM_ENABLE);
+    ServerPort = config_get_uint(obsConfig, SECTION_NAME, PARAM_PORT);
+    LocalSocketEnabled = config_get_bool(obsConfig, SECTION_NAME,
+        PARAM_LOCAL_ENABLE);
+    LocalSocketName = QString::fromUtf8(config_get_string(obsConfig,
+        SECTION_NAME, PARAM_LOCAL_NAME));
+    // An empty name can't be listened on
+    if (LocalSocketName.isEmpty())
+        LocalSocketName = "obs-ostws";
+    CompressionLevel = (int)config_get_int(obsConfig, SECTION_NAME,
+        PARAM_COMPRESSION_LEVEL);
+    CompressionWindowBits = (int)config_get_int(obsConfig, SECTION_NAME,
+        PARAM_COMPRESSION_WINDOW);
+    DebugEnabled = config_get_bool(obsConfig, SECTION_NAME, PARAM_DEBUG);
+    AlertsEnabled = config_get_bool(obsConfig, SECTION_NAME, PARAM_ALERT);
+    SettingsLoaded = true;
 }
 
 void Config::Save() {
+    config_t* obsConfig = obs_frontend_get_global_config();
+    if (!obsConfig)
+        return;
+
+    config_set_bool(obsConfig, SECTION_NAME, PARAM_ENABLE, ServerEnabled);
+    config_set_uint(obsConfig, SECTION_NAME, PARAM_PORT, ServerPort);
+    config_set_bool(obsConfig, SECTION_NAME, PARAM_LOCAL_ENABLE,
+        LocalSocketEnabled);
+    config_set_string(obsConfig, SECTION_NAME, PARAM_LOCAL_NAME,
+        QT_TO_UTF8(LocalSocketName));
+    config_set_int(obsConfig, SECTION_NAME, PARAM_COMPRESSION_LEVEL,
+        CompressionLevel);
+    config_set_int(obsConfig, SECTION_NAME, PARAM_COMPRESSION_WINDOW,
+        CompressionWindowBits);
+    config_set_bool(obsConfig, SECTION_NAME, PARAM_DEBUG, DebugEnabled);
+    config_set_bool(obsConfig, SECTION_NAME, PARAM_ALERT, AlertsEnabled);
+    config_save(obsConfig);
 }
 
 Config* Config::Current() {
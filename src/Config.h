@@ -20,6 +20,7 @@ with this program. If not, see <https://www.gnu.org/licenses/>
 #define CONFIG_H
 
 #include <QString>
+#include <util/config-file.h>
 
 
 class Config {
@@ -32,6 +33,12 @@ class Config {
     bool ServerEnabled;
     uint64_t ServerPort;
 
+    bool LocalSocketEnabled;
+    QString LocalSocketName;
+
+    int CompressionLevel;
+    int CompressionWindowBits;
+
     bool DebugEnabled;
     bool AlertsEnabled;
 
@@ -41,6 +48,8 @@ class Config {
     static Config* Current();
 
   private:
+    void SetDefaults(config_t* obsConfig);
+
     static Config* _instance;
 };
 
@@ -0,0 +1,366 @@
+#include <locale.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Cbor.h"
+#include "JsonWriter.h"
+
+#define JSON_WRITER_INITIAL_CAPACITY 4096
+
+// Heads of open CBOR containers take the 32-bit form until their count is
+// known, and are shortened when they are closed
+#define CBOR_PLACEHOLDER_SIZE 5
+
+JsonWriter::JsonWriter() :
+	_withCbor(false),
+	_cborStart(-1),
+	_depth(0)
+{
+	// A reserved capacity survives resize(0), so the buffer is only ever
+	// grown, never freed between messages
+	_buffer.reserve(JSON_WRITER_INITIAL_CAPACITY);
+	_cbor.reserve(JSON_WRITER_INITIAL_CAPACITY);
+}
+
+JsonWriter& JsonWriter::Begin(const char* updateType, bool cbor)
+{
+	static thread_local JsonWriter writer;
+	writer._buffer.resize(0);
+	writer._buffer.append('{');
+
+	writer._withCbor = cbor;
+	writer._cbor.resize(0);
+	writer._cborStart = -1;
+	writer._depth = 0;
+	writer._inPlace.resize(0);
+	if (cbor)
+		writer.beginCbor(CBOR_MAP);
+
+	if (updateType)
+		writer.writeString("update-type", updateType);
+	return writer;
+}
+
+void JsonWriter::writeKey(const char* key)
+{
+	char last = _buffer.at(_buffer.size() - 1);
+	if (last != '{' && last != '[')
+		_buffer.append(',');
+
+	if (key)
+	{
+		appendString(key);
+		_buffer.append(':');
+	}
+
+	if (_withCbor)
+	{
+		_containers[_depth - 1].count++;
+		if (key)
+			Cbor::WriteText(_cbor, key, strlen(key));
+	}
+}
+
+void JsonWriter::beginCbor(uint8_t major)
+{
+	if (_depth == JSON_WRITER_MAX_DEPTH)
+	{
+		dropCbor();
+		return;
+	}
+
+	cbor_container& container = _containers[_depth++];
+	container.major = major;
+	container.head = _cbor.size();
+	container.count = 0;
+
+	char placeholder[CBOR_PLACEHOLDER_SIZE] = { (char)(major << 5 | 26) };
+	_cbor.append(placeholder, sizeof(placeholder));
+}
+
+// Writes the head of the innermost container, moving its content back
+// over the part of the placeholder the head doesn't need
+void JsonWriter::endCbor()
+{
+	const cbor_container& container = _containers[--_depth];
+	char head[CBOR_MAX_HEAD_SIZE];
+	int headSize = Cbor::EncodeHead(head, container.major, container.count);
+	int shift = CBOR_PLACEHOLDER_SIZE - headSize;
+
+	char* data = _cbor.data();
+	int content = container.head + CBOR_PLACEHOLDER_SIZE;
+	memmove(data + content - shift, data + content, _cbor.size() - content);
+	memcpy(data + container.head, head, headSize);
+	_cbor.resize(_cbor.size() - shift);
+
+	for (in_place_string& string : _inPlace)
+	{
+		if (string.cbor > container.head)
+			string.cbor -= shift;
+	}
+}
+
+void JsonWriter::dropCbor()
+{
+	_withCbor = false;
+	_cbor.resize(0);
+}
+
+// Same escaping as jansson without JSON_ENSURE_ASCII and JSON_ESCAPE_SLASH
+void JsonWriter::appendString(const char* value)
+{
+	static const char hex[] = "0123456789ABCDEF";
+
+	_buffer.append('"');
+	const char* run = value;
+	for (const char* p = value; *p; p++)
+	{
+		unsigned char c = (unsigned char)*p;
+		if (c >= 0x20 && c != '"' && c != '\\')
+			continue;
+
+		_buffer.append(run, (int)(p - run));
+		run = p + 1;
+
+		switch (c)
+		{
+		case '"': _buffer.append("\\\"", 2); break;
+		case '\\': _buffer.append("\\\\", 2); break;
+		case '\b': _buffer.append("\\b", 2); break;
+		case '\f': _buffer.append("\\f", 2); break;
+		case '\n': _buffer.append("\\n", 2); break;
+		case '\r': _buffer.append("\\r", 2); break;
+		case '\t': _buffer.append("\\t", 2); break;
+		default:
+			{
+				char escape[6] = { '\\', 'u', '0', '0',
+					hex[c >> 4], hex[c & 0xF] };
+				_buffer.append(escape, sizeof(escape));
+			}
+			break;
+		}
+	}
+	_buffer.append(run);
+	_buffer.append('"');
+}
+
+void JsonWriter::writeString(const char* key, const char* value)
+{
+	if (!value)
+		value = "";
+
+	writeKey(key);
+	appendString(value);
+	if (_withCbor)
+		Cbor::WriteText(_cbor, value, strlen(value));
+}
+
+void JsonWriter::writeBool(const char* key, bool value)
+{
+	writeKey(key);
+	if (value)
+		_buffer.append("true", 4);
+	else
+		_buffer.append("false", 5);
+	if (_withCbor)
+		Cbor::WriteHead(_cbor, CBOR_SIMPLE, value ? CBOR_TRUE : CBOR_FALSE);
+}
+
+void JsonWriter::writeNull(const char* key)
+{
+	writeKey(key);
+	_buffer.append("null", 4);
+	if (_withCbor)
+		Cbor::WriteHead(_cbor, CBOR_SIMPLE, CBOR_NULL);
+}
+
+void JsonWriter::writeInt(const char* key, long long value)
+{
+	char number[24];
+	int length = snprintf(number, sizeof(number), "%lld", value);
+
+	writeKey(key);
+	_buffer.append(number, length);
+	if (_withCbor)
+		Cbor::WriteInt(_cbor, value);
+}
+
+// Formats like jansson's jsonp_dtostr with the default precision of 17
+void JsonWriter::writeDouble(const char* key, double value)
+{
+	// obs_data drops values jansson can't represent
+	if (!isfinite(value))
+		return;
+
+	char number[40];
+	int length = snprintf(number, sizeof(number), "%.17g", value);
+	fixDecimalPoint(number);
+
+	if (!strchr(number, '.') && !strchr(number, 'e'))
+	{
+		number[length++] = '.';
+		number[length++] = '0';
+		number[length] = '\0';
+	}
+
+	// No '+' and no leading zeros in the exponent
+	char* start = strchr(number, 'e');
+	if (start)
+	{
+		start++;
+		char* end = start + 1;
+		if (*start == '-')
+			start++;
+		while (*end == '0')
+			end++;
+		if (end != start)
+		{
+			memmove(start, end, length - (end - number) + 1);
+			length -= (int)(end - start);
+		}
+	}
+
+	writeKey(key);
+	_buffer.append(number, length);
+	if (_withCbor)
+		Cbor::WriteDouble(_cbor, value);
+}
+
+void JsonWriter::writeFixed(const char* key, double value, int decimals)
+{
+	if (!isfinite(value))
+		return;
+
+	char number[40];
+	int length = snprintf(number, sizeof(number), "%.*f", decimals, value);
+	if (length >= (int)sizeof(number))
+		return;
+
+	// CBOR gets the value a JSON parser reads back, parsed while the
+	// number is still in the C library's locale
+	writeKey(key);
+	if (_withCbor)
+	{
+		if (decimals > 0)
+			Cbor::WriteDouble(_cbor, strtod(number, nullptr));
+		else
+			Cbor::WriteInt(_cbor, strtoll(number, nullptr, 10));
+	}
+
+	fixDecimalPoint(number);
+	_buffer.append(number, length);
+}
+
+// printf follows LC_NUMERIC, JSON always has a '.'
+void JsonWriter::fixDecimalPoint(char* number)
+{
+	const char* point = localeconv()->decimal_point;
+	if (point[0] != '.')
+	{
+		char* localePoint = strchr(number, point[0]);
+		if (localePoint)
+			*localePoint = '.';
+	}
+}
+
+char* JsonWriter::writeStringInPlace(const char* key, int length)
+{
+	writeKey(key);
+	_buffer.append('"');
+	int offset = _buffer.size();
+	_buffer.resize(offset + length);
+	_buffer.append('"');
+
+	if (_withCbor)
+	{
+		Cbor::WriteHead(_cbor, CBOR_TEXT, length);
+		_inPlace.append({offset, _cbor.size(), length});
+		_cbor.resize(_cbor.size() + length);
+	}
+	return _buffer.data() + offset;
+}
+
+void JsonWriter::writeRaw(const char* key, const char* json, int length,
+	const char* cbor, int cborLength)
+{
+	writeKey(key);
+	_buffer.append(json, length);
+
+	if (!_withCbor)
+		return;
+	if (cbor && cborLength > 0)
+		_cbor.append(cbor, cborLength);
+	else
+		dropCbor();
+}
+
+void JsonWriter::beginObject(const char* key)
+{
+	writeKey(key);
+	_buffer.append('{');
+	if (_withCbor)
+		beginCbor(CBOR_MAP);
+}
+
+void JsonWriter::endObject()
+{
+	_buffer.append('}');
+	if (_withCbor)
+		endCbor();
+}
+
+void JsonWriter::beginArray(const char* key)
+{
+	writeKey(key);
+	_buffer.append('[');
+	if (_withCbor)
+		beginCbor(CBOR_ARRAY);
+}
+
+void JsonWriter::endArray()
+{
+	_buffer.append(']');
+	if (_withCbor)
+		endCbor();
+}
+
+int JsonWriter::size() const
+{
+	return _buffer.size();
+}
+
+QByteArray JsonWriter::end()
+{
+	_buffer.append('}');
+
+	if (_withCbor && _depth == 1)
+	{
+		for (const in_place_string& string : _inPlace)
+			memcpy(_cbor.data() + string.cbor,
+				_buffer.constData() + string.json, string.length);
+
+		// The top-level head is written right before the content instead
+		// of moving the whole message back
+		char head[CBOR_MAX_HEAD_SIZE];
+		int headSize = Cbor::EncodeHead(head, CBOR_MAP, _containers[0].count);
+		_cborStart = CBOR_PLACEHOLDER_SIZE - headSize;
+		memcpy(_cbor.data() + _cborStart, head, headSize);
+		_depth = 0;
+	}
+	else
+	{
+		dropCbor();
+	}
+
+	return QByteArray(_buffer.constData(), _buffer.size());
+}
+
+QByteArray JsonWriter::cbor() const
+{
+	if (!_withCbor || _cborStart < 0)
+		return QByteArray();
+	return QByteArray(_cbor.constData() + _cborStart,
+		_cbor.size() - _cborStart);
+}
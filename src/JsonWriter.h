@@ -0,0 +1,100 @@
+#ifndef JSONWRITER_H
+#define JSONWRITER_H
+
+#include <stdint.h>
+#include <QByteArray>
+#include <QVector>
+
+// Nesting the CBOR form can follow, deeper messages are sent as JSON only
+#define JSON_WRITER_MAX_DEPTH 16
+
+/**
+ * Streaming writer for the updates sent on every frame or meter tick. The
+ * output is byte for byte what obs_data_get_json produces for the same
+ * fields set in the same order (compact, insertion order, jansson number
+ * and string formatting), without building an obs_data tree. Each thread
+ * reuses one buffer, take the result before starting the next message.
+ *
+ * When asked for, the same calls also write the CBOR form of the message,
+ * byte for byte what Cbor::FromData produces for the same fields, so
+ * binary clients don't get it re-parsed from the JSON.
+ */
+class JsonWriter
+{
+public:
+	// Writer of the calling thread, emptied and with the opening brace
+	// written. update-type is written first when given. With `cbor` the
+	// CBOR form is written alongside (see cbor()).
+	static JsonWriter& Begin(const char* updateType = nullptr,
+		bool cbor = false);
+
+	void writeString(const char* key, const char* value);
+	void writeBool(const char* key, bool value);
+	void writeInt(const char* key, long long value);
+	void writeDouble(const char* key, double value);
+	// Fixed number of decimals, for values where the full precision of
+	// writeDouble would only add bytes
+	void writeFixed(const char* key, double value, int decimals);
+	void writeNull(const char* key);
+	// Reserves `length` bytes for a string value the caller fills in
+	// place, the characters must not need escaping
+	char* writeStringInPlace(const char* key, int length);
+	// Appends an already serialized value as the value of `key` (or as
+	// the next array element with a null key). Without its CBOR form the
+	// message is left without one.
+	void writeRaw(const char* key, const char* json, int length,
+		const char* cbor = nullptr, int cborLength = 0);
+
+	void beginObject(const char* key = nullptr);
+	void endObject();
+	void beginArray(const char* key);
+	void endArray();
+
+	// JSON bytes written so far, for copying parts of a message into
+	// another
+	int size() const;
+
+	// Closes the top-level object and copies the message out
+	QByteArray end();
+	// CBOR form of the message end() closed, empty when it wasn't asked
+	// for or a raw value came without one
+	QByteArray cbor() const;
+
+private:
+	// CBOR array or map whose head is written when it's closed
+	struct cbor_container
+	{
+		uint8_t major;
+		int head;
+		uint64_t count;
+	};
+
+	// String reserved by writeStringInPlace, copied to the CBOR form when
+	// the message ends
+	struct in_place_string
+	{
+		int json;
+		int cbor;
+		int length;
+	};
+
+	JsonWriter();
+	void writeKey(const char* key);
+	void appendString(const char* value);
+	static void fixDecimalPoint(char* number);
+
+	void beginCbor(uint8_t major);
+	void endCbor();
+	void dropCbor();
+
+	QByteArray _buffer;
+
+	bool _withCbor;
+	QByteArray _cbor;
+	int _cborStart;
+	cbor_container _containers[JSON_WRITER_MAX_DEPTH];
+	int _depth;
+	QVector<in_place_string> _inPlace;
+};
+
+#endif // JSONWRITER_H
@@ -0,0 +1,260 @@
+#include <math.h>
+#include <string.h>
+
+#include "Loudness.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define LOUDNESS_ABSOLUTE_GATE -70.0
+#define LOUDNESS_INTEGRATED_GATE -10.0
+#define LOUDNESS_RANGE_GATE -20.0
+#define LOUDNESS_MOMENTARY_BLOCKS 4
+
+static double energy_to_lufs(double energy)
+{
+	return -0.691 + 10.0 * log10(energy);
+}
+
+static int histogram_bin(double lufs)
+{
+	int bin = (int)floor((lufs - LOUDNESS_ABSOLUTE_GATE) * 10.0);
+	if (bin < 0)
+		return 0;
+	return bin < LOUDNESS_HISTOGRAM_BINS ? bin : LOUDNESS_HISTOGRAM_BINS - 1;
+}
+
+static void histogram_add(struct loudness_histogram* histogram, double energy)
+{
+	int bin = histogram_bin(energy_to_lufs(energy));
+	histogram->counts[bin]++;
+	histogram->energies[bin] += energy;
+}
+
+// BS.1770 weights for the OBS layouts: 5.1 and 7.1 have the LFE fourth
+// and surrounds after it
+static double channel_weight(int channel, int nr_channels)
+{
+	if (nr_channels < 6 || channel < 3)
+		return 1.0;
+	return channel == 3 ? 0.0 : 1.41;
+}
+
+void loudness_reset(struct loudness_meter* meter, uint32_t sample_rate,
+	int nr_channels)
+{
+	memset(meter, 0, sizeof(*meter));
+	meter->sample_rate = sample_rate;
+	meter->nr_channels = nr_channels < LOUDNESS_MAX_CHANNELS
+		? nr_channels : LOUDNESS_MAX_CHANNELS;
+	meter->block_size = sample_rate / 10;
+
+	// Coefficients of the 48 kHz filters in BS.1770, redesigned for the
+	// actual sample rate
+	double f0 = 1681.974450955533;
+	double gain = 3.999843853973347;
+	double q = 0.7071752369554196;
+	double k = tan(M_PI * f0 / sample_rate);
+	double vh = pow(10.0, gain / 20.0);
+	double vb = pow(vh, 0.4996667741545416);
+	double a0 = 1.0 + k / q + k * k;
+	meter->shelf_b[0] = (vh + vb * k / q + k * k) / a0;
+	meter->shelf_b[1] = 2.0 * (k * k - vh) / a0;
+	meter->shelf_b[2] = (vh - vb * k / q + k * k) / a0;
+	meter->shelf_a[0] = 1.0;
+	meter->shelf_a[1] = 2.0 * (k * k - 1.0) / a0;
+	meter->shelf_a[2] = (1.0 - k / q + k * k) / a0;
+
+	f0 = 38.13547087602444;
+	q = 0.5003270373238773;
+	k = tan(M_PI * f0 / sample_rate);
+	a0 = 1.0 + k / q + k * k;
+	meter->pass_b[0] = 1.0;
+	meter->pass_b[1] = -2.0;
+	meter->pass_b[2] = 1.0;
+	meter->pass_a[0] = 1.0;
+	meter->pass_a[1] = 2.0 * (k * k - 1.0) / a0;
+	meter->pass_a[2] = (1.0 - k / q + k * k) / a0;
+
+	meter->values.momentary = -INFINITY;
+	meter->values.short_term = -INFINITY;
+	meter->values.integrated = -INFINITY;
+	meter->values.range = 0.0f;
+}
+
+// Sum of the squared K-weighted samples, both biquads in transposed
+// direct form II
+static double k_weighted_sum(struct loudness_meter* meter, int channel,
+	const float* samples, size_t count)
+{
+	const double* sb = meter->shelf_b;
+	const double* sa = meter->shelf_a;
+	const double* pb = meter->pass_b;
+	const double* pa = meter->pass_a;
+	double* z = meter->state[channel];
+
+	double sum = 0.0;
+	for (size_t i = 0; i < count; i++)
+	{
+		double x = samples[i];
+		double shelved = sb[0] * x + z[0];
+		z[0] = sb[1] * x - sa[1] * shelved + z[1];
+		z[1] = sb[2] * x - sa[2] * shelved;
+
+		double y = pb[0] * shelved + z[2];
+		z[2] = pb[1] * shelved - pa[1] * y + z[3];
+		z[3] = pb[2] * shelved - pa[2] * y;
+
+		sum += y * y;
+	}
+
+	// Keep silence from decaying into denormals
+	for (int i = 0; i < 4; i++)
+	{
+		if (fabs(z[i]) < 1e-30)
+			z[i] = 0.0;
+	}
+	return sum;
+}
+
+static double mean_of_last_blocks(const struct loudness_meter* meter, int count)
+{
+	double sum = 0.0;
+	for (int i = 1; i <= count; i++)
+		sum += meter->blocks[(meter->block_count - i) % LOUDNESS_SHORT_TERM_BLOCKS];
+	return sum / count;
+}
+
+// Mean loudness of the blocks above the absolute gate and `relative_gate`
+// below their own mean, the BS.1770 two-stage gating. The relative gate is
+// applied at the resolution of the bins.
+static double gated_loudness(const struct loudness_histogram* histogram,
+	double relative_gate, int* first_bin, uint64_t* count)
+{
+	double energy = 0.0;
+	uint64_t blocks = 0;
+	for (int bin = 0; bin < LOUDNESS_HISTOGRAM_BINS; bin++)
+	{
+		energy += histogram->energies[bin];
+		blocks += histogram->counts[bin];
+	}
+	if (!blocks)
+		return -INFINITY;
+
+	int start = histogram_bin(energy_to_lufs(energy / blocks) + relative_gate);
+	energy = 0.0;
+	blocks = 0;
+	for (int bin = start; bin < LOUDNESS_HISTOGRAM_BINS; bin++)
+	{
+		energy += histogram->energies[bin];
+		blocks += histogram->counts[bin];
+	}
+
+	*first_bin = start;
+	*count = blocks;
+	return blocks ? energy_to_lufs(energy / blocks) : -INFINITY;
+}
+
+// Spread between the 10th and 95th percentile of the gated short-term
+// loudness, EBU Tech 3342
+static double loudness_range(const struct loudness_histogram* histogram)
+{
+	int start;
+	uint64_t count;
+	if (!isfinite(gated_loudness(histogram, LOUDNESS_RANGE_GATE, &start, &count)))
+		return 0.0;
+
+	uint64_t low = (uint64_t)(count * 0.10);
+	uint64_t high = (uint64_t)(count * 0.95);
+	int lowBin = -1;
+	int highBin = start;
+	uint64_t seen = 0;
+	for (int bin = start; bin < LOUDNESS_HISTOGRAM_BINS; bin++)
+	{
+		seen += histogram->counts[bin];
+		if (lowBin < 0 && seen > low)
+			lowBin = bin;
+		if (seen > high)
+		{
+			highBin = bin;
+			break;
+		}
+	}
+	return lowBin < 0 ? 0.0 : (highBin - lowBin) / 10.0;
+}
+
+static void finish_block(struct loudness_meter* meter)
+{
+	meter->blocks[meter->block_count % LOUDNESS_SHORT_TERM_BLOCKS] =
+		meter->block_sum / meter->block_size;
+	meter->block_count++;
+	meter->block_sum = 0.0;
+	meter->block_frames = 0;
+
+	int start;
+	uint64_t count;
+	if (meter->block_count >= LOUDNESS_MOMENTARY_BLOCKS)
+	{
+		// Blocks overlap by 75%, one gating block every 100 ms
+		double energy = mean_of_last_blocks(meter, LOUDNESS_MOMENTARY_BLOCKS);
+		double momentary = energy_to_lufs(energy);
+		meter->values.momentary = (float)momentary;
+		if (momentary >= LOUDNESS_ABSOLUTE_GATE)
+		{
+			histogram_add(&meter->momentary_histogram, energy);
+			meter->values.integrated = (float)gated_loudness(
+				&meter->momentary_histogram, LOUDNESS_INTEGRATED_GATE,
+				&start, &count);
+		}
+	}
+
+	if (meter->block_count >= LOUDNESS_SHORT_TERM_BLOCKS)
+	{
+		double energy = mean_of_last_blocks(meter, LOUDNESS_SHORT_TERM_BLOCKS);
+		double shortTerm = energy_to_lufs(energy);
+		meter->values.short_term = (float)shortTerm;
+		if (shortTerm >= LOUDNESS_ABSOLUTE_GATE)
+		{
+			histogram_add(&meter->short_term_histogram, energy);
+			meter->values.range = (float)loudness_range(
+				&meter->short_term_histogram);
+		}
+	}
+}
+
+bool loudness_process(struct loudness_meter* meter, float* const* planes,
+	size_t frames, float mul)
+{
+	if (!meter->block_size)
+		return false;
+
+	bool updated = false;
+	double gain = (double)mul * mul;
+	size_t offset = 0;
+	while (offset < frames)
+	{
+		size_t count = meter->block_size - meter->block_frames;
+		if (count > frames - offset)
+			count = frames - offset;
+
+		double sum = 0.0;
+		for (int channel = 0; channel < meter->nr_channels; channel++)
+		{
+			double weight = channel_weight(channel, meter->nr_channels);
+			if (weight > 0.0)
+				sum += weight * k_weighted_sum(meter, channel,
+					planes[channel] + offset, count);
+		}
+		meter->block_sum += gain * sum;
+		meter->block_frames += (uint32_t)count;
+		offset += count;
+
+		if (meter->block_frames == meter->block_size)
+		{
+			finish_block(meter);
+			updated = true;
+		}
+	}
+	return updated;
+}
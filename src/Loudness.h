@@ -0,0 +1,72 @@
+#ifndef LOUDNESS_H
+#define LOUDNESS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Channels a meter can weight, the MAX_AUDIO_CHANNELS of libobs
+#define LOUDNESS_MAX_CHANNELS 8
+// 0.1 LU bins from -70 to +30 LUFS
+#define LOUDNESS_HISTOGRAM_BINS 1000
+// 3 s of 100 ms blocks
+#define LOUDNESS_SHORT_TERM_BLOCKS 30
+
+// Gating blocks above the absolute gate by loudness, with the summed energy
+// of each bin so the gated means stay exact
+struct loudness_histogram
+{
+	uint32_t counts[LOUDNESS_HISTOGRAM_BINS];
+	double energies[LOUDNESS_HISTOGRAM_BINS];
+};
+
+// EBU R128 results in LUFS (range in LU), -INFINITY until measurable
+struct loudness_values
+{
+	float momentary;
+	float short_term;
+	float integrated;
+	float range;
+};
+
+/**
+ * Incremental ITU-R BS.1770-4 / EBU R128 meter. Samples are K-weighted and
+ * summed into 100 ms blocks, momentary (400 ms) and short-term (3 s)
+ * loudness are averaged from the last blocks, and the gated integrated
+ * loudness and the loudness range (EBU Tech 3342) come from histograms of
+ * the momentary and short-term values, so memory stays constant however
+ * long the measurement runs (about 24 KB, nearly all of it the two
+ * histograms). Used from the audio thread only.
+ */
+struct loudness_meter
+{
+	uint32_t sample_rate;
+	int nr_channels;
+
+	// K-weighting, a high shelf then a high pass, per channel
+	double shelf_b[3], shelf_a[3];
+	double pass_b[3], pass_a[3];
+	double state[LOUDNESS_MAX_CHANNELS][4];
+
+	double block_sum;
+	uint32_t block_frames;
+	uint32_t block_size;
+	double blocks[LOUDNESS_SHORT_TERM_BLOCKS];
+	uint64_t block_count;
+
+	struct loudness_histogram momentary_histogram;
+	struct loudness_histogram short_term_histogram;
+
+	struct loudness_values values;
+};
+
+// Starts a new measurement, also when the sample rate or layout changed.
+// Channels past LOUDNESS_MAX_CHANNELS are not measured.
+void loudness_reset(struct loudness_meter* meter, uint32_t sample_rate,
+	int nr_channels);
+
+// Feeds one buffer of planar float samples scaled by `mul`. Returns true
+// when a block was completed and `values` were updated.
+bool loudness_process(struct loudness_meter* meter, float* const* planes,
+	size_t frames, float mul);
+
+#endif // LOUDNESS_H
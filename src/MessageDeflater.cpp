@@ -0,0 +1,60 @@
+#include <util/platform.h>
+
+#include "MessageDeflater.h"
+
+MessageDeflater::MessageDeflater(int level, int windowBits, bool contextTakeover) :
+	bytesIn(0),
+	bytesOut(0),
+	deflateTimeNs(0),
+	_stream(),
+	_valid(false),
+	_level(level < 0 || level > 9 ? Z_DEFAULT_COMPRESSION : level),
+	// zlib cannot produce raw deflate streams with a 256 byte window
+	_windowBits(windowBits < 9 ? 9 : (windowBits > 15 ? 15 : windowBits)),
+	_contextTakeover(contextTakeover)
+{
+	_valid = deflateInit2(&_stream, _level, Z_DEFLATED, -_windowBits,
+		8, Z_DEFAULT_STRATEGY) == Z_OK;
+}
+
+MessageDeflater::~MessageDeflater()
+{
+	if (_valid)
+		deflateEnd(&_stream);
+}
+
+QByteArray MessageDeflater::compress(const QByteArray& payload)
+{
+	uint64_t start = os_gettime_ns();
+
+	QByteArray output;
+	output.resize((int)deflateBound(&_stream, payload.size()) + 16);
+
+	_stream.next_in = (Bytef*)payload.constData();
+	_stream.avail_in = payload.size();
+
+	int written = 0;
+	do
+	{
+		if (written == output.size())
+			output.resize(output.size() * 2);
+
+		_stream.next_out = (Bytef*)output.data() + written;
+		_stream.avail_out = output.size() - written;
+		deflate(&_stream, Z_SYNC_FLUSH);
+		written = output.size() - _stream.avail_out;
+	} while (_stream.avail_out == 0);
+
+	// RFC 7692 7.2.1: strip the empty stored block ending the sync flush
+	if (written >= 4)
+		written -= 4;
+	output.resize(written);
+
+	if (!_contextTakeover)
+		deflateReset(&_stream);
+
+	bytesIn += payload.size();
+	bytesOut += output.size();
+	deflateTimeNs += os_gettime_ns() - start;
+	return output;
+}
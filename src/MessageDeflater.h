@@ -0,0 +1,43 @@
+#ifndef MESSAGEDEFLATER_H
+#define MESSAGEDEFLATER_H
+
+#include <QByteArray>
+#include <zlib.h>
+
+/**
+ * Per-client compressor producing payloads formatted like RFC 7692
+ * (permessage-deflate) messages: raw deflate, flushed with Z_SYNC_FLUSH and
+ * with the trailing 0x00 0x00 0xff 0xff removed. They are sent as plain
+ * binary frames, the extension isn't negotiated on the WebSocket itself
+ * (QWebSocket can't), so clients inflate them at the application level.
+ * With context takeover the sliding window is kept between messages, so
+ * messages must be compressed in send order.
+ */
+class MessageDeflater
+{
+public:
+	MessageDeflater(int level, int windowBits, bool contextTakeover);
+	~MessageDeflater();
+
+	// False when zlib couldn't set up the stream, compress() must not be used
+	bool isValid() const { return _valid; }
+
+	QByteArray compress(const QByteArray& payload);
+
+	int level() const { return _level; }
+	int windowBits() const { return _windowBits; }
+	bool contextTakeover() const { return _contextTakeover; }
+
+	qint64 bytesIn;
+	qint64 bytesOut;
+	quint64 deflateTimeNs;
+
+private:
+	z_stream _stream;
+	bool _valid;
+	int _level;
+	int _windowBits;
+	bool _contextTakeover;
+};
+
+#endif // MESSAGEDEFLATER_H
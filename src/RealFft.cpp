@@ -0,0 +1,103 @@
+#include <math.h>
+
+#include "RealFft.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+RealFft::RealFft(int size)
+	: _size(size)
+{
+	int half = size / 2;
+
+	_cos.resize(half / 2);
+	_sin.resize(half / 2);
+	for (int t = 0; t < half / 2; t++)
+	{
+		_cos[t] = (float)cos(2.0 * M_PI * t / half);
+		_sin[t] = (float)-sin(2.0 * M_PI * t / half);
+	}
+
+	_splitCos.resize(half + 1);
+	_splitSin.resize(half + 1);
+	for (int k = 0; k <= half; k++)
+	{
+		_splitCos[k] = (float)cos(2.0 * M_PI * k / size);
+		_splitSin[k] = (float)-sin(2.0 * M_PI * k / size);
+	}
+
+	int bits = 0;
+	while ((1 << bits) < half)
+		bits++;
+	_bitReverse.resize(half);
+	for (int i = 0; i < half; i++)
+	{
+		int reversed = 0;
+		for (int bit = 0; bit < bits; bit++)
+		{
+			if (i & (1 << bit))
+				reversed |= 1 << (bits - 1 - bit);
+		}
+		_bitReverse[i] = reversed;
+	}
+
+	_re.resize(half);
+	_im.resize(half);
+}
+
+void RealFft::powerSpectrum(const float* input, float* power)
+{
+	int half = _size / 2;
+	float* re = _re.data();
+	float* im = _im.data();
+
+	for (int i = 0; i < half; i++)
+	{
+		re[_bitReverse[i]] = input[2 * i];
+		im[_bitReverse[i]] = input[2 * i + 1];
+	}
+
+	for (int length = 2; length <= half; length <<= 1)
+	{
+		int step = half / length;
+		int span = length / 2;
+		for (int start = 0; start < half; start += length)
+		{
+			for (int j = 0; j < span; j++)
+			{
+				float wr = _cos[j * step];
+				float wi = _sin[j * step];
+				int a = start + j;
+				int b = a + span;
+				float xr = re[b] * wr - im[b] * wi;
+				float xi = re[b] * wi + im[b] * wr;
+				re[b] = re[a] - xr;
+				im[b] = im[a] - xi;
+				re[a] += xr;
+				im[a] += xi;
+			}
+		}
+	}
+
+	// X[k] = E[k] + W^k O[k], with E and O the spectra of the even and
+	// odd samples recovered from Z[k] and conj(Z[half - k])
+	for (int k = 0; k <= half; k++)
+	{
+		int forward = k % half;
+		int mirrored = (half - k) % half;
+		float zr = re[forward];
+		float zi = im[forward];
+		float cr = re[mirrored];
+		float ci = -im[mirrored];
+
+		float er = 0.5f * (zr + cr);
+		float ei = 0.5f * (zi + ci);
+		float orr = 0.5f * (zi - ci);
+		float oi = -0.5f * (zr - cr);
+
+		float xr = er + _splitCos[k] * orr - _splitSin[k] * oi;
+		float xi = ei + _splitCos[k] * oi + _splitSin[k] * orr;
+		power[k] = xr * xr + xi * xi;
+	}
+}
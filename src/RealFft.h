@@ -0,0 +1,35 @@
+#ifndef REALFFT_H
+#define REALFFT_H
+
+#include <QVector>
+
+/**
+ * FFT of real input: a radix-2 complex FFT of half the size over the even
+ * and odd samples packed as real and imaginary parts, split into the
+ * spectrum of the real signal afterwards. Tables are built once per size.
+ */
+class RealFft
+{
+public:
+	// `size` is a power of two, at least 4
+	explicit RealFft(int size);
+
+	int size() const { return _size; }
+
+	// Squared magnitudes of bins 0 to size / 2 (size / 2 + 1 values)
+	void powerSpectrum(const float* input, float* power);
+
+private:
+	int _size;
+	// e^(-2 pi i t / (size / 2)) for the butterflies
+	QVector<float> _cos;
+	QVector<float> _sin;
+	// e^(-2 pi i k / size) for the split
+	QVector<float> _splitCos;
+	QVector<float> _splitSin;
+	QVector<int> _bitReverse;
+	QVector<float> _re;
+	QVector<float> _im;
+};
+
+#endif // REALFFT_H
@@ -0,0 +1,168 @@
+#include <string.h>
+
+#include "RequestHeader.h"
+
+static const char* const request_names[] = {
+#define X(name, async, params) #name,
+	REQUEST_HANDLERS(X)
+#undef X
+};
+
+// FNV-1a, evaluated at compile time for the case labels below. Two request
+// names with the same hash fail to compile as duplicate cases.
+static constexpr uint32_t request_hash(const char* name,
+	uint32_t hash = 2166136261u)
+{
+	return *name
+		? request_hash(name + 1, (hash ^ (uint8_t)*name) * 16777619u)
+		: hash;
+}
+
+int find_request(const char* type)
+{
+	int index;
+	switch (request_hash(type))
+	{
+#define X(name, async, params) \
+	case request_hash(#name): \
+		index = request_##name; \
+		break;
+	REQUEST_HANDLERS(X)
+#undef X
+	default:
+		return -1;
+	}
+
+	return strcmp(request_names[index], type) == 0 ? index : -1;
+}
+
+// Returns a pointer past the closing quote of the string starting at `p`
+static const char* skip_string(const char* p, const char* end, bool* escaped)
+{
+	for (p++; p < end; p++)
+	{
+		if (*p == '"')
+			return p + 1;
+		if (*p == '\\')
+		{
+			if (escaped)
+				*escaped = true;
+			p++;
+		}
+	}
+	return nullptr;
+}
+
+// Returns a pointer to the ',' or '}' ending the member value at `p`
+static const char* skip_value(const char* p, const char* end)
+{
+	int depth = 0;
+	while (p < end)
+	{
+		char c = *p;
+		if (c == '"')
+		{
+			p = skip_string(p, end, nullptr);
+			if (!p)
+				return nullptr;
+			continue;
+		}
+
+		if (c == '{' || c == '[')
+			depth++;
+		else if (c == ']' || c == '}')
+		{
+			if (depth == 0)
+				return c == '}' ? p : nullptr;
+			depth--;
+		}
+		else if (c == ',' && depth == 0)
+			return p;
+		p++;
+	}
+	return nullptr;
+}
+
+static const char* skip_whitespace(const char* p, const char* end)
+{
+	while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+		p++;
+	return p;
+}
+
+bool scan_request_header(const char* message, size_t length,
+	request_header* header)
+{
+	const char* p = message;
+	const char* end = p + length;
+	bool hasType = false;
+	bool hasId = false;
+
+	p = skip_whitespace(p, end);
+	if (p == end || *p++ != '{')
+		return false;
+
+	while (true)
+	{
+		p = skip_whitespace(p, end);
+		if (p == end || *p != '"')
+			return false;
+
+		bool escaped = false;
+		const char* key = p + 1;
+		p = skip_string(p, end, &escaped);
+		if (!p || escaped)
+			return false;
+		bool isType = false;
+		bool isId = false;
+		size_t keyLength = p - 1 - key;
+		if (keyLength == 12 && memcmp(key, "request-type", 12) == 0)
+			isType = true;
+		else if (keyLength == 10 && memcmp(key, "message-id", 10) == 0)
+			isId = true;
+
+		p = skip_whitespace(p, end);
+		if (p == end || *p++ != ':')
+			return false;
+		p = skip_whitespace(p, end);
+
+		if (isType || isId)
+		{
+			if (p == end || *p != '"')
+				return false;
+			const char* value = p + 1;
+			p = skip_string(p, end, &escaped);
+			if (!p || escaped)
+				return false;
+			if (isType)
+			{
+				header->type = value;
+				header->type_length = p - 1 - value;
+				hasType = true;
+			}
+			else
+			{
+				header->message_id = value;
+				header->message_id_length = p - 1 - value;
+				hasId = true;
+			}
+			p = skip_whitespace(p, end);
+		}
+		else
+		{
+			p = skip_value(p, end);
+			if (!p)
+				return false;
+		}
+
+		if (p == end)
+			return false;
+		if (*p == '}')
+			break;
+		if (*p++ != ',')
+			return false;
+	}
+
+	return hasType && hasId
+		&& skip_whitespace(p + 1, end) == end;
+}
@@ -0,0 +1,78 @@
+#ifndef REQUESTHEADER_H
+#define REQUESTHEADER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Handler name, whether it runs on the worker pool (it may only use OBS
+// APIs that are safe to call from any thread, and no client state), and
+// whether it reads request fields
+#define REQUEST_HANDLERS(X) \
+	X(GetVersion, true, false) \
+	X(GetAuthRequired, false, false) \
+	X(Authenticate, false, true) \
+	\
+	X(SetHeartbeat, false, true) \
+	X(ExecuteBatch, false, true) \
+	X(SetResponseOrdering, false, true) \
+	X(Resume, false, true) \
+	X(SetBatching, false, true) \
+	\
+	X(SetVideo, false, true) \
+	X(SetAudio, false, true) \
+	X(GetAudioFilters, false, false) \
+	X(ResetLoudness, false, true) \
+	X(StartSyncMeasurement, false, true) \
+	X(StopSyncMeasurement, false, true) \
+	X(SetCompression, false, true) \
+	X(Subscribe, false, true) \
+	X(GetSubscriptions, false, false) \
+	\
+	X(GetSourceFilters, true, true) \
+	X(AddFilterToSource, false, true) \
+	X(RemoveFilterFromSource, false, true) \
+	X(ReorderSourceFilter, false, true) \
+	X(MoveSourceFilter, false, true) \
+	X(SetSourceFilterSettings, true, true) \
+	X(SetSourceFilterVisibility, true, true) \
+	X(TriggerHotkeyOnSource, true, true) \
+	X(SendCaptions, true, true) \
+	\
+	X(GetSharedMemoryTransport, false, true) \
+	X(GetFilterLayout, false, true) \
+	X(SetCompactUpdates, false, true) \
+	X(GetDetectionState, false, true)
+
+enum request_index
+{
+#define X(name, async, params) request_##name,
+	REQUEST_HANDLERS(X)
+#undef X
+	request_count
+};
+
+/**
+ * Index of the request named `type` in REQUEST_HANDLERS, or -1 when there
+ * is no such request. `type` is NUL-terminated.
+ */
+int find_request(const char* type);
+
+// request-type and message-id of a text request, pointing into the message
+struct request_header
+{
+	const char* type;
+	size_t type_length;
+	const char* message_id;
+	size_t message_id_length;
+};
+
+/**
+ * Read the request-type and message-id members in one pass over the
+ * message, without building the obs_data tree. Other values are skipped
+ * without being validated. Returns false when the message doesn't have both
+ * as plain strings, the full parser then handles it and reports errors.
+ */
+bool scan_request_header(const char* message, size_t length,
+	request_header* header);
+
+#endif // REQUESTHEADER_H
@@ -0,0 +1,164 @@
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <limits.h>
+#endif
+#include <string.h>
+#include <new>
+
+#include <obs-module.h>
+
+#include "SharedMemoryRing.h"
+#include "obs-ostws.h"
+
+#define SHM_RING_ALIGN 64
+
+static uint32_t align_up(uint32_t size)
+{
+	return (size + SHM_RING_ALIGN - 1) & ~(SHM_RING_ALIGN - 1);
+}
+
+static void copy_name(char* dst, const char* src)
+{
+	strncpy(dst, src ? src : "", SHM_RING_NAME_SIZE - 1);
+	dst[SHM_RING_NAME_SIZE - 1] = '\0';
+}
+
+SharedMemoryRing::SharedMemoryRing() :
+	_header(nullptr),
+	_mappedSize(0),
+	_slotCount(0),
+	_slotSize(0),
+	_writing(0)
+{
+}
+
+SharedMemoryRing::~SharedMemoryRing()
+{
+	close();
+}
+
+bool SharedMemoryRing::open(uint32_t slotCount, uint32_t payloadSize)
+{
+#ifdef _WIN32
+	UNUSED_PARAMETER(slotCount);
+	UNUSED_PARAMETER(payloadSize);
+	return false;
+#else
+	close();
+
+	static std::atomic<uint32_t> counter(0);
+	_name = QString("/obs-ostws-%1-%2").arg(getpid()).arg(++counter);
+	_slotCount = slotCount;
+	_slotSize = align_up(sizeof(shm_slot_header) + payloadSize);
+
+	uint32_t headerSize = align_up(sizeof(shm_ring_header));
+	_mappedSize = headerSize + (size_t)_slotCount * _slotSize;
+
+	QByteArray name = _name.toUtf8();
+	int fd = shm_open(name.constData(), O_CREAT | O_EXCL | O_RDWR, 0600);
+	if (fd < 0)
+	{
+		blog(LOG_ERROR, "shm_open(%s) failed", name.constData());
+		return false;
+	}
+
+	void* memory = MAP_FAILED;
+	if (ftruncate(fd, _mappedSize) == 0)
+		memory = mmap(nullptr, _mappedSize, PROT_READ | PROT_WRITE,
+			MAP_SHARED, fd, 0);
+	::close(fd);
+
+	if (memory == MAP_FAILED)
+	{
+		blog(LOG_ERROR, "failed to map %zu bytes of shared memory for %s",
+			_mappedSize, name.constData());
+		shm_unlink(name.constData());
+		return false;
+	}
+
+	// ftruncate zero-fills, so every slot starts with seq 0 (never published)
+	_header = new (memory) shm_ring_header();
+	_header->magic = SHM_RING_MAGIC;
+	_header->version = SHM_RING_VERSION;
+	_header->header_size = headerSize;
+	_header->slot_count = _slotCount;
+	_header->slot_size = _slotSize;
+	_header->slot_header_size = sizeof(shm_slot_header);
+	_header->doorbell.store(0);
+	_header->write_seq.store(0, std::memory_order_release);
+	_writing = 0;
+	return true;
+#endif
+}
+
+void SharedMemoryRing::close()
+{
+#ifndef _WIN32
+	if (!_header)
+		return;
+
+	munmap(_header, _mappedSize);
+	shm_unlink(_name.toUtf8().constData());
+	_header = nullptr;
+#endif
+}
+
+shm_slot_header* SharedMemoryRing::slot(uint64_t seq) const
+{
+	uint8_t* base = (uint8_t*)_header + _header->header_size;
+	return (shm_slot_header*)(base + (seq % _slotCount) * _slotSize);
+}
+
+uint64_t SharedMemoryRing::lastSequence() const
+{
+	return _header ? _header->write_seq.load(std::memory_order_acquire) : 0;
+}
+
+uint8_t* SharedMemoryRing::beginWrite(shm_slot_type type, uint32_t length,
+	uint64_t timestamp, const char* source, const char* group,
+	const char* name, uint32_t width, uint32_t height)
+{
+	if (!_header || length > payloadSize())
+		return nullptr;
+
+	_writing = _header->write_seq.load(std::memory_order_relaxed) + 1;
+	shm_slot_header* header = slot(_writing);
+
+	// Invalidate the slot first so readers still copying it notice
+	header->seq.store(0, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	header->timestamp = timestamp;
+	header->type = type;
+	header->length = length;
+	header->width = width;
+	header->height = height;
+	copy_name(header->source, source);
+	copy_name(header->group, group);
+	copy_name(header->name, name);
+
+	return (uint8_t*)header + sizeof(shm_slot_header);
+}
+
+void SharedMemoryRing::endWrite()
+{
+	if (!_header || !_writing)
+		return;
+
+	slot(_writing)->seq.store(_writing, std::memory_order_release);
+	_header->write_seq.store(_writing, std::memory_order_release);
+	_writing = 0;
+
+	_header->doorbell.fetch_add(1, std::memory_order_release);
+#ifdef __linux__
+	// Shared (not FUTEX_PRIVATE) wake so waiters in other processes see it
+	syscall(SYS_futex, &_header->doorbell, FUTEX_WAKE, INT_MAX,
+		nullptr, nullptr, 0);
+#endif
+}
@@ -0,0 +1,92 @@
+#ifndef SHAREDMEMORYRING_H
+#define SHAREDMEMORYRING_H
+
+#include <atomic>
+#include <stdint.h>
+#include <QString>
+
+#define SHM_RING_MAGIC 0x5254534F // "OSTR"
+#define SHM_RING_VERSION 1
+#define SHM_RING_NAME_SIZE 64
+
+enum shm_slot_type
+{
+	shm_slot_pixels = 1, // BGRA rows of a rectangle, width * 4 bytes per row
+	shm_slot_event = 2 // UTF-8 JSON of a GroupUpdate or RectangleUpdate
+};
+
+/**
+ * Start of the shared memory object. Readers wait on `doorbell` (a futex
+ * word incremented on every publish) and process every sequence number
+ * up to `write_seq`; slot n lives at header_size + (n % slot_count) * slot_size.
+ */
+struct shm_ring_header
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t header_size;
+	uint32_t slot_count;
+	uint32_t slot_size;
+	uint32_t slot_header_size;
+	std::atomic<uint32_t> doorbell;
+	uint32_t reserved;
+	std::atomic<uint64_t> write_seq;
+};
+
+/**
+ * A slot is being rewritten while `seq` differs from the sequence number the
+ * reader expects; readers copy the payload and check `seq` again afterwards
+ * to detect being overrun.
+ */
+struct shm_slot_header
+{
+	std::atomic<uint64_t> seq;
+	uint64_t timestamp;
+	uint32_t type;
+	uint32_t length;
+	uint32_t width;
+	uint32_t height;
+	char source[SHM_RING_NAME_SIZE];
+	char group[SHM_RING_NAME_SIZE];
+	char name[SHM_RING_NAME_SIZE];
+};
+
+/**
+ * Single producer ring buffer in POSIX shared memory, written by one video
+ * filter and read by co-located consumers without going through the socket.
+ */
+class SharedMemoryRing
+{
+public:
+	SharedMemoryRing();
+	~SharedMemoryRing();
+
+	bool open(uint32_t slotCount, uint32_t payloadSize);
+	void close();
+
+	uint8_t* beginWrite(shm_slot_type type, uint32_t length,
+		uint64_t timestamp, const char* source, const char* group,
+		const char* name, uint32_t width = 0, uint32_t height = 0);
+	void endWrite();
+
+	bool isOpen() const { return _header != nullptr; }
+	const QString& name() const { return _name; }
+	size_t size() const { return _mappedSize; }
+	uint32_t headerSize() const { return _header ? _header->header_size : 0; }
+	uint32_t slotCount() const { return _slotCount; }
+	uint32_t slotSize() const { return _slotSize; }
+	uint32_t payloadSize() const { return _slotSize - sizeof(shm_slot_header); }
+	uint64_t lastSequence() const;
+
+private:
+	shm_slot_header* slot(uint64_t seq) const;
+
+	QString _name;
+	shm_ring_header* _header;
+	size_t _mappedSize;
+	uint32_t _slotCount;
+	uint32_t _slotSize;
+	uint64_t _writing;
+};
+
+#endif // SHAREDMEMORYRING_H
@@ -0,0 +1,114 @@
+#include <math.h>
+
+#include "SyncCorrelator.h"
+
+// Levels below this don't count, so noise doesn't make onsets
+#define SYNC_LEVEL_FLOOR -60.0f
+
+SyncEnvelope::SyncEnvelope()
+	: _latest(-1),
+	  _levelSlot(-1),
+	  _level(SYNC_LEVEL_FLOOR)
+{
+	_values.resize(SYNC_HISTORY_SLOTS);
+	_slots.resize(SYNC_HISTORY_SLOTS);
+	_slots.fill(-1);
+}
+
+void SyncEnvelope::set(int64_t slot, float value)
+{
+	if (slot < 0 || (_latest >= 0 && slot <= _latest - SYNC_HISTORY_SLOTS))
+		return;
+
+	int index = (int)(slot & (SYNC_HISTORY_SLOTS - 1));
+	_values[index] = value;
+	_slots[index] = slot;
+	if (slot > _latest)
+		_latest = slot;
+}
+
+void SyncEnvelope::addLevel(int64_t slot, float level)
+{
+	level = fmaxf(level, SYNC_LEVEL_FLOOR);
+	// After a gap the level rises from the floor
+	float previous = slot - 1 == _levelSlot ? _level : SYNC_LEVEL_FLOOR;
+	set(slot, fmaxf(level - previous, 0.0f));
+	_levelSlot = slot;
+	_level = level;
+}
+
+void SyncEnvelope::addEdge(int64_t slot)
+{
+	set(slot, 1.0f);
+}
+
+float SyncEnvelope::at(int64_t slot) const
+{
+	int index = (int)(slot & (SYNC_HISTORY_SLOTS - 1));
+	return slot >= 0 && _slots[index] == slot ? _values[index] : 0.0f;
+}
+
+bool sync_correlate(const SyncEnvelope& reference, const SyncEnvelope& target,
+	int64_t end, int window, int maxLag, sync_result* result)
+{
+	int64_t first = end - maxLag - window + 1;
+	int64_t last = end - maxLag;
+	int64_t targetFirst = first - maxLag;
+	int count = window + 2 * maxLag;
+
+	QVector<float> referenceValues(window);
+	QVector<float> targetValues(count);
+	double referenceEnergy = 0.0;
+	for (int i = 0; i < window; i++)
+	{
+		referenceValues[i] = reference.at(first + i);
+		referenceEnergy += referenceValues[i] * referenceValues[i];
+	}
+	for (int i = 0; i < count; i++)
+		targetValues[i] = target.at(targetFirst + i);
+	if (referenceEnergy <= 0.0 || last < 0)
+		return false;
+
+	// Energy of the target under the window, slid along with the lag
+	double targetEnergy = 0.0;
+	for (int i = 0; i < window; i++)
+		targetEnergy += targetValues[i] * targetValues[i];
+
+	QVector<double> scores(2 * maxLag + 1);
+	int best = -1;
+	for (int lag = -maxLag; lag <= maxLag; lag++)
+	{
+		int shift = lag + maxLag;
+		if (lag > -maxLag)
+		{
+			float out = targetValues[shift - 1];
+			float in = targetValues[shift + window - 1];
+			targetEnergy += in * in - out * out;
+		}
+
+		double sum = 0.0;
+		for (int i = 0; i < window; i++)
+			sum += referenceValues[i] * targetValues[shift + i];
+
+		scores[shift] = targetEnergy > 1e-12
+			? sum / sqrt(referenceEnergy * targetEnergy) : 0.0;
+		if (best < 0 || scores[shift] > scores[best])
+			best = shift;
+	}
+	if (scores[best] <= 0.0)
+		return false;
+
+	// Parabolic interpolation between the neighbouring lags
+	double lag = best - maxLag;
+	if (best > 0 && best < 2 * maxLag)
+	{
+		double denominator = scores[best - 1] - 2.0 * scores[best] + scores[best + 1];
+		if (denominator < 0.0)
+			lag += 0.5 * (scores[best - 1] - scores[best + 1]) / denominator;
+	}
+
+	result->offset = lag * (SYNC_SLOT_NS / 1000000.0);
+	result->confidence = fmin(scores[best], 1.0);
+	result->end = end;
+	return true;
+}
@@ -0,0 +1,59 @@
+#ifndef SYNCCORRELATOR_H
+#define SYNCCORRELATOR_H
+
+#include <stdint.h>
+#include <QVector>
+
+// Envelopes are sampled on a grid of OBS timestamps, in 5 ms slots
+#define SYNC_SLOT_NS 5000000LL
+#define SYNC_SLOTS_PER_SECOND 200
+// Slots kept, a power of two above the longest window plus both lags
+#define SYNC_HISTORY_SLOTS 4096
+
+/**
+ * Onset envelope of one side of a sync measurement: how much the signal
+ * rose in every slot, the log level of an audio source or the flashes of
+ * a video rectangle. Slots nothing was added to count as no rise, so
+ * sparse sides only add their edges, in any order within the history.
+ */
+class SyncEnvelope
+{
+public:
+	SyncEnvelope();
+
+	// Audio, the rise of the level in dBFS since the previous slot
+	void addLevel(int64_t slot, float level);
+	// Video, a rising edge of the detection state
+	void addEdge(int64_t slot);
+
+	float at(int64_t slot) const;
+	// Last slot added, -1 if none
+	int64_t latest() const { return _latest; }
+
+private:
+	void set(int64_t slot, float value);
+
+	QVector<float> _values;
+	QVector<int64_t> _slots;
+	int64_t _latest;
+	int64_t _levelSlot;
+	float _level;
+};
+
+struct sync_result
+{
+	// Milliseconds the target is late on the reference, negative if early
+	double offset;
+	// Normalized correlation of the envelopes at that offset, 0 to 1
+	double confidence;
+	// Last slot of the target window
+	int64_t end;
+};
+
+// Cross-correlates the last `window` slots of the reference up to `end`,
+// minus `maxLag`, with the target shifted by up to `maxLag` slots either
+// way. Returns false when either side had no onsets.
+bool sync_correlate(const SyncEnvelope& reference, const SyncEnvelope& target,
+	int64_t end, int window, int maxLag, sync_result* result);
+
+#endif // SYNCCORRELATOR_H
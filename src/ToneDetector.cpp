@@ -0,0 +1,111 @@
+#include <math.h>
+
+#include "ToneDetector.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+static uint64_t frames_to_ns(uint64_t frames, uint32_t sample_rate)
+{
+	return frames * 1000000000ULL / sample_rate;
+}
+
+void tone_detector_reset(struct tone_detector* detector, uint32_t sample_rate)
+{
+	detector->sample_rate = sample_rate;
+	detector->block_size = (uint32_t)fmax(lround(sample_rate / detector->bandwidth), 1.0);
+	// Exact frequency rather than the nearest bin of the block, the
+	// magnitude of the generalized Goertzel doesn't need an integer bin
+	detector->coefficient = 2.0 * cos(2.0 * M_PI * detector->frequency / sample_rate);
+	detector->block_frames = 0;
+	detector->s1 = 0.0;
+	detector->s2 = 0.0;
+	detector->detecting = false;
+}
+
+// Level of the finished block, then starts the next one
+static float finish_block(struct tone_detector* detector)
+{
+	double power = detector->s1 * detector->s1 + detector->s2 * detector->s2
+		- detector->coefficient * detector->s1 * detector->s2;
+	double amplitude = 2.0 * sqrt(fmax(power, 0.0)) / detector->block_size;
+
+	detector->block_frames = 0;
+	detector->s1 = 0.0;
+	detector->s2 = 0.0;
+	return amplitude > 0.0 ? (float)(20.0 * log10(amplitude)) : -INFINITY;
+}
+
+static bool update_state(struct tone_detector* detector, uint64_t block_end)
+{
+	float level = detector->level;
+
+	if (detector->state)
+	{
+		if (level >= detector->threshold - detector->hysteresis)
+			return false;
+
+		detector->state = false;
+		detector->stateTimestamp = block_end;
+		return true;
+	}
+
+	if (level < detector->threshold)
+	{
+		detector->detecting = false;
+		return false;
+	}
+
+	if (!detector->detecting)
+	{
+		detector->detecting = true;
+		detector->detecting_timestamp = detector->block_timestamp;
+	}
+	if (block_end - detector->detecting_timestamp < detector->duration)
+		return false;
+
+	detector->state = true;
+	detector->detecting = false;
+	detector->stateTimestamp = block_end;
+	return true;
+}
+
+size_t tone_detector_process(struct tone_detector* detector,
+	const float* mix, size_t offset, size_t frames, uint64_t timestamp,
+	bool* changed)
+{
+	*changed = false;
+	if (!detector->sample_rate || offset >= frames)
+		return frames - offset;
+
+	if (detector->block_frames == 0)
+		detector->block_timestamp = timestamp
+			+ frames_to_ns(offset, detector->sample_rate);
+
+	size_t count = detector->block_size - detector->block_frames;
+	if (count > frames - offset)
+		count = frames - offset;
+
+	double coefficient = detector->coefficient;
+	double s1 = detector->s1;
+	double s2 = detector->s2;
+	for (size_t i = offset; i < offset + count; i++)
+	{
+		double s0 = mix[i] + coefficient * s1 - s2;
+		s2 = s1;
+		s1 = s0;
+	}
+	detector->s1 = s1;
+	detector->s2 = s2;
+	detector->block_frames += (uint32_t)count;
+
+	if (detector->block_frames == detector->block_size)
+	{
+		uint64_t block_end = detector->block_timestamp
+			+ frames_to_ns(detector->block_size, detector->sample_rate);
+		detector->level = finish_block(detector);
+		*changed = update_state(detector, block_end);
+	}
+	return count;
+}
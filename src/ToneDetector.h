@@ -0,0 +1,60 @@
+#ifndef TONEDETECTOR_H
+#define TONEDETECTOR_H
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <QByteArray>
+#include <QString>
+
+/**
+ * Goertzel detector for one cue tone of an audio filter, run by the audio
+ * thread. The level of `frequency` is measured over blocks of
+ * 1 / `bandwidth` seconds of the channel average, in dB relative to a full
+ * scale sine and before the source volume. The state turns on after
+ * `duration` of consecutive blocks at or above `threshold` and off at the
+ * first block more than `hysteresis` below it. Memory stays constant
+ * whatever the buffer sizes. Names and ids work like audio_threshold.
+ */
+struct tone_detector
+{
+	QByteArray name;
+	QString name_string;
+	uint32_t id = 0;
+	double frequency = 1000.0;
+	double bandwidth = 50.0;
+	float threshold = -30.0f;
+	float hysteresis = 3.0f;
+	// In ns
+	uint64_t duration = 0;
+
+	bool state = false;
+	uint64_t stateTimestamp = 0;
+	// Level of the last completed block
+	float level = -INFINITY;
+
+	// Set up for `sample_rate` by tone_detector_reset
+	uint32_t sample_rate = 0;
+	double coefficient = 0.0;
+	uint32_t block_size = 0;
+	uint32_t block_frames = 0;
+	double s1 = 0.0;
+	double s2 = 0.0;
+	uint64_t block_timestamp = 0;
+	// Start of the first block of the current run over the threshold
+	bool detecting = false;
+	uint64_t detecting_timestamp = 0;
+};
+
+// Restarts the detector for a sample rate, also after settings changes
+void tone_detector_reset(struct tone_detector* detector, uint32_t sample_rate);
+
+// Feeds the channel average `mix` of `frames` frames starting at
+// `timestamp` from `offset` on, until a block completes. Returns the frames
+// consumed and sets `changed` when the completed block changed the state,
+// stateTimestamp is then the time it changed at.
+size_t tone_detector_process(struct tone_detector* detector,
+	const float* mix, size_t offset, size_t frames, uint64_t timestamp,
+	bool* changed);
+
+#endif // TONEDETECTOR_H
@@ -27,77 +27,82 @@ along with this program; If not, see <https://www.gnu.org/licenses/>
 #include <media-io/video-io.h>
 #include <media-io/video-frame.h>
 #include <media-io/audio-resampler.h>
+#include <QHash>
+#include <QSet>
 #include "WSServer.h"
-#include <QList>
+#include "VideoFilter.h"
+#include "JsonWriter.h"
+#include "AudioAnalyzer.h"
 
 #define TEXFORMAT GS_BGRA
 
-struct video_rectangle
+static const char hex_digits[] = "0123456789ABCDEF";
+
+const char* ostws_filter_getname(void* data)
 {
-	const char* name;
-	uint32_t x = 0;
-	uint32_t y = 0;
-	uint32_t width = 0;
-	uint32_t height = 0;
-	uint32_t color = 0;
-	uint32_t tolerance = 0;
-	uint32_t maxR = 0;
-	uint32_t maxG = 0;
-	uint32_t maxB = 0;
-	uint32_t maxA = 0;
-	uint32_t minR = 0;
-	uint32_t minG = 0;
-	uint32_t minB = 0;
-	uint32_t minA = 0;
-	bool invert = false;
-	bool output = false;
-	bool outputOnMatch = false;
-	uint64_t outputRate;
-	mutable uint64_t nextVideoUpdate;
-	mutable bool state = false;
-};
-
-struct video_group
+	UNUSED_PARAMETER(data);
+	return obs_module_text("OstWS (Video)");
+}
+
+void ostws_filter_update(void* data, obs_data_t* settings);
+
+void ostws_filter_getdefaults(obs_data_t* defaults)
 {
-	const char* name;
-	bool individual = false;
-	mutable bool state = false;
-	QList<video_rectangle>* rectangles;
-};
+}
 
-struct ostws_filter
+static void shm_publish_event(struct ostws_filter* s, const QByteArray& json,
+	uint64_t timestamp, const char* source, const char* group, const char* name)
 {
-	obs_source_t* context;
-	pthread_mutex_t ostws_sender_video_mutex;
-	struct obs_video_info ovi;
-	struct obs_audio_info oai;
+	uint32_t length = (uint32_t)json.size();
 
-	uint32_t known_width;
-	uint32_t known_height;
+	uint8_t* payload = s->shm_ring->beginWrite(shm_slot_event, length,
+		timestamp, source, group, name);
+	if (!payload)
+		return;
 
-	gs_texrender_t* texrender;
-	gs_stagesurf_t* stagesurface;
-	uint8_t* video_data;
-	uint32_t video_linesize;
+	memcpy(payload, json.constData(), length);
+	s->shm_ring->endWrite();
+}
 
-	video_t* video_output;
-	bool is_audioonly;
+static void shm_publish_pixels(struct ostws_filter* s, const video_group* group,
+	const video_rectangle* rectangle, const uint8_t* frameData,
+	uint32_t linesize, uint64_t timestamp, const char* source)
+{
+	if (rectangle->x >= s->known_width || rectangle->y >= s->known_height)
+		return;
 
-	uint64_t nextVideoUpdate;
+	const uint32_t width = min(rectangle->width, s->known_width - rectangle->x);
+	const uint32_t height = min(rectangle->height, s->known_height - rectangle->y);
+	const uint32_t row_size = width * 4;
 
-	QList<video_group>* groups;
-};
+	uint8_t* payload = s->shm_ring->beginWrite(shm_slot_pixels,
+		row_size * height, timestamp, source, group->name.constData(),
+		rectangle->name.constData(),
+		width, height);
+	if (!payload)
+		return;
 
-const char* ostws_filter_getname(void* data)
-{
-	UNUSED_PARAMETER(data);
-	return obs_module_text("OstWS (Video)");
+	for (uint32_t y = 0; y < height; y++)
+	{
+		memcpy(payload + y * row_size,
+		       frameData + (rectangle->y + y) * linesize + rectangle->x * 4,
+		       row_size);
+	}
+	s->shm_ring->endWrite();
 }
 
-void ostws_filter_update(void* data, obs_data_t* settings);
-
-void ostws_filter_getdefaults(obs_data_t* defaults)
+// ID-only counterpart of a state update, see GetFilterLayout
+static JsonWriter& compact_state_update(const char* updateType,
+	const ostws_filter* s, uint32_t id, bool state, bool lastState,
+	uint64_t timestamp, bool cbor)
 {
+	JsonWriter& writer = JsonWriter::Begin(updateType, cbor);
+	writer.writeInt("filter-id", s->id);
+	writer.writeInt("id", id);
+	writer.writeBool("state", state);
+	writer.writeBool("lastState", lastState);
+	writer.writeInt("timestamp", timestamp);
+	return writer;
 }
 
 void ostws_filter_raw_video(void* data, video_data* frame)
@@ -111,9 +116,16 @@ void ostws_filter_raw_video(void* data, video_data* frame)
 	uint32_t linesizeForLong = frame->linesize[0] / 4;
 
 	pthread_mutex_lock(&s->ostws_sender_video_mutex);
+	s->last_frame_timestamp = frame->timestamp;
 
+	const char* source_name =
+		obs_source_get_name(obs_filter_get_parent(s->context));
 	uint8_t* frameData = frame->data[0];
 	uint32_t* frameLongData = (uint32_t*)(frameData);
+	// State updates of a frame are queued together, so they always land in
+	// the same flush
+	QList<broadcast_message> frame_updates;
+	const bool cbor = WSServer::Instance->has_cbor_clients();
 	for (int groupIndex = 0; groupIndex < s->groups->count(); groupIndex++)
 	{
 		const video_group* group = &s->groups->at(groupIndex);
@@ -159,38 +171,76 @@ void ostws_filter_raw_video(void* data, video_data* frame)
 				}
 			}
 
-			if (group->individual && individualState != rectangle->state)
+			if (individualState != rectangle->state)
 			{
-				OBSDataAutoRelease obs_data = obs_data_create();
-				obs_data_set_string(obs_data, "update-type", "RectangleUpdate");
-				obs_data_set_string(obs_data, "name", rectangle->name);
-				obs_data_set_string(obs_data, "group", group->name);
-				obs_data_set_bool(obs_data, "state", individualState);
-				obs_data_set_bool(obs_data, "lastState", rectangle->state);
-				obs_data_set_int(obs_data, "timestamp", frame->timestamp);
-				WSServer::Instance->broadcast_thread_safe({
-					obs_data_get_json(obs_data),
-					video
-				});
+				if (group->individual)
+				{
+					JsonWriter& writer = JsonWriter::Begin("RectangleUpdate", cbor);
+					writer.writeString("name", rectangle->name.constData());
+					writer.writeString("group", group->name.constData());
+					writer.writeBool("state", individualState);
+					writer.writeBool("lastState", rectangle->state);
+					writer.writeInt("timestamp", frame->timestamp);
+
+					broadcast_message update = json_message(writer,
+						rectangle_state,
+						control,
+						source_name,
+						group->name_string,
+						rectangle->name_string
+					);
+					update.timestamp = frame->timestamp;
+					if (WSServer::Instance->has_compact_clients())
+						set_compact_form(update, compact_state_update(
+							"RectangleUpdate", s, rectangle->id,
+							individualState, rectangle->state, frame->timestamp,
+							cbor));
+					frame_updates << update;
+
+					if (s->shm_ring)
+						shm_publish_event(s, update.encoded->utf8,
+							frame->timestamp, source_name,
+							group->name.constData(), rectangle->name.constData());
+				}
+				if (os_atomic_load_long(&s->sync_users))
+					AudioAnalyzer::Instance->video_state_changed(s,
+						rectangle->id, individualState, frame->timestamp);
 				rectangle->state = individualState;
+				rectangle->stateTimestamp = frame->timestamp;
 			}
 		}
 
 		if (state != group->state)
 		{
-			OBSDataAutoRelease obs_data = obs_data_create();
-			obs_data_set_string(obs_data, "update-type", "GroupUpdate");
-			obs_data_set_string(obs_data, "name", group->name);
-			obs_data_set_bool(obs_data, "state", state);
-			obs_data_set_bool(obs_data, "lastState", group->state);
-			obs_data_set_int(obs_data, "timestamp", frame->timestamp);
-			WSServer::Instance->broadcast_thread_safe({
-				obs_data_get_json(obs_data),
-				video
-			});
+			JsonWriter& writer = JsonWriter::Begin("GroupUpdate", cbor);
+			writer.writeString("name", group->name.constData());
+			writer.writeBool("state", state);
+			writer.writeBool("lastState", group->state);
+			writer.writeInt("timestamp", frame->timestamp);
+
+			broadcast_message update = json_message(writer,
+				group_state,
+				control,
+				source_name,
+				group->name_string,
+				group->name_string
+			);
+			update.timestamp = frame->timestamp;
+			if (WSServer::Instance->has_compact_clients())
+				set_compact_form(update, compact_state_update(
+					"GroupUpdate", s, group->id,
+					state, group->state, frame->timestamp, cbor));
+			frame_updates << update;
+
+			if (s->shm_ring)
+				shm_publish_event(s, update.encoded->utf8, frame->timestamp,
+					source_name, group->name.constData(), group->name.constData());
 			group->state = state;
+			group->stateTimestamp = frame->timestamp;
 		}
 	}
+	if (!frame_updates.isEmpty())
+		WSServer::Instance->broadcast_thread_safe(frame_updates);
 
 	for (int groupIndex = 0; groupIndex < s->groups->count(); groupIndex++)
 	{
@@ -205,38 +255,62 @@ void ostws_filter_raw_video(void* data, video_data* frame)
 			{
 				rectangle->nextVideoUpdate = frame->timestamp + rectangle->outputRate * 1000000;
 
-				OBSDataAutoRelease obs_data = obs_data_create();
-				obs_data_set_string(obs_data, "update-type", "VideoUpdate");
-				obs_data_set_string(obs_data, "name", rectangle->name);
-				obs_data_set_string(obs_data, "group", group->name);
-				OBSDataArrayAutoRelease array = obs_data_array_create();
-
-				const uint32_t buffer_size = rectangle->height * rectangle->width * 8;
-				char* buffer = new char[buffer_size + 1];
-				uint32_t buffer_i = 0;
-
-				for (size_t y = rectangle->y; y < rectangle->y + rectangle->height; y++)
+				if (s->shm_ring)
+					shm_publish_pixels(s, group, rectangle, frameData,
+						linesize, frame->timestamp, source_name);
+
+				JsonWriter& writer = JsonWriter::Begin("VideoUpdate", cbor);
+				writer.writeString("name", rectangle->name.constData());
+				writer.writeString("group", group->name.constData());
+
+				// Pixels inside the frame, as %08X each
+				const uint32_t width = rectangle->x < s->known_width
+					? min(rectangle->width, s->known_width - rectangle->x) : 0;
+				const uint32_t height = rectangle->y < s->known_height
+					? min(rectangle->height, s->known_height - rectangle->y) : 0;
+				const int pixels_length = (int)(width * height * 8);
+				char* pixels = writer.writeStringInPlace("pixels",
+					pixels_length);
+				// The compact form copies the pixels from the full one
+				const int pixels_offset = writer.size() - pixels_length - 1;
+
+				for (uint32_t y = 0; y < height; y++)
 				{
-					if (y >= s->known_height)
-						break;
-
-					const size_t y_pos = y * linesizeForLong;
-					for (size_t x = rectangle->x; x < rectangle->x + rectangle->width; x++)
+					const uint32_t* row = frameLongData
+						+ (rectangle->y + y) * linesizeForLong + rectangle->x;
+					for (uint32_t x = 0; x < width; x++)
 					{
-						if (x >= s->known_width)
-							break;
-
-						sprintf(&buffer[buffer_i], "%08X", (*(frameLongData + y_pos + x)));
-						buffer_i = buffer_i + 8;
+						uint32_t color = row[x];
+						for (int nibble = 7; nibble >= 0; nibble--)
+						{
+							*pixels++ = hex_digits[color >> 28];
+							color <<= 4;
+						}
 					}
 				}
 
-				obs_data_set_string(obs_data, "pixels", buffer);
-				obs_data_set_int(obs_data, "timestamp", frame->timestamp);
-				WSServer::Instance->broadcast_thread_safe({
-					obs_data_get_json(obs_data),
-					video
-				});
+				writer.writeInt("timestamp", frame->timestamp);
+
+				broadcast_message update = json_message(writer,
+					video,
+					bulk,
+					source_name,
+					group->name_string,
+					rectangle->name_string
+				);
+				update.timestamp = frame->timestamp;
+				if (WSServer::Instance->has_compact_clients())
+				{
+					JsonWriter& compact = JsonWriter::Begin("VideoUpdate", cbor);
+					compact.writeInt("filter-id", s->id);
+					compact.writeInt("id", rectangle->id);
+					memcpy(compact.writeStringInPlace("pixels", pixels_length),
+						update.encoded->utf8.constData() + pixels_offset,
+						pixels_length);
+					compact.writeInt("timestamp", frame->timestamp);
+					set_compact_form(update, compact);
+				}
+				WSServer::Instance->broadcast_thread_safe(update);
 			}
 		}
 	}
@@ -329,6 +403,67 @@ void ostws_filter_offscreen_render(void* data, uint32_t cx, uint32_t cy)
 	}
 }
 
+obs_data_t* ostws_filter_detection_state(struct ostws_filter* s,
+	const client_config* client)
+{
+	obs_source_t* parent = obs_filter_get_parent(s->context);
+	const char* source_name = parent ? obs_source_get_name(parent) : "";
+	QString source = QString::fromUtf8(source_name);
+
+	obs_data_t* state = obs_data_create();
+	obs_data_set_string(state, "source", source_name);
+	obs_data_set_string(state, "filter", obs_source_get_name(s->context));
+	obs_data_set_int(state, "filter-id", s->id);
+
+	OBSDataArrayAutoRelease groups = obs_data_array_create();
+
+	pthread_mutex_lock(&s->ostws_sender_video_mutex);
+	obs_data_set_int(state, "layout-version", s->layout_version);
+	obs_data_set_int(state, "timestamp", s->last_frame_timestamp);
+	for (const video_group& group : *s->groups)
+	{
+		OBSDataArrayAutoRelease rectangles = obs_data_array_create();
+		for (const video_rectangle& rectangle : *group.rectangles)
+		{
+			if (client && !WSServer::accepts(client, rectangle_state, source,
+					group.name_string, rectangle.name_string))
+				continue;
+
+			OBSDataAutoRelease item = obs_data_create();
+			obs_data_set_int(item, "id", rectangle.id);
+			obs_data_set_string(item, "name", rectangle.name.constData());
+			obs_data_set_bool(item, "state", rectangle.state);
+			obs_data_set_int(item, "timestamp", rectangle.stateTimestamp);
+			obs_data_array_push_back(rectangles, item);
+		}
+
+		if (client && obs_data_array_count(rectangles) == 0
+			&& !WSServer::accepts(client, group_state, source,
+				group.name_string, group.name_string))
+			continue;
+
+		OBSDataAutoRelease item = obs_data_create();
+		obs_data_set_int(item, "id", group.id);
+		obs_data_set_string(item, "name", group.name.constData());
+		obs_data_set_bool(item, "individual", group.individual);
+		obs_data_set_bool(item, "state", group.state);
+		obs_data_set_int(item, "timestamp", group.stateTimestamp);
+		obs_data_set_array(item, "rectangles", rectangles);
+		obs_data_array_push_back(groups, item);
+	}
+	pthread_mutex_unlock(&s->ostws_sender_video_mutex);
+
+	obs_data_set_array(state, "groups", groups);
+	return state;
+}
+
+static void clear_groups(struct ostws_filter* s)
+{
+	for (const video_group& group : *s->groups)
+		delete group.rectangles;
+	s->groups->clear();
+}
+
 void ostws_filter_update(void* data, obs_data_t* settings)
 {
 	UNUSED_PARAMETER(settings);
@@ -345,7 +480,26 @@ void ostws_filter_update(void* data, obs_data_t* settings)
 	WSServer::Instance->broadcast_thread_safe(json);
 
 	pthread_mutex_lock(&s->ostws_sender_video_mutex);
-	s->groups->clear();
+
+	// Keep the ids of groups and rectangles that are still there
+	QHash<QByteArray, uint32_t> previous_ids;
+	for (const video_group& group : *s->groups)
+	{
+		previous_ids.insert(group.name, group.id);
+		for (const video_rectangle& rectangle : *group.rectangles)
+			previous_ids.insert(group.name + '\0' + rectangle.name, rectangle.id);
+	}
+	QSet<uint32_t> used_ids;
+	auto layout_id = [&](const QByteArray& key) -> uint32_t
+	{
+		uint32_t id = previous_ids.value(key);
+		if (!id || used_ids.contains(id))
+			id = ++s->next_layout_id;
+		used_ids.insert(id);
+		return id;
+	};
+
+	clear_groups(s);
 
 	OBSDataArrayAutoRelease groups = obs_data_get_array(settings, "groups");
 	for (size_t i = 0; i < obs_data_array_count(groups); ++i)
@@ -353,6 +507,8 @@ void ostws_filter_update(void* data, obs_data_t* settings)
 		OBSDataAutoRelease group = obs_data_array_item(groups, i);
 		video_group video_group;
 		video_group.name = obs_data_get_string(group, "name");
+		video_group.name_string = QString::fromUtf8(video_group.name);
+		video_group.id = layout_id(video_group.name);
 		video_group.individual = obs_data_get_bool(group, "individual");
 		video_group.rectangles = new QList<video_rectangle>();
 
@@ -363,6 +519,9 @@ void ostws_filter_update(void* data, obs_data_t* settings)
 
 			video_rectangle video_rectangle1;
 			video_rectangle1.name = obs_data_get_string(rectangle, "name");
+			video_rectangle1.name_string = QString::fromUtf8(video_rectangle1.name);
+			video_rectangle1.id = layout_id(
+				video_group.name + '\0' + video_rectangle1.name);
 			video_rectangle1.x = obs_data_get_int(rectangle, "x");
 			video_rectangle1.y = obs_data_get_int(rectangle, "y");
 			video_rectangle1.width = obs_data_get_int(rectangle, "width");
@@ -404,8 +563,17 @@ void ostws_filter_update(void* data, obs_data_t* settings)
 
 		s->groups->append(video_group);
 	}
+	s->layout_version++;
+	uint32_t layout_version = s->layout_version;
 	pthread_mutex_unlock(&s->ostws_sender_video_mutex);
 
+	OBSDataAutoRelease layout_data = obs_data_create();
+	obs_data_set_string(layout_data, "update-type", "FilterLayoutChanged");
+	obs_data_set_int(layout_data, "filter-id", s->id);
+	obs_data_set_int(layout_data, "layout-version", layout_version);
+	WSServer::Instance->broadcast_thread_safe(
+		{obs_data_get_json(layout_data), global, control, layout_data.Get()});
+
 	if (!s->is_audioonly)
 	{
 		obs_add_main_render_callback(ostws_filter_offscreen_render, s);
@@ -414,13 +582,17 @@ void ostws_filter_update(void* data, obs_data_t* settings)
 
 void* ostws_filter_create(obs_data_t* settings, obs_source_t* source)
 {
+	static volatile long next_filter_id = 0;
+
 	auto s = (struct ostws_filter*)bzalloc(sizeof(struct ostws_filter));
 	s->groups = new QList<video_group>();
+	s->id = (uint32_t)os_atomic_inc_long(&next_filter_id);
 	s->is_audioonly = false;
 	s->context = source;
 	s->texrender = gs_texrender_create(TEXFORMAT, GS_ZS_NONE);
 	s->video_data = nullptr;
 	pthread_mutex_init(&s->ostws_sender_video_mutex, NULL);
+	WSServer::Instance->add_video_filter(s);
 
 	obs_get_video_info(&s->ovi);
 	obs_get_audio_info(&s->oai);
@@ -445,8 +617,13 @@ void ostws_filter_destroy(void* data)
 	QString json = obs_data_get_json(obs_data);
 	WSServer::Instance->broadcast_thread_safe(json);
 
+	WSServer::Instance->remove_video_filter(s);
+	AudioAnalyzer::Instance->remove_video(s);
 	obs_remove_main_render_callback(ostws_filter_offscreen_render, s);
 	video_output_close(s->video_output);
+	delete s->shm_ring;
+	clear_groups(s);
+	delete s->groups;
 
 	gs_stagesurface_unmap(s->stagesurface);
 	gs_stagesurface_destroy(s->stagesurface);
@@ -0,0 +1,99 @@
+#ifndef VIDEOFILTER_H
+#define VIDEOFILTER_H
+
+#include <obs.h>
+#include <util/threading.h>
+#include <media-io/video-io.h>
+#include <QList>
+#include <QString>
+#include <QByteArray>
+
+#include "SharedMemoryRing.h"
+
+// Names are copied out of the settings, as UTF-8 for the serialized updates
+// and as QString for subscription matching. Ids stay the same across
+// settings updates for groups and rectangles whose names don't change.
+struct video_rectangle
+{
+	QByteArray name;
+	QString name_string;
+	uint32_t id = 0;
+	uint32_t x = 0;
+	uint32_t y = 0;
+	uint32_t width = 0;
+	uint32_t height = 0;
+	uint32_t color = 0;
+	uint32_t tolerance = 0;
+	uint32_t maxR = 0;
+	uint32_t maxG = 0;
+	uint32_t maxB = 0;
+	uint32_t maxA = 0;
+	uint32_t minR = 0;
+	uint32_t minG = 0;
+	uint32_t minB = 0;
+	uint32_t minA = 0;
+	bool invert = false;
+	bool output = false;
+	bool outputOnMatch = false;
+	uint64_t outputRate;
+	mutable uint64_t nextVideoUpdate;
+	// Last detected state and the frame it changed on, kept up to date
+	// whether or not updates are sent for it
+	mutable bool state = false;
+	mutable uint64_t stateTimestamp = 0;
+};
+
+struct video_group
+{
+	QByteArray name;
+	QString name_string;
+	uint32_t id = 0;
+	bool individual = false;
+	mutable bool state = false;
+	mutable uint64_t stateTimestamp = 0;
+	QList<video_rectangle>* rectangles;
+};
+
+struct ostws_filter
+{
+	obs_source_t* context;
+	pthread_mutex_t ostws_sender_video_mutex;
+	struct obs_video_info ovi;
+	struct obs_audio_info oai;
+
+	uint32_t known_width;
+	uint32_t known_height;
+
+	gs_texrender_t* texrender;
+	gs_stagesurf_t* stagesurface;
+	uint8_t* video_data;
+	uint32_t video_linesize;
+
+	video_t* video_output;
+	bool is_audioonly;
+
+	uint64_t nextVideoUpdate;
+	// Timestamp of the last analyzed frame, 0 before the first one
+	uint64_t last_frame_timestamp;
+
+	QList<video_group>* groups;
+	// Identifies the filter in compact updates, unique for the session
+	uint32_t id;
+	uint32_t next_layout_id;
+	uint32_t layout_version;
+
+	// Optional local transport, opened by GetSharedMemoryTransport
+	SharedMemoryRing* shm_ring;
+
+	// Sync measurements using a rectangle of the filter, see AudioAnalyzer
+	volatile long sync_users;
+};
+
+struct client_config;
+
+// Current group and rectangle states of the filter. With a client, only
+// the ones its subscriptions accept are included.
+obs_data_t* ostws_filter_detection_state(struct ostws_filter* s,
+	const client_config* client = nullptr);
+
+#endif // VIDEOFILTER_H
@@ -248,7 +248,7 @@ void WSEvents::broadcastUpdate(const char* updateType,
 		obs_data_apply(update, additionalFields);
 
 	QString json = obs_data_get_json(update);
-	_srv->broadcast(json);
+	_srv->broadcast({json, global, control, update.Get()});
 
 	if (Config::Current()->DebugEnabled)
 		blog(LOG_DEBUG, "Update << '%s'", json.toUtf8().constData());
@@ -17,45 +17,95 @@
  * with this program. If not, see <https://www.gnu.org/licenses/>
  */
 
+#include <QRunnable>
 #include <obs-data.h>
 
 #include "Config.h"
 #include "Utils.h"
+#include "Cbor.h"
 
+#include "RequestHeader.h"
 #include "WSRequestHandler.h"
+#include "WSServer.h"
 
-QHash<QString, void(*)(WSRequestHandler*)> WSRequestHandler::messageMap{
-	{"GetVersion", WSRequestHandler::HandleGetVersion},
-	{"GetAuthRequired", WSRequestHandler::HandleGetAuthRequired},
-	{"Authenticate", WSRequestHandler::HandleAuthenticate},
-
-	{"SetHeartbeat", WSRequestHandler::HandleSetHeartbeat},
-
-	{"SetVideo", WSRequestHandler::HandleSetVideo},
-	{"SetAudio", WSRequestHandler::HandleSetAudio},
-
-	{"GetSourceFilters", WSRequestHandler::HandleGetSourceFilters},
-	{"AddFilterToSource", WSRequestHandler::HandleAddFilterToSource},
-	{"RemoveFilterFromSource", WSRequestHandler::HandleRemoveFilterFromSource},
-	{"ReorderSourceFilter", WSRequestHandler::HandleReorderSourceFilter},
-	{"MoveSourceFilter", WSRequestHandler::HandleMoveSourceFilter},
-	{"SetSourceFilterSettings", WSRequestHandler::HandleSetSourceFilterSettings},
-	{"SetSourceFilterVisibility", WSRequestHandler::HandleSetSourceFilterVisibility},
-	{"TriggerHotkeyOnSource", WSRequestHandler::HandleTriggerHotkeyOnSource},
-	{"SendCaptions", WSRequestHandler::HandleSendCaptions},
+const WSRequestHandler::request_handler WSRequestHandler::requestHandlers[] = {
+#define X(name, async, params) {#name, WSRequestHandler::Handle##name, async, params},
+	REQUEST_HANDLERS(X)
+#undef X
 };
 
-WSRequestHandler::WSRequestHandler(QWebSocket* client) :
-	_messageId(0),
-	_requestType(""),
+const int WSRequestHandler::requestHandlerCount = request_count;
+
+const WSRequestHandler::request_handler* WSRequestHandler::findHandler(
+	const char* requestType)
+{
+	int index = find_request(requestType);
+	return index < 0 ? nullptr : &requestHandlers[index];
+}
+
+class AsyncRequest : public QRunnable
+{
+public:
+	AsyncRequest(WSRequestHandler* handler,
+		void (*handlerFunc)(WSRequestHandler*)) :
+		_handler(handler),
+		_handlerFunc(handlerFunc)
+	{
+	}
+
+	~AsyncRequest()
+	{
+		delete _handler;
+	}
+
+	void run() override
+	{
+		_handlerFunc(_handler);
+		WSServer::Instance->complete_request_thread_safe(
+			_handler->_clientId, _handler->_ticket);
+	}
+
+private:
+	WSRequestHandler* _handler;
+	void (*_handlerFunc)(WSRequestHandler*);
+};
+
+WSRequestHandler::WSRequestHandler(client_config* client) :
 	data(nullptr),
-	_client(client)
+	_batchResponses(nullptr),
+	_client(client),
+	_clientId(client ? client->id : 0),
+	_ticket(0),
+	_async(false),
+	_dispatched(false)
 {
 }
 
-void WSRequestHandler::processIncomingMessage(QString textMessage)
+void WSRequestHandler::processIncomingMessage(QByteArray msgData)
 {
-	QByteArray msgData = textMessage.toUtf8();
+	_ticket = _client->next_ticket++;
+
+	// Requests whose handler reads no fields (GetVersion, GetAuthRequired,
+	// GetAudioFilters, GetSubscriptions) are dispatched without building the
+	// tree. All others still go through the full parser below.
+	request_header header;
+	if (scan_request_header(msgData.constData(), msgData.size(), &header))
+	{
+		_requestType = QByteArray(header.type, (int)header.type_length);
+		_messageId = QByteArray(header.message_id,
+			(int)header.message_id_length);
+		const request_handler* handler = findHandler(_requestType.constData());
+		if (handler && !handler->params)
+		{
+			if (Config::Current()->DebugEnabled)
+				blog(LOG_DEBUG, "Request >> '%s'", msgData.constData());
+
+			dispatch(handler);
+			completeRequest();
+			return;
+		}
+	}
+
 	const char* msg = msgData.constData();
 
 	data = obs_data_create_from_json(msg);
@@ -66,6 +116,7 @@ void WSRequestHandler::processIncomingMessage(QString textMessage)
 
 		blog(LOG_ERROR, "invalid JSON payload received for '%s'", msg);
 		SendErrorResponse("invalid JSON payload");
+		completeRequest();
 		return;
 	}
 
@@ -74,6 +125,35 @@ void WSRequestHandler::processIncomingMessage(QString textMessage)
 		blog(LOG_DEBUG, "Request >> '%s'", msg);
 	}
 
+	processRequest();
+	completeRequest();
+}
+
+void WSRequestHandler::processIncomingBinaryMessage(QByteArray binaryMessage)
+{
+	_ticket = _client->next_ticket++;
+
+	data = Cbor::ToData(binaryMessage);
+	if (!data)
+	{
+		blog(LOG_ERROR, "invalid CBOR payload received (%d bytes)",
+			binaryMessage.size());
+		SendErrorResponse("invalid CBOR payload");
+		completeRequest();
+		return;
+	}
+
+	if (Config::Current()->DebugEnabled)
+	{
+		blog(LOG_DEBUG, "Request >> '%s'", obs_data_get_json(data));
+	}
+
+	processRequest();
+	completeRequest();
+}
+
+void WSRequestHandler::processRequest()
+{
 	if (!hasField("request-type")
 		|| !hasField("message-id"))
 	{
@@ -84,12 +164,43 @@ void WSRequestHandler::processIncomingMessage(QString textMessage)
 	_requestType = obs_data_get_string(data, "request-type");
 	_messageId = obs_data_get_string(data, "message-id");
 
-	void (*handlerFunc)(WSRequestHandler*) = (messageMap[_requestType]);
-
-	if (handlerFunc != nullptr)
-		handlerFunc(this);
-	else
+	const request_handler* handler = findHandler(_requestType.constData());
+	if (!handler)
+	{
 		SendErrorResponse("invalid request type");
+		return;
+	}
+
+	dispatch(handler);
+}
+
+void WSRequestHandler::dispatch(const request_handler* handler)
+{
+	if (!_batchResponses && handler->async)
+	{
+		WSRequestHandler* request = new WSRequestHandler(nullptr);
+		request->_clientId = _clientId;
+		request->_ticket = _ticket;
+		request->_async = true;
+		obs_data_addref(data);
+		request->data = data.Get();
+		request->_requestType = _requestType;
+		request->_messageId = _messageId;
+
+		_dispatched = true;
+		WSServer::Instance->run_request(new AsyncRequest(request, handler->func));
+		return;
+	}
+
+	handler->func(this);
+}
+
+// Lets the responses of later requests through, for clients waiting on
+// ordered responses. Requests running on the worker pool complete there.
+void WSRequestHandler::completeRequest()
+{
+	if (!_dispatched)
+		WSServer::Instance->complete_request(_clientId, _ticket);
 }
 
 WSRequestHandler::~WSRequestHandler()
@@ -133,8 +244,19 @@ void WSRequestHandler::SendErrorResponse(obs_data_t* additionalFields)
 
 void WSRequestHandler::SendResponse(obs_data_t* response)
 {
+	if (_batchResponses)
+	{
+		obs_data_array_push_back(_batchResponses, response);
+		return;
+	}
+
 	QString json = obs_data_get_json(response);
-	_client->sendTextMessage(json);
+	if (_async)
+		WSServer::Instance->respond_thread_safe(_clientId, _ticket,
+			{json, global, control, response});
+	else
+		WSServer::Instance->respond(_clientId, _ticket,
+			{json, global, control, response});
 
 	if (Config::Current()->DebugEnabled)
 		blog(LOG_DEBUG, "Response << '%s'", json.toUtf8().constData());
@@ -30,36 +30,82 @@ with this program. If not, see <https://www.gnu.org/licenses/>
 
 #include "obs-ostws.h"
 
+struct client_config;
+struct ostws_filter;
+struct ostws_audiofilter;
+
 class WSRequestHandler : public QObject {
   Q_OBJECT
 
   public:
-    explicit WSRequestHandler(QWebSocket* client);
+    explicit WSRequestHandler(client_config* client);
     ~WSRequestHandler();
-    void processIncomingMessage(QString textMessage);
+    void processIncomingMessage(QByteArray textMessage);
+    void processIncomingBinaryMessage(QByteArray binaryMessage);
     bool hasField(QString name);
 
   private:
-    QWebSocket* _client;
-    const char* _messageId;
-    const char* _requestType;
+    friend class AsyncRequest;
+
+    // Null while running on the worker pool, use _clientId there
+    client_config* _client;
+    quint64 _clientId;
+    quint64 _ticket;
+    bool _async;
+    bool _dispatched;
+    QByteArray _messageId;
+    QByteArray _requestType;
     OBSDataAutoRelease data;
-
+    // Set while running inside ExecuteBatch, responses are collected here
+    obs_data_array_t* _batchResponses;
+
+    struct request_handler
+    {
+        const char* name;
+        void (*func)(WSRequestHandler*);
+        // Runs on the worker pool / reads request fields
+        bool async;
+        bool params;
+    };
+
+    static const request_handler requestHandlers[];
+    static const int requestHandlerCount;
+    static const request_handler* findHandler(const char* requestType);
+
+    void processRequest();
+    void dispatch(const request_handler* handler);
+    void completeRequest();
+    // `hold` gets a reference to the filter source, for callers keeping
+    // the filter past the lookup
+    ostws_filter* findVideoFilter(const char* sourceField = "sourceName",
+        const char* filterField = "filterName", OBSSource* hold = nullptr);
+    ostws_audiofilter* findAudioFilter(const char* sourceField = "sourceName",
+        const char* filterField = "filterName", OBSSource* hold = nullptr);
     void SendOKResponse(obs_data_t* additionalFields = NULL);
     void SendErrorResponse(const char* errorMessage);
     void SendErrorResponse(obs_data_t* additionalFields = NULL);
     void SendResponse(obs_data_t* response);
 
-    static QHash<QString, void(*)(WSRequestHandler*)> messageMap;
 
     static void HandleGetVersion(WSRequestHandler* req);
     static void HandleGetAuthRequired(WSRequestHandler* req);
     static void HandleAuthenticate(WSRequestHandler* req);
 
     static void HandleSetHeartbeat(WSRequestHandler* req);
+    static void HandleExecuteBatch(WSRequestHandler* req);
+    static void HandleSetResponseOrdering(WSRequestHandler* req);
+    static void HandleResume(WSRequestHandler* req);
+    static void HandleSetBatching(WSRequestHandler* req);
 
     static void HandleSetVideo(WSRequestHandler* req);
     static void HandleSetAudio(WSRequestHandler* req);
+    static void HandleGetAudioFilters(WSRequestHandler* req);
+    static void HandleResetLoudness(WSRequestHandler* req);
+    static void HandleStartSyncMeasurement(WSRequestHandler* req);
+    static void HandleStopSyncMeasurement(WSRequestHandler* req);
+    static void HandleSubscribe(WSRequestHandler* req);
+    static void HandleGetSubscriptions(WSRequestHandler* req);
+    static void HandleSetCompression(WSRequestHandler* req);
 
 	static void HandleGetSourceFilters(WSRequestHandler* req);
 	static void HandleAddFilterToSource(WSRequestHandler* req);
@@ -70,6 +116,11 @@ class WSRequestHandler : public QObject {
 	static void HandleSetSourceFilterVisibility(WSRequestHandler* req);
 	static void HandleTriggerHotkeyOnSource(WSRequestHandler* req);
 	static void HandleSendCaptions(WSRequestHandler * req);
+
+	static void HandleGetSharedMemoryTransport(WSRequestHandler* req);
+	static void HandleGetFilterLayout(WSRequestHandler* req);
+	static void HandleSetCompactUpdates(WSRequestHandler* req);
+	static void HandleGetDetectionState(WSRequestHandler* req);
 };
 
 #endif // WSPROTOCOL_H
@@ -1,7 +1,11 @@
 #include <QString>
+#include <util/threading.h>
 
+#include "AudioAnalyzer.h"
+#include "AudioFilter.h"
 #include "Config.h"
 #include "Utils.h"
+#include "VideoFilter.h"
 #include "WSEvents.h"
 
 #include "WSRequestHandler.h"
@@ -23,7 +27,9 @@ void WSRequestHandler::HandleGetVersion(WSRequestHandler* req)
 {
 	QString obsVersion = Utils::OBSVersionString();
 
-	QList<QString> names = req->messageMap.keys();
+	QList<QString> names;
+	for (int i = 0; i < requestHandlerCount; i++)
+		names << requestHandlers[i].name;
 	names.sort(Qt::CaseInsensitive);
 
 	// (Palakis) OBS' data arrays only support object arrays, so I improvised.
@@ -104,6 +110,240 @@ void WSRequestHandler::HandleSetHeartbeat(WSRequestHandler* req)
 	req->SendOKResponse(response);
 }
 
+/**
+ * Run a list of requests in order and return all their responses at once.
+ * Requests take the same fields as when sent on their own, `message-id` is
+ * optional and defaults to the index in the list.
+ *
+ * Batches are not atomic: OBS keeps rendering while they run, so a frame
+ * may show only part of the changes. Requests with `atomic` set are
+ * rejected rather than run without that guarantee.
+ *
+ * @param {Array of Objects} `requests` Requests to execute
+ * @param {boolean (optional)} `halt-on-error` Skip the remaining requests after the first error (default false)
+ *
+ * @return {Array of Objects} `results` One response per executed request
+ * @return {int} `executed` Number of requests executed
+ *
+ * @api requests
+ * @name ExecuteBatch
+ * @category general
+ */
+void WSRequestHandler::HandleExecuteBatch(WSRequestHandler* req)
+{
+	if (!req->hasField("requests"))
+	{
+		req->SendErrorResponse("missing request parameters");
+		return;
+	}
+
+	if (req->_batchResponses)
+	{
+		req->SendErrorResponse("ExecuteBatch can't be nested");
+		return;
+	}
+
+	if (obs_data_get_bool(req->data, "atomic"))
+	{
+		req->SendErrorResponse("atomic batches are not supported");
+		return;
+	}
+
+	bool haltOnError = obs_data_get_bool(req->data, "halt-on-error");
+
+	OBSDataArrayAutoRelease requests = obs_data_get_array(req->data, "requests");
+	OBSDataArrayAutoRelease results = obs_data_array_create();
+	size_t count = obs_data_array_count(requests);
+	size_t executed = 0;
+
+	for (; executed < count; executed++)
+	{
+		WSRequestHandler sub(req->_client);
+		sub._batchResponses = results;
+		sub.data = obs_data_array_item(requests, executed);
+		if (!sub.hasField("message-id"))
+			obs_data_set_string(sub.data, "message-id",
+				QByteArray::number((qulonglong)executed));
+
+		sub.processRequest();
+
+		size_t resultCount = obs_data_array_count(results);
+		if (haltOnError && resultCount > 0)
+		{
+			OBSDataAutoRelease result = obs_data_array_item(results, resultCount - 1);
+			if (strcmp(obs_data_get_string(result, "status"), "ok") != 0)
+			{
+				executed++;
+				break;
+			}
+		}
+	}
+
+	OBSDataAutoRelease response = obs_data_create();
+	obs_data_set_array(response, "results", results);
+	obs_data_set_int(response, "executed", executed);
+	req->SendOKResponse(response);
+}
+
+/**
+ * Some requests run on a worker pool and may complete after requests sent
+ * later, their responses are matched to requests by `message-id`. Enabling
+ * ordered responses holds every response back until all earlier requests of
+ * the client completed.
+ *
+ * @param {boolean} `enable` Deliver responses in request order
+ *
+ * @api requests
+ * @name SetResponseOrdering
+ * @category general
+ */
+void WSRequestHandler::HandleSetResponseOrdering(WSRequestHandler* req)
+{
+	if (!req->hasField("enable"))
+	{
+		req->SendErrorResponse("Ordering <enable> parameter missing");
+		return;
+	}
+
+	WSServer::Instance->set_ordered_responses(req->_client,
+		obs_data_get_bool(req->data, "enable"));
+	req->SendOKResponse();
+}
+
+/**
+ * Replay the updates a client missed, for example while reconnecting.
+ * Every broadcast except VideoUpdate and AudioUpdate carries an increasing
+ * `seq` and the most recent ones are kept by the server. The missed updates
+ * matching the current subscriptions are sent, in order, before the
+ * response. Subscribe again first when reconnecting.
+ *
+ * @param {int} `after` Last `seq` received
+ *
+ * @return {int} `replayed` Number of updates sent
+ * @return {int} `last-seq` Latest `seq` broadcast so far
+ * @return {int} `oldest-seq` Oldest `seq` still kept
+ * @return {boolean} `gap` Some updates after `after` can't be replayed anymore (or the server restarted), resync with GetDetectionState
+ *
+ * @api requests
+ * @name Resume
+ * @category general
+ */
+void WSRequestHandler::HandleResume(WSRequestHandler* req)
+{
+	if (!req->hasField("after"))
+	{
+		req->SendErrorResponse("missing request parameters");
+		return;
+	}
+
+	replay_result result = WSServer::Instance->replay_events(req->_client,
+		(quint64)obs_data_get_int(req->data, "after"));
+
+	OBSDataAutoRelease response = obs_data_create();
+	obs_data_set_int(response, "replayed", result.replayed);
+	obs_data_set_int(response, "last-seq", result.last_seq);
+	obs_data_set_int(response, "oldest-seq", result.oldest_seq);
+	obs_data_set_bool(response, "gap", result.gap);
+	req->SendOKResponse(response);
+}
+
+/**
+ * Receive the updates of one flush cycle (every update produced for a video
+ * frame, or within ~33 ms) as a single message:
+ * `{"update-type": "Batch", "timestamp": T, "updates": [...]}`. When all the
+ * updates come from the same frame, `timestamp` is only set at the top and
+ * removed from the updates. A single update and VideoUpdate frames are sent
+ * as they are.
+ *
+ * @param {boolean} `enable` Starts/Stops batching updates
+ *
+ * @api requests
+ * @name SetBatching
+ * @category general
+ */
+void WSRequestHandler::HandleSetBatching(WSRequestHandler* req)
+{
+	if (!req->hasField("enable"))
+	{
+		req->SendErrorResponse("Batching <enable> parameter missing");
+		return;
+	}
+
+	WSServer::Instance->set_batching(req->_client,
+		obs_data_get_bool(req->data, "enable"));
+	req->SendOKResponse();
+}
+
+static const struct
+{
+	const char* name;
+	broadcast_type type;
+} update_types[] = {
+	{"GroupUpdate", group_state},
+	{"RectangleUpdate", rectangle_state},
+	{"VideoUpdate", video},
+	{"AudioUpdate", audio},
+	{"SpectrumUpdate", spectrum},
+	{"AudioThreshold", threshold_state},
+	{"AudioTone", tone_state},
+	{"AudioOnset", onset},
+	{"AudioBeat", beat},
+	{"SyncOffset", sync_offset},
+};
+
+static int update_type_from_name(const char* name)
+{
+	if (strcmp(name, "*") == 0)
+		return ALL_BROADCAST_TYPES;
+
+	for (const auto& update_type : update_types)
+	{
+		if (strcmp(update_type.name, name) == 0)
+			return update_type.type;
+	}
+	return 0;
+}
+
+static QRegExp subscription_pattern(obs_data_t* item, const char* key)
+{
+	QString pattern = obs_data_get_string(item, key);
+	if (pattern == "*")
+		pattern.clear();
+	return QRegExp(pattern, Qt::CaseSensitive, QRegExp::Wildcard);
+}
+
+// Adds a match-all subscription for types, or removes types from every subscription
+static QList<subscription> toggle_types(QList<subscription> subscriptions,
+	int types, bool enable)
+{
+	QList<subscription> result;
+	for (subscription sub : subscriptions)
+	{
+		sub.types &= ~types;
+		if (sub.types)
+			result.append(sub);
+	}
+
+	if (enable)
+	{
+		subscription all;
+		all.types = types;
+		result.append(all);
+	}
+	return result;
+}
+
+/**
+ * Enable/disable sending of GroupUpdate, RectangleUpdate and VideoUpdate
+ * for every filter. Shorthand for a match-all `Subscribe`.
+ *
+ * @param {boolean} `enable` Starts/Stops sending video updates
+ * @param {boolean (optional)} `snapshot` When enabling, also send a DetectionState update per filter (see GetDetectionState) right after the response (default false)
+ *
+ * @api requests
+ * @name SetVideo
+ * @category general
+ */
 void WSRequestHandler::HandleSetVideo(WSRequestHandler* req)
 {
 	if (!req->hasField("enable"))
@@ -111,15 +351,41 @@ void WSRequestHandler::HandleSetVideo(WSRequestHandler* req)
 		req->SendErrorResponse("Video <enable> parameter missing");
 		return;
 	}
-	WSServer::client_config_map[req->_client].video_broadcast =
-		obs_data_get_bool(req->data, "enable");
+
+	WSServer::Instance->set_subscriptions(req->_client,
+		toggle_types(req->_client->subscriptions, VIDEO_BROADCAST_TYPES,
+			obs_data_get_bool(req->data, "enable")));
+
+	bool enabled = (req->_client->topic_mask & VIDEO_BROADCAST_TYPES) != 0;
 
 	OBSDataAutoRelease response = obs_data_create();
-	obs_data_set_bool(response, "enable",
-	                  WSServer::client_config_map[req->_client].video_broadcast);
+	obs_data_set_bool(response, "enable", enabled);
 	req->SendOKResponse(response);
+
+	if (enabled && obs_data_get_bool(req->data, "snapshot"))
+		WSServer::Instance->push_detection_snapshot(req->_client);
 }
 
+/**
+ * Enable/disable sending of AudioUpdate for every audio filter.
+ * Shorthand for a match-all `Subscribe`. Levels are in dB and are the
+ * highest since the previous AudioUpdate to this client: `magnitude` (RMS
+ * of the loudest channel), `peak` (sample peak), `true_peak` (4x
+ * oversampled, ITU-R BS.1770) and `magnitude` and `peak` per channel in
+ * `channels`. `loudness` holds the latest EBU R128 `momentary`,
+ * `short_term` and `integrated` loudness in LUFS and the loudness `range`
+ * in LU, measured after the source volume (see ResetLoudness).
+ *
+ * @param {boolean} `enable` Starts/Stops sending audio updates
+ * @param {int (optional)} `rate` AudioUpdates per second, 1 to 60 (default 2, kept when omitted)
+ *
+ * @return {boolean} `enable` Whether audio updates are sent
+ * @return {int} `rate` AudioUpdates per second
+ *
+ * @api requests
+ * @name SetAudio
+ * @category general
+ */
 void WSRequestHandler::HandleSetAudio(WSRequestHandler* req)
 {
 	if (!req->hasField("enable"))
@@ -128,15 +394,434 @@ void WSRequestHandler::HandleSetAudio(WSRequestHandler* req)
 		return;
 	}
 
-	WSServer::client_config_map[req->_client].audio_broadcast =
-		obs_data_get_bool(req->data, "enable");
+	if (req->hasField("rate"))
+	{
+		int rate = (int)obs_data_get_int(req->data, "rate");
+		if (rate < 1 || rate > AUDIO_MAX_RATE)
+		{
+			req->SendErrorResponse("Audio <rate> must be between 1 and 60");
+			return;
+		}
+		WSServer::Instance->set_audio_rate(req->_client, rate);
+	}
+
+	WSServer::Instance->set_subscriptions(req->_client,
+		toggle_types(req->_client->subscriptions, audio,
+			obs_data_get_bool(req->data, "enable")));
 
 	OBSDataAutoRelease response = obs_data_create();
 	obs_data_set_bool(response, "enable",
-	                  WSServer::client_config_map[req->_client].audio_broadcast);
+	                  (req->_client->topic_mask & audio) != 0);
+	obs_data_set_int(response, "rate",
+		qRound(1000.0 / req->_client->audio_interval));
+	req->SendOKResponse(response);
+}
+
+/**
+ * List the audio filters with the ids used in compact AudioUpdates (see
+ * SetCompactUpdates), which carry `levels` as `[id, magnitude, peak,
+ * true_peak, [magnitude, peak, ...per channel], [momentary, short_term,
+ * integrated, range]]` arrays in place of `sources`. Muted levels are
+ * `null`.
+ *
+ * The `thresholds` setting of an audio filter is an array of rules with a
+ * `name`, a `level` in dB (default -40), `below` to trigger under the level
+ * instead of over it, a `duration` in ms the level has to stay there, a
+ * `hysteresis` in dB before the state turns off again and the `meter`
+ * compared, `magnitude` (default) or `peak`. Levels are after the source
+ * volume. Every state change is sent as an AudioThreshold event with
+ * `source`, `name`, `state`, `lastState`, `level` and `timestamp`; in
+ * compact form `filter-id` and `id` replace the names.
+ *
+ * The `tones` setting is an array of cue tone detectors with a `name`, the
+ * `frequency` in Hz, a `threshold` in dB relative to a full scale sine
+ * (default -30), the `duration` in ms the tone has to last, a `hysteresis`
+ * in dB (default 3) and a `bandwidth` in Hz (default 50, the level is
+ * measured over blocks of 1 / `bandwidth` seconds). Tones are measured on
+ * the average of the channels before the source volume. State changes are
+ * sent as AudioTone events like AudioThreshold, with the `frequency` too.
+ *
+ * The `onsets` and `beats` settings enable the rhythm analysis, measured
+ * like the spectrum before the source volume. AudioOnset events carry the
+ * `timestamp` of every detected note onset and its `strength`; onsets need
+ * `onsetThreshold` times the recent average spectral flux (default 1.5).
+ * AudioBeat events carry the `timestamp` of every tracked beat, the `bpm`
+ * (searched between `beatMinBpm` and `beatMaxBpm`, default 60 and 200), a
+ * `confidence` from 0 to 1 and the predicted `next` beat, to schedule
+ * graphics ahead. They arrive up to a tenth of a second after the beat,
+ * the timestamps are those of the audio. Both are sent with `source`, or
+ * `filter-id` in compact form.
+ *
+ * @return {Array of Objects} `filters` Audio filters with `id`, `source` and `filter` (filter name)
+ * @return {Array of Objects} `filters.*.thresholds` Threshold rules with `id`, `name`, `state` and `timestamp` (of the last change)
+ * @return {Array of Objects} `filters.*.tones` Tone detectors with `id`, `name`, `frequency`, `state` and `timestamp`
+ *
+ * @api requests
+ * @name GetAudioFilters
+ * @category general
+ */
+void WSRequestHandler::HandleGetAudioFilters(WSRequestHandler* req)
+{
+	OBSDataArrayAutoRelease filters = WSServer::Instance->describe_audio_filters();
+
+	OBSDataAutoRelease response = obs_data_create();
+	obs_data_set_array(response, "filters", filters);
+	req->SendOKResponse(response);
+}
+
+ostws_audiofilter* WSRequestHandler::findAudioFilter(const char* sourceField,
+	const char* filterField, OBSSource* hold)
+{
+	if (!hasField(sourceField) || !hasField(filterField))
+	{
+		SendErrorResponse("missing request parameters");
+		return nullptr;
+	}
+
+	const char* sourceName = obs_data_get_string(data, sourceField);
+	const char* filterName = obs_data_get_string(data, filterField);
+
+	OBSSourceAutoRelease source = obs_get_source_by_name(sourceName);
+	if (!source)
+	{
+		SendErrorResponse("specified source doesn't exist");
+		return nullptr;
+	}
+
+	OBSSourceAutoRelease filter = obs_source_get_filter_by_name(source, filterName);
+	ostws_audiofilter* audio_filter = WSServer::Instance->find_audio_filter(filter);
+	if (!audio_filter)
+	{
+		SendErrorResponse("specified filter doesn't exist or is not an OstWS audio filter");
+		return nullptr;
+	}
+	if (hold)
+		*hold = filter;
+	return audio_filter;
+}
+
+/**
+ * Start a new loudness measurement on an audio filter: the integrated
+ * loudness and the loudness range forget everything measured so far.
+ * Measurements also restart when the sample rate or channel count changes.
+ *
+ * @param {String} `sourceName` Source the audio filter is applied to
+ * @param {String} `filterName` Name of the audio filter
+ *
+ * @api requests
+ * @name ResetLoudness
+ * @category general
+ */
+void WSRequestHandler::HandleResetLoudness(WSRequestHandler* req)
+{
+	OBSSource hold;
+	ostws_audiofilter* audio_filter = req->findAudioFilter("sourceName",
+		"filterName", &hold);
+	if (!audio_filter)
+		return;
+
+	os_atomic_set_bool(&audio_filter->loudness_reset, true);
+	req->SendOKResponse();
+}
+
+/**
+ * Start measuring the sync offset of a target against a reference audio
+ * filter, continuously, instead of clap tests. The target is another audio
+ * filter, or a rectangle of a video filter that detects a flash (its
+ * rising edges count). Both sides are reduced to onset envelopes in 5 ms
+ * slots of OBS timestamps, cross-correlated once per second over the last
+ * `window` seconds on the analysis thread. Every result is sent to the
+ * client that started the measurement, if it subscribed to SyncOffset
+ * updates, with the `measurement-id`, the `offset` in ms the
+ * target is late (negative when early), a `confidence` from 0 to 1 (the
+ * normalized correlation, trust values above 0.5 or so) and the
+ * `timestamp` of the end of the window. Windows without onsets on either
+ * side send nothing. Measurements run until stopped, the client that
+ * started them disconnects or a filter is removed.
+ *
+ * @param {String} `sourceName` Source the reference audio filter is applied to
+ * @param {String} `filterName` Name of the reference audio filter
+ * @param {String} `targetSourceName` Source the target filter is applied to
+ * @param {String} `targetFilterName` Name of the target filter, an audio filter or a video filter with `targetGroup` and `targetRectangle`
+ * @param {String (optional)} `targetGroup` Group of the target rectangle
+ * @param {String (optional)} `targetRectangle` Name of the target rectangle
+ * @param {double (optional)} `window` Seconds correlated (default 10, 2 to 15)
+ * @param {int (optional)} `maxOffset` Largest offset searched either way in ms (default 500, up to 2000)
+ *
+ * @return {int} `measurement-id` Id of the measurement
+ *
+ * @api requests
+ * @name StartSyncMeasurement
+ * @category general
+ */
+void WSRequestHandler::HandleStartSyncMeasurement(WSRequestHandler* req)
+{
+	// Keep the filters from being destroyed until the measurement is
+	// registered, from then on their destruction ends it
+	OBSSource referenceSource;
+	OBSSource targetSource;
+	ostws_audiofilter* reference = req->findAudioFilter("sourceName",
+		"filterName", &referenceSource);
+	if (!reference)
+		return;
+
+	double window = 10.0;
+	if (req->hasField("window"))
+		window = obs_data_get_double(req->data, "window");
+	int maxOffset = 500;
+	if (req->hasField("maxOffset"))
+		maxOffset = (int)obs_data_get_int(req->data, "maxOffset");
+	if (window < 2.0 || window > SYNC_MAX_WINDOW
+		|| maxOffset < 5 || maxOffset > SYNC_MAX_OFFSET)
+	{
+		req->SendErrorResponse("invalid window or maxOffset");
+		return;
+	}
+
+	ostws_audiofilter* target = nullptr;
+	ostws_filter* video_filter = nullptr;
+	uint32_t rectangle_id = 0;
+	if (req->hasField("targetGroup") || req->hasField("targetRectangle"))
+	{
+		video_filter = req->findVideoFilter("targetSourceName",
+			"targetFilterName", &targetSource);
+		if (!video_filter)
+			return;
+
+		QByteArray groupName = obs_data_get_string(req->data, "targetGroup");
+		QByteArray rectangleName = obs_data_get_string(req->data, "targetRectangle");
+		pthread_mutex_lock(&video_filter->ostws_sender_video_mutex);
+		for (const video_group& group : *video_filter->groups)
+		{
+			if (group.name != groupName)
+				continue;
+			for (const video_rectangle& rectangle : *group.rectangles)
+			{
+				if (rectangle.name == rectangleName)
+					rectangle_id = rectangle.id;
+			}
+		}
+		pthread_mutex_unlock(&video_filter->ostws_sender_video_mutex);
+
+		if (!rectangle_id)
+		{
+			req->SendErrorResponse("specified rectangle doesn't exist");
+			return;
+		}
+	}
+	else
+	{
+		target = req->findAudioFilter("targetSourceName", "targetFilterName",
+			&targetSource);
+		if (!target)
+			return;
+		if (target == reference)
+		{
+			req->SendErrorResponse("reference and target are the same filter");
+			return;
+		}
+	}
+
+	int id = AudioAnalyzer::Instance->start_sync(req->_clientId, reference,
+		target, video_filter, rectangle_id, window, maxOffset);
+
+	OBSDataAutoRelease response = obs_data_create();
+	obs_data_set_int(response, "measurement-id", id);
 	req->SendOKResponse(response);
 }
 
+/**
+ * Stop a measurement started by StartSyncMeasurement, from the same client.
+ *
+ * @param {int} `measurement-id` Id of the measurement
+ *
+ * @api requests
+ * @name StopSyncMeasurement
+ * @category general
+ */
+void WSRequestHandler::HandleStopSyncMeasurement(WSRequestHandler* req)
+{
+	if (!req->hasField("measurement-id"))
+	{
+		req->SendErrorResponse("missing request parameters");
+		return;
+	}
+
+	sync_stop_result result = AudioAnalyzer::Instance->stop_sync(
+		(int)obs_data_get_int(req->data, "measurement-id"), req->_clientId);
+	if (result == sync_not_found)
+	{
+		req->SendErrorResponse("specified measurement doesn't exist");
+		return;
+	}
+	if (result == sync_not_owner)
+	{
+		req->SendErrorResponse("specified measurement was started by another client");
+		return;
+	}
+	req->SendOKResponse();
+}
+
+/**
+ * Subscribe to a selection of updates. Source, group and rectangle names are
+ * wildcard patterns (`*` and `?`), omitted patterns match everything.
+ * AudioUpdate only carries the sources matching `source`. SpectrumUpdate is
+ * sent by audio filters with the `spectrum` setting enabled: `bands` holds
+ * the level of every band in dB (before the source volume, -120 for
+ * silence), log-spaced from `spectrumMinFrequency` to `spectrumMaxFrequency`,
+ * `spectrumRate` times per second. AudioThreshold is sent within a few
+ * milliseconds of one of the `thresholds` rules of an audio filter changing
+ * state and AudioTone when one of its `tones` detectors does (see
+ * GetAudioFilters), `name` matches the rule or detector name. AudioOnset
+ * and AudioBeat are sent by audio filters with the `onsets` and `beats`
+ * settings enabled, see GetAudioFilters. SyncOffset is sent by the
+ * measurements of StartSyncMeasurement to the client that started them,
+ * `source` matches their reference.
+ *
+ * @param {Array of Objects} `subscriptions`
+ * @param {String} `subscriptions.*.update-type` `GroupUpdate`, `RectangleUpdate`, `VideoUpdate`, `AudioUpdate`, `SpectrumUpdate`, `AudioThreshold`, `AudioTone`, `AudioOnset`, `AudioBeat`, `SyncOffset` or `*`
+ * @param {String (optional)} `subscriptions.*.source` Source the filter is applied to
+ * @param {String (optional)} `subscriptions.*.group` Group name
+ * @param {String (optional)} `subscriptions.*.name` Rectangle name (or group name for GroupUpdate)
+ * @param {boolean (optional)} `replace` Replace the current subscriptions instead of adding to them (default true)
+ *
+ * @api requests
+ * @name Subscribe
+ * @category general
+ */
+void WSRequestHandler::HandleSubscribe(WSRequestHandler* req)
+{
+	if (!req->hasField("subscriptions"))
+	{
+		req->SendErrorResponse("missing request parameters");
+		return;
+	}
+
+	QList<subscription> subscriptions;
+	if (req->hasField("replace") && !obs_data_get_bool(req->data, "replace"))
+		subscriptions = req->_client->subscriptions;
+
+	OBSDataArrayAutoRelease items = obs_data_get_array(req->data, "subscriptions");
+	for (size_t i = 0; i < obs_data_array_count(items); i++)
+	{
+		OBSDataAutoRelease item = obs_data_array_item(items, i);
+
+		subscription sub;
+		sub.types = update_type_from_name(obs_data_get_string(item, "update-type"));
+		if (!sub.types)
+		{
+			req->SendErrorResponse("invalid update-type");
+			return;
+		}
+
+		sub.source = subscription_pattern(item, "source");
+		sub.group = subscription_pattern(item, "group");
+		sub.name = subscription_pattern(item, "name");
+		subscriptions.append(sub);
+	}
+
+	WSServer::Instance->set_subscriptions(req->_client, subscriptions);
+	HandleGetSubscriptions(req);
+}
+
+/**
+ * List the update subscriptions of this client.
+ *
+ * @return {Array of Objects} `subscriptions` Same format as `Subscribe`, one entry per update type
+ *
+ * @api requests
+ * @name GetSubscriptions
+ * @category general
+ */
+void WSRequestHandler::HandleGetSubscriptions(WSRequestHandler* req)
+{
+	OBSDataArrayAutoRelease items = obs_data_array_create();
+	for (const subscription& sub : req->_client->subscriptions)
+	{
+		for (const auto& update_type : update_types)
+		{
+			if (!(sub.types & update_type.type))
+				continue;
+
+			OBSDataAutoRelease item = obs_data_create();
+			obs_data_set_string(item, "update-type", update_type.name);
+			obs_data_set_string(item, "source", sub.source.pattern().toUtf8());
+			obs_data_set_string(item, "group", sub.group.pattern().toUtf8());
+			obs_data_set_string(item, "name", sub.name.pattern().toUtf8());
+			obs_data_array_push_back(items, item);
+		}
+	}
+
+	OBSDataAutoRelease response = obs_data_create();
+	obs_data_set_array(response, "subscriptions", items);
+	req->SendOKResponse(response);
+}
+
+/**
+ * Enable/disable deflate compression of everything the server sends to this
+ * client. This is application-level framing, not the RFC 7692 extension
+ * negotiated on the WebSocket: the response to this request is still sent
+ * uncompressed, every following message arrives as a plain binary frame
+ * (RSV1 unset) holding a raw deflate payload without the trailing
+ * `0x00 0x00 0xff 0xff`, which the client appends before inflating. The
+ * payloads are those of RFC 7692, so a permessage-deflate inflater works on
+ * them. Omitted `level` and `window-bits` come from the `CompressionLevel`
+ * and `CompressionWindowBits` keys of the OstWS section of the OBS global
+ * config (default 3 and 15). If zlib can't set up the compressor the
+ * response has `enable` false and messages stay uncompressed.
+ *
+ * @param {boolean} `enable` Starts/Stops compressing messages
+ * @param {int (optional)} `level` zlib compression level (0-9)
+ * @param {int (optional)} `window-bits` LZ77 window size (9-15)
+ * @param {boolean (optional)} `context-takeover` Keep the compression context between messages (default true)
+ *
+ * @api requests
+ * @name SetCompression
+ * @category general
+ */
+void WSRequestHandler::HandleSetCompression(WSRequestHandler* req)
+{
+	if (!req->hasField("enable"))
+	{
+		req->SendErrorResponse("Compression <enable> parameter missing");
+		return;
+	}
+
+	QSharedPointer<MessageDeflater> deflater;
+	if (obs_data_get_bool(req->data, "enable"))
+	{
+		int level = req->hasField("level")
+			? (int)obs_data_get_int(req->data, "level")
+			: Config::Current()->CompressionLevel;
+		int windowBits = req->hasField("window-bits")
+			? (int)obs_data_get_int(req->data, "window-bits")
+			: Config::Current()->CompressionWindowBits;
+		bool contextTakeover = !req->hasField("context-takeover")
+			|| obs_data_get_bool(req->data, "context-takeover");
+
+		deflater.reset(new MessageDeflater(level, windowBits, contextTakeover));
+		if (!deflater->isValid())
+		{
+			blog(LOG_WARNING, "deflate setup failed (level %d, window bits %d), "
+				"sending uncompressed", level, windowBits);
+			deflater.reset();
+		}
+	}
+
+	OBSDataAutoRelease response = obs_data_create();
+	obs_data_set_bool(response, "enable", !deflater.isNull());
+	if (deflater)
+	{
+		obs_data_set_int(response, "level", deflater->level());
+		obs_data_set_int(response, "window-bits", deflater->windowBits());
+		obs_data_set_bool(response, "context-takeover",
+		                  deflater->contextTakeover());
+	}
+	req->SendOKResponse(response);
+
+	WSServer::Instance->set_compression(req->_client, deflater);
+}
+
 /**
  * Send the provided text as embedded CEA-608 caption data
  *
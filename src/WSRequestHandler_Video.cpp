@@ -0,0 +1,252 @@
+#include <QString>
+
+#include "VideoFilter.h"
+#include "WSServer.h"
+
+#include "WSRequestHandler.h"
+
+// Payload room for state events when no rectangle is larger
+#define SHM_MIN_PAYLOAD_SIZE 4096
+#define SHM_DEFAULT_SLOTS 16
+#define SHM_MAX_SLOTS 1024
+
+ostws_filter* WSRequestHandler::findVideoFilter(const char* sourceField,
+	const char* filterField, OBSSource* hold)
+{
+	if (!hasField(sourceField) || !hasField(filterField))
+	{
+		SendErrorResponse("missing request parameters");
+		return nullptr;
+	}
+
+	const char* sourceName = obs_data_get_string(data, sourceField);
+	const char* filterName = obs_data_get_string(data, filterField);
+
+	OBSSourceAutoRelease source = obs_get_source_by_name(sourceName);
+	if (!source)
+	{
+		SendErrorResponse("specified source doesn't exist");
+		return nullptr;
+	}
+
+	OBSSourceAutoRelease filter = obs_source_get_filter_by_name(source, filterName);
+	ostws_filter* video_filter = WSServer::Instance->find_video_filter(filter);
+	if (!video_filter)
+	{
+		SendErrorResponse("specified filter doesn't exist or is not an OstWS video filter");
+		return nullptr;
+	}
+	if (hold)
+		*hold = filter;
+	return video_filter;
+}
+
+/**
+ * Open (or close) a shared memory ring the video filter publishes rectangle
+ * crops (raw BGRA rows) and state events into, for consumers on the same
+ * machine. See SharedMemoryRing.h for the layout. Crops larger than
+ * `payload-size` are skipped, request the transport again after growing a
+ * rectangle. Calling it again replaces the previous ring.
+ *
+ * @param {String} `sourceName` Source the video filter is applied to
+ * @param {String} `filterName` Name of the video filter
+ * @param {boolean (optional)} `enable` Open or close the ring (default true)
+ * @param {int (optional)} `slots` Number of slots in the ring (default 16)
+ *
+ * @return {String} `name` Name to pass to shm_open
+ * @return {int} `size` Size of the shared memory object in bytes
+ * @return {int} `header-size` Offset of the first slot
+ * @return {int} `slot-count` Number of slots
+ * @return {int} `slot-size` Distance between two slots
+ * @return {int} `slot-header-size` Offset of the payload inside a slot
+ * @return {int} `payload-size` Largest payload a slot can hold
+ *
+ * @api requests
+ * @name GetSharedMemoryTransport
+ * @category video
+ */
+void WSRequestHandler::HandleGetSharedMemoryTransport(WSRequestHandler* req)
+{
+	OBSSource hold;
+	ostws_filter* video_filter = req->findVideoFilter("sourceName",
+		"filterName", &hold);
+	if (!video_filter)
+		return;
+
+	bool enable = !req->hasField("enable")
+		|| obs_data_get_bool(req->data, "enable");
+
+	uint32_t slots = SHM_DEFAULT_SLOTS;
+	if (req->hasField("slots"))
+		slots = (uint32_t)obs_data_get_int(req->data, "slots");
+	if (slots < 2 || slots > SHM_MAX_SLOTS)
+	{
+		req->SendErrorResponse("invalid slot count");
+		return;
+	}
+
+	SharedMemoryRing* ring = nullptr;
+	pthread_mutex_lock(&video_filter->ostws_sender_video_mutex);
+	SharedMemoryRing* previous = video_filter->shm_ring;
+	if (enable)
+	{
+		uint32_t payloadSize = SHM_MIN_PAYLOAD_SIZE;
+		for (const video_group& group : *video_filter->groups)
+		{
+			for (const video_rectangle& rectangle : *group.rectangles)
+				payloadSize = qMax(payloadSize, rectangle.width * rectangle.height * 4);
+		}
+
+		ring = new SharedMemoryRing();
+		if (!ring->open(slots, payloadSize))
+		{
+			delete ring;
+			ring = nullptr;
+		}
+	}
+	if (enable && !ring)
+	{
+		pthread_mutex_unlock(&video_filter->ostws_sender_video_mutex);
+		req->SendErrorResponse("shared memory transport not available");
+		return;
+	}
+	video_filter->shm_ring = ring;
+	pthread_mutex_unlock(&video_filter->ostws_sender_video_mutex);
+	delete previous;
+
+	OBSDataAutoRelease response = obs_data_create();
+	obs_data_set_bool(response, "enable", ring != nullptr);
+	if (ring)
+	{
+		obs_data_set_string(response, "name", ring->name().toUtf8());
+		obs_data_set_int(response, "size", ring->size());
+		obs_data_set_int(response, "header-size", ring->headerSize());
+		obs_data_set_int(response, "slot-count", ring->slotCount());
+		obs_data_set_int(response, "slot-size", ring->slotSize());
+		obs_data_set_int(response, "slot-header-size", sizeof(shm_slot_header));
+		obs_data_set_int(response, "payload-size", ring->payloadSize());
+	}
+	req->SendOKResponse(response);
+}
+
+/**
+ * Get the groups and rectangles of a video filter with their numeric ids.
+ * Ids are unique within the filter and stay the same when the settings
+ * change, as long as the group (or the rectangle within its group) keeps
+ * its name. A `FilterLayoutChanged` update with the filter id and the new
+ * `layout-version` is broadcast whenever the settings are applied.
+ *
+ * @param {String} `sourceName` Source the video filter is applied to
+ * @param {String} `filterName` Name of the video filter
+ *
+ * @return {int} `filter-id` Id of the filter in compact updates
+ * @return {int} `layout-version` Increases with every settings update
+ * @return {Array of Objects} `groups` Groups of the filter
+ * @return {int} `groups.*.id` Group id
+ * @return {String} `groups.*.name` Group name
+ * @return {boolean} `groups.*.individual` Whether rectangles send their own updates
+ * @return {Array of Objects} `groups.*.rectangles` Rectangles of the group, with `id`, `name`, `x`, `y`, `width` and `height`
+ *
+ * @api requests
+ * @name GetFilterLayout
+ * @category video
+ */
+void WSRequestHandler::HandleGetFilterLayout(WSRequestHandler* req)
+{
+	OBSSource hold;
+	ostws_filter* video_filter = req->findVideoFilter("sourceName",
+		"filterName", &hold);
+	if (!video_filter)
+		return;
+
+	OBSDataArrayAutoRelease groups = obs_data_array_create();
+
+	pthread_mutex_lock(&video_filter->ostws_sender_video_mutex);
+	for (const video_group& group : *video_filter->groups)
+	{
+		OBSDataArrayAutoRelease rectangles = obs_data_array_create();
+		for (const video_rectangle& rectangle : *group.rectangles)
+		{
+			OBSDataAutoRelease item = obs_data_create();
+			obs_data_set_int(item, "id", rectangle.id);
+			obs_data_set_string(item, "name", rectangle.name.constData());
+			obs_data_set_int(item, "x", rectangle.x);
+			obs_data_set_int(item, "y", rectangle.y);
+			obs_data_set_int(item, "width", rectangle.width);
+			obs_data_set_int(item, "height", rectangle.height);
+			obs_data_array_push_back(rectangles, item);
+		}
+
+		OBSDataAutoRelease item = obs_data_create();
+		obs_data_set_int(item, "id", group.id);
+		obs_data_set_string(item, "name", group.name.constData());
+		obs_data_set_bool(item, "individual", group.individual);
+		obs_data_set_array(item, "rectangles", rectangles);
+		obs_data_array_push_back(groups, item);
+	}
+	uint32_t layoutVersion = video_filter->layout_version;
+	pthread_mutex_unlock(&video_filter->ostws_sender_video_mutex);
+
+	OBSDataAutoRelease response = obs_data_create();
+	obs_data_set_int(response, "filter-id", video_filter->id);
+	obs_data_set_int(response, "layout-version", layoutVersion);
+	obs_data_set_array(response, "groups", groups);
+	req->SendOKResponse(response);
+}
+
+/**
+ * Receive RectangleUpdate, GroupUpdate and VideoUpdate with `filter-id` and
+ * `id` (see GetFilterLayout) in place of the `name` and `group` strings,
+ * and AudioUpdate with audio filter ids (see GetAudioFilters).
+ * Subscriptions still match on names.
+ *
+ * @param {boolean} `enable` Starts/Stops sending compact updates
+ *
+ * @api requests
+ * @name SetCompactUpdates
+ * @category video
+ */
+void WSRequestHandler::HandleSetCompactUpdates(WSRequestHandler* req)
+{
+	if (!req->hasField("enable"))
+	{
+		req->SendErrorResponse("Compact updates <enable> parameter missing");
+		return;
+	}
+
+	WSServer::Instance->set_compact_updates(req->_client,
+		obs_data_get_bool(req->data, "enable"));
+	req->SendOKResponse();
+}
+
+/**
+ * Get the current state of every group and rectangle of a video filter,
+ * without waiting for the next transition. States are tracked for all
+ * rectangles, also those in groups that don't send individual updates.
+ *
+ * @param {String} `sourceName` Source the video filter is applied to
+ * @param {String} `filterName` Name of the video filter
+ *
+ * @return {String} `source` Source name
+ * @return {String} `filter` Filter name
+ * @return {int} `filter-id` Id of the filter in compact updates
+ * @return {int} `layout-version` See GetFilterLayout
+ * @return {int} `timestamp` Timestamp of the last analyzed frame, 0 if none was analyzed yet
+ * @return {Array of Objects} `groups` Groups with `id`, `name`, `individual`, `state`, `timestamp` (of the last change) and `rectangles`
+ * @return {Array of Objects} `groups.*.rectangles` Rectangles with `id`, `name`, `state` and `timestamp` (of the last change)
+ *
+ * @api requests
+ * @name GetDetectionState
+ * @category video
+ */
+void WSRequestHandler::HandleGetDetectionState(WSRequestHandler* req)
+{
+	OBSSource hold;
+	ostws_filter* video_filter = req->findVideoFilter("sourceName",
+		"filterName", &hold);
+	if (!video_filter)
+		return;
+
+	OBSDataAutoRelease state = ostws_filter_detection_state(video_filter);
+	req->SendOKResponse(state);
+}
@@ -16,9 +16,16 @@ You should have received a copy of the GNU General Public License along
 with this program. If not, see <https://www.gnu.org/licenses/>
 */
 
+#include <math.h>
+
 #include <QtWebSockets/QWebSocket>
+#include <QtNetwork/QLocalServer>
+#include <QtNetwork/QLocalSocket>
+#include <QtCore/QtEndian>
 #include <QtCore/QThread>
+#include <QtCore/QThreadPool>
 #include <QtCore/QByteArray>
+#include <QtCore/QUrlQuery>
 #include <QMainWindow>
 #include <QMessageBox>
 #include <QTimer>
@@ -28,21 +35,47 @@ with this program. If not, see <https://www.gnu.org/licenses/>
 #include "obs-ostws.h"
 #include "Config.h"
 #include "Utils.h"
+#include "AudioAnalyzer.h"
 #include "AudioFilter.h"
+#include "VideoFilter.h"
+#include "Cbor.h"
+#include "JsonWriter.h"
+
+// Bulk messages (pixel dumps) are only handed to a socket while less than
+// this many bytes are still waiting in its write buffer, so control and state
+// messages never queue behind more than one bulk message.
+#define BULK_LANE_WATERMARK (64 * 1024)
+// Older bulk messages are dropped once a slow client has this many pending
+#define BULK_LANE_MAX_QUEUED 32
+// Local clients sending larger frames are disconnected
+#define LOCAL_FRAME_MAX_SIZE (64 * 1024 * 1024)
+// Control broadcasts kept for Resume
+#define EVENT_LOG_SIZE 4096
 
 QT_USE_NAMESPACE
 WSServer* WSServer::Instance = nullptr;
-QHash<QWebSocket*, client_config> WSServer::client_config_map{};
 
 WSServer::WSServer(QObject* parent)
 	: QObject(parent),
 	  _wsServer(Q_NULLPTR),
+	  _localServer(Q_NULLPTR),
+	  _cycleTimersStarted(false),
 	  _clients(),
-	  _clMutex(QMutex::Recursive)
+	  _nextClientId(1),
+	  _lastSeq(0),
+	  _clMutex(QMutex::Recursive),
+	  _flushPending(0),
+	  _flushing(false),
+	  _compactClients(0),
+	  _cborClients(0),
+	  _requestPool(Q_NULLPTR),
+	  _audioTimer(Q_NULLPTR)
 {
 	_wsServer = new QWebSocketServer(
 		QStringLiteral("obs-ostws"),
 		QWebSocketServer::NonSecureMode);
+	_localServer = new QLocalServer(this);
+	_requestPool = new QThreadPool(this);
 }
 
 WSServer::~WSServer()
@@ -66,13 +99,7 @@ void WSServer::Start(quint16 port)
 		connect(_wsServer, SIGNAL(newConnection()),
 		        this, SLOT(onNewConnection()));
 
-		QTimer* cycleTimer = new QTimer();
-		connect(cycleTimer, SIGNAL(timeout()), this, SLOT(onCycle()));
-		cycleTimer->start(33);
-
-		QTimer* audioBroadcastCycleTimer = new QTimer();
-		connect(audioBroadcastCycleTimer, SIGNAL(timeout()), this, SLOT(onAudioBroadcastCycle()));
-		audioBroadcastCycleTimer->start(500);
+		startCycleTimers();
 	}
 	else
 	{
@@ -92,61 +119,646 @@ void WSServer::Start(quint16 port)
 	}
 }
 
+/**
+ * Listen on a local socket (a Unix domain socket, or a named pipe on
+ * Windows) speaking the same requests and updates as the WebSocket server,
+ * in length-prefixed frames. Only the user running OBS can connect.
+ * Started at load when `LocalSocketEnabled` is set in the OstWS section of
+ * the OBS global config, on `LocalSocketName` (default "obs-ostws").
+ */
+void WSServer::StartLocal(QString name)
+{
+	if (_localServer->isListening())
+		_localServer->close();
+
+	_localServer->setSocketOptions(QLocalServer::UserAccessOption);
+	QLocalServer::removeServer(name);
+
+	if (_localServer->listen(name))
+	{
+		blog(LOG_INFO, "server started successfully on local socket %s",
+			_localServer->fullServerName().toUtf8().constData());
+
+		connect(_localServer, SIGNAL(newConnection()),
+		        this, SLOT(onNewLocalConnection()), Qt::UniqueConnection);
+
+		startCycleTimers();
+	}
+	else
+	{
+		blog(LOG_ERROR,
+			"error: failed to start server on local socket %s: %s",
+			name.toUtf8().constData(),
+			_localServer->errorString().toUtf8().constData());
+	}
+}
+
+void WSServer::startCycleTimers()
+{
+	if (_cycleTimersStarted)
+		return;
+	_cycleTimersStarted = true;
+
+	QTimer* cycleTimer = new QTimer();
+	connect(cycleTimer, SIGNAL(timeout()), this, SLOT(onCycle()));
+	cycleTimer->start(33);
+
+	_audioClock.start();
+	_audioTimer = new QTimer();
+	_audioTimer->setTimerType(Qt::PreciseTimer);
+	connect(_audioTimer, SIGNAL(timeout()), this, SLOT(onAudioBroadcastCycle()));
+	_audioTimer->start(1000 / AUDIO_DEFAULT_RATE);
+}
+
 void WSServer::Stop()
 {
 	QMutexLocker locker(&_clMutex);
-	for (QWebSocket* pClient : _clients)
+	for (client_config* client : _clients)
 	{
-		pClient->close();
+		if (client->socket)
+			client->socket->close();
+		else
+			client->local_socket->disconnectFromServer();
 	}
 	locker.unlock();
 
 	_wsServer->close();
+	_localServer->close();
+	_requestPool->waitForDone();
 
 	blog(LOG_INFO, "server stopped successfully");
 }
 
 void WSServer::onCycle()
 {
+	_flushPending = 0;
+
 	QMutexLocker locker(&_broadcastMutex);
+	QMutexLocker clientLocker(&_clMutex);
+	_flushing = true;
 	while (!_broadcastQueue.isEmpty())
 		broadcast(_broadcastQueue.dequeue());
+	_flushing = false;
+
+	sendBatches();
 }
 
-void WSServer::broadcast(QString message)
+void WSServer::set_batching(client_config* client, bool enable)
+{
+	QMutexLocker locker(&_clMutex);
+	client->batch_updates = enable;
+}
+
+void WSServer::sendBatches()
 {
 	QMutexLocker locker(&_clMutex);
-	for (QWebSocket* pClient : _clients)
+	for (client_config* client : _clients)
+	{
+		if (client->batch.isEmpty())
+			continue;
+
+		if (client->batch.count() == 1)
+			send(client, client->batch.first());
+		else
+			send(client, buildBatch(client));
+		client->batch.clear();
+	}
+}
+
+/**
+ * {"update-type":"Batch","timestamp":T,"updates":[...]} with the updates in
+ * broadcast order. When they all come from the same video frame its
+ * timestamp is only given once, at the top.
+ */
+broadcast_message WSServer::buildBatch(client_config* client)
+{
+	quint64 timestamp = client->batch.first().timestamp;
+	for (const broadcast_message& message : client->batch)
+	{
+		if (message.timestamp != timestamp)
+			timestamp = 0;
+	}
+	QByteArray timestampMember = ",\"timestamp\":" + QByteArray::number(timestamp);
+
+	bool cbor = client->encoding == encoding_cbor;
+	JsonWriter& writer = JsonWriter::Begin("Batch", cbor);
+	if (timestamp)
+		writer.writeInt("timestamp", (long long)timestamp);
+	writer.beginArray("updates");
+	for (const broadcast_message& message : client->batch)
+	{
+		bool compact = client->compact_updates && message.compact_encoded;
+		broadcast_message form = message;
+		if (compact)
+		{
+			form.message = message.compact;
+			form.encoded = message.compact_encoded;
+		}
+		QByteArray json = encodedPayload(form, encoding_json);
+		QByteArray binary = cbor ? encodedPayload(form, encoding_cbor)
+			: QByteArray();
+
+		int member = timestamp ? json.indexOf(timestampMember) : -1;
+		if (member >= 0)
+		{
+			json.remove(member, timestampMember.size());
+			if (cbor)
+				Cbor::RemoveMember(binary, "timestamp");
+		}
+		writer.writeRaw(nullptr, json.constData(), json.size(),
+			binary.constData(), binary.size());
+	}
+	writer.endArray();
+
+	return json_message(writer, global, control);
+}
+
+broadcast_message json_message(const QByteArray& json, broadcast_type type,
+	broadcast_priority priority, const QString& source,
+	const QString& group, const QString& name)
+{
+	broadcast_message message = {
+		QString::fromUtf8(json),
+		type,
+		priority,
+		OBSData(),
+		source,
+		group,
+		name
+	};
+	message.encoded.reset(new encoded_payloads());
+	message.encoded->utf8 = json;
+	return message;
+}
+
+void set_compact_form(broadcast_message& message, const QByteArray& json)
+{
+	message.compact = QString::fromUtf8(json);
+	message.compact_encoded.reset(new encoded_payloads());
+	message.compact_encoded->utf8 = json;
+}
+
+broadcast_message json_message(JsonWriter& writer, broadcast_type type,
+	broadcast_priority priority, const QString& source,
+	const QString& group, const QString& name)
+{
+	broadcast_message message = json_message(writer.end(), type, priority,
+		source, group, name);
+	message.encoded->cbor = writer.cbor();
+	return message;
+}
+
+void set_compact_form(broadcast_message& message, JsonWriter& writer)
+{
+	set_compact_form(message, writer.end());
+	message.compact_encoded->cbor = writer.cbor();
+}
+
+void WSServer::broadcast(QString message)
+{
+	broadcast({message, global});
+}
+
+// Appends "seq" as the last member, where obs_data_set_int would put it
+static void append_sequence(QString& json, QSharedPointer<encoded_payloads>& encoded,
+	quint64 seq)
+{
+	if (!json.endsWith('}'))
+		return;
+
+	QString member = QString(json.length() > 2 ? ",\"seq\":%1}" : "\"seq\":%1}")
+		.arg(seq);
+	json.chop(1);
+	json += member;
+
+	QSharedPointer<encoded_payloads> stamped(new encoded_payloads());
+	if (encoded && !encoded->utf8.isEmpty())
+	{
+		stamped->utf8 = encoded->utf8;
+		stamped->utf8.chop(1);
+		stamped->utf8 += member.toUtf8();
+	}
+	if (encoded && !encoded->cbor.isEmpty())
 	{
-		pClient->sendTextMessage(message);
+		stamped->cbor = encoded->cbor;
+		if (!Cbor::AppendMember(stamped->cbor, "seq", (long long)seq))
+			stamped->cbor.clear();
 	}
+	encoded = stamped;
 }
 
 void WSServer::broadcast(broadcast_message message)
 {
+	if (!message.encoded)
+		message.encoded.reset(new encoded_payloads());
+
 	QMutexLocker locker(&_clMutex);
-	for (QWebSocket* pClient : _clients)
+	if (message.priority == control)
+	{
+		message.seq = ++_lastSeq;
+		append_sequence(message.message, message.encoded, message.seq);
+		if (message.compact_encoded)
+			append_sequence(message.compact, message.compact_encoded,
+				message.seq);
+		if (message.data)
+			obs_data_set_int(message.data, "seq", message.seq);
+
+		_eventLog.enqueue(message);
+		while (_eventLog.count() > EVENT_LOG_SIZE)
+			_eventLog.dequeue();
+	}
+
+	const QList<client_config*>& clients =
+		message.type == global ? _clients : _subscribers[message.type];
+	for (client_config* client : clients)
 	{
-		if (message.type == global ||
-			(message.type == video && client_config_map[pClient].video_broadcast) ||
-			(message.type == audio && client_config_map[pClient].audio_broadcast)
-		)
+		if (message.recipient && client->id != message.recipient)
+			continue;
+		if (accepts(client, message.type,
+			message.source, message.group, message.name))
 		{
-			pClient->sendTextMessage(message.message);
+			if (_flushing && client->batch_updates
+				&& message.priority == control)
+				client->batch << message;
+			else
+				send(client, message);
 		}
 	}
 }
 
+static bool pattern_matches(const QRegExp& pattern, const QString& value)
+{
+	return pattern.isEmpty() || pattern.exactMatch(value);
+}
+
+bool WSServer::accepts(const client_config* client, broadcast_type type,
+	const QString& source, const QString& group, const QString& name)
+{
+	if (type == global || (client->unfiltered_mask & type))
+		return true;
+	if (!(client->topic_mask & type))
+		return false;
+
+	for (const subscription& sub : client->subscriptions)
+	{
+		if ((sub.types & type)
+			&& pattern_matches(sub.source, source)
+			&& pattern_matches(sub.group, group)
+			&& pattern_matches(sub.name, name))
+			return true;
+	}
+	return false;
+}
+
+void WSServer::set_subscriptions(client_config* client,
+	QList<subscription> subscriptions)
+{
+	QMutexLocker locker(&_clMutex);
+	client->subscriptions = subscriptions;
+	client->topic_mask = 0;
+	client->unfiltered_mask = 0;
+	for (const subscription& sub : subscriptions)
+	{
+		client->topic_mask |= sub.types;
+		if (sub.source.isEmpty() && sub.group.isEmpty() && sub.name.isEmpty())
+			client->unfiltered_mask |= sub.types;
+	}
+
+	for (int type = 1; type & ALL_BROADCAST_TYPES; type <<= 1)
+	{
+		QList<client_config*>& subscribers = _subscribers[type];
+		subscribers.removeAll(client);
+		if (client->topic_mask & type)
+			subscribers.append(client);
+	}
+}
+
 void WSServer::broadcast_thread_safe(QString message)
 {
-	QMutexLocker locker(&_broadcastMutex);
-	_broadcastQueue.enqueue({message, global});
+	broadcast_thread_safe({message, global});
 }
 
 void WSServer::broadcast_thread_safe(broadcast_message message)
 {
 	QMutexLocker locker(&_broadcastMutex);
 	_broadcastQueue.enqueue(message);
+	locker.unlock();
+
+	// State changes should not wait for the next cycle tick
+	if (message.priority == control && _flushPending.testAndSetOrdered(0, 1))
+		QMetaObject::invokeMethod(this, "onCycle", Qt::QueuedConnection);
+}
+
+void WSServer::broadcast_thread_safe(const QList<broadcast_message>& messages)
+{
+	bool hasControl = false;
+	QMutexLocker locker(&_broadcastMutex);
+	for (const broadcast_message& message : messages)
+	{
+		_broadcastQueue.enqueue(message);
+		hasControl |= message.priority == control;
+	}
+	locker.unlock();
+
+	if (hasControl && _flushPending.testAndSetOrdered(0, 1))
+		QMetaObject::invokeMethod(this, "onCycle", Qt::QueuedConnection);
+}
+
+void WSServer::send(client_config* client, broadcast_message message)
+{
+	if (client->compact_updates && message.compact_encoded)
+	{
+		message.message = message.compact;
+		message.encoded = message.compact_encoded;
+		message.data = nullptr;
+	}
+
+	if (!message.encoded)
+		message.encoded.reset(new encoded_payloads());
+
+	QMutexLocker locker(&_clMutex);
+	if (message.priority == control)
+	{
+		client->bytes_in_flight += writeMessage(client, message);
+		return;
+	}
+
+	client->bulk_queue.enqueue(message);
+	while (client->bulk_queue.count() > BULK_LANE_MAX_QUEUED)
+		client->bulk_queue.dequeue();
+
+	pumpBulkLane(client);
+}
+
+client_config* WSServer::findClient(quint64 id)
+{
+	QMutexLocker locker(&_clMutex);
+	for (client_config* client : _clients)
+	{
+		if (client->id == id)
+			return client;
+	}
+	return nullptr;
+}
+
+/**
+ * Deliver a response of the request numbered `ticket`. Clients that asked
+ * for ordered responses only get it once all earlier requests completed.
+ * Must be called from the thread owning the sockets.
+ */
+void WSServer::respond(quint64 client_id, quint64 ticket,
+	broadcast_message message)
+{
+	QMutexLocker locker(&_clMutex);
+	client_config* client = findClient(client_id);
+	if (!client)
+		return;
+
+	if (!client->ordered_responses || ticket <= client->next_response)
+		send(client, message);
+	else
+		client->held_responses[ticket] << message;
+}
+
+void WSServer::complete_request(quint64 client_id, quint64 ticket)
+{
+	QMutexLocker locker(&_clMutex);
+	client_config* client = findClient(client_id);
+	if (!client || !client->ordered_responses
+		|| ticket < client->next_response)
+		return;
+
+	client->finished_tickets.insert(ticket);
+	while (client->finished_tickets.remove(client->next_response))
+	{
+		client->next_response++;
+		releaseHeldResponses(client, client->next_response);
+	}
+}
+
+void WSServer::releaseHeldResponses(client_config* client, quint64 ticket)
+{
+	for (const broadcast_message& message : client->held_responses.take(ticket))
+		send(client, message);
+}
+
+void WSServer::set_compact_updates(client_config* client, bool enable)
+{
+	QMutexLocker locker(&_clMutex);
+	if (client->compact_updates == enable)
+		return;
+
+	client->compact_updates = enable;
+	if (enable)
+		_compactClients.ref();
+	else
+		_compactClients.deref();
+}
+
+// Lets producers skip building the compact form nobody would receive
+bool WSServer::has_compact_clients()
+{
+	return _compactClients.load() > 0;
+}
+
+// Lets producers skip writing the CBOR form nobody would receive
+bool WSServer::has_cbor_clients()
+{
+	return _cborClients.load() > 0;
+}
+
+void WSServer::set_ordered_responses(client_config* client, bool enable)
+{
+	QMutexLocker locker(&_clMutex);
+	if (client->ordered_responses == enable)
+		return;
+
+	if (enable)
+	{
+		// Requests already in flight keep completing out of order, the
+		// current one (the request enabling it) is the first ordered one
+		client->next_response = client->next_ticket - 1;
+	}
+	else
+	{
+		while (!client->held_responses.isEmpty())
+			releaseHeldResponses(client, client->held_responses.firstKey());
+		client->finished_tickets.clear();
+	}
+	client->ordered_responses = enable;
+}
+
+void WSServer::respond_thread_safe(quint64 client_id, quint64 ticket,
+	broadcast_message message)
+{
+	queueResponse({client_id, ticket, false, message});
+}
+
+void WSServer::complete_request_thread_safe(quint64 client_id, quint64 ticket)
+{
+	queueResponse({client_id, ticket, true});
+}
+
+void WSServer::queueResponse(pending_response response)
+{
+	QMutexLocker locker(&_responseMutex);
+	bool wasEmpty = _responseQueue.isEmpty();
+	_responseQueue.enqueue(response);
+	locker.unlock();
+
+	if (wasEmpty)
+		QMetaObject::invokeMethod(this, "onResponsesReady", Qt::QueuedConnection);
+}
+
+void WSServer::onResponsesReady()
+{
+	QMutexLocker locker(&_responseMutex);
+	QQueue<pending_response> responses;
+	responses.swap(_responseQueue);
+	locker.unlock();
+
+	for (const pending_response& response : responses)
+	{
+		if (response.finished)
+			complete_request(response.client_id, response.ticket);
+		else
+			respond(response.client_id, response.ticket, response.message);
+	}
+}
+
+/**
+ * Run a request handler on the worker pool. It must only use OBS APIs that
+ * are safe to call from any thread, and report back through the
+ * *_thread_safe methods.
+ */
+void WSServer::run_request(QRunnable* request)
+{
+	_requestPool->start(request);
+}
+
+void WSServer::pumpBulkLane(client_config* client)
+{
+	while (!client->bulk_queue.isEmpty()
+		&& client->bytes_in_flight < BULK_LANE_WATERMARK)
+	{
+		client->bytes_in_flight +=
+			writeMessage(client, client->bulk_queue.dequeue());
+	}
+}
+
+qint64 WSServer::writeMessage(client_config* client,
+	const broadcast_message& message)
+{
+	if (client->socket && !client->deflater && client->encoding == encoding_json)
+		return client->socket->sendTextMessage(message.message);
+
+	QByteArray payload = client->deflater
+		? deflatedPayload(client, message)
+		: encodedPayload(message, client->encoding);
+
+	if (client->socket)
+		return client->socket->sendBinaryMessage(payload);
+
+	bool binary = client->deflater || client->encoding != encoding_json;
+	char header[LOCAL_FRAME_HEADER_SIZE];
+	qToBigEndian<quint32>(payload.size(), (uchar*)header);
+	header[4] = binary ? LOCAL_FRAME_BINARY : LOCAL_FRAME_TEXT;
+
+	return client->local_socket->write(header, sizeof(header))
+		+ client->local_socket->write(payload);
+}
+
+QByteArray WSServer::deflatedPayload(client_config* client,
+	const broadcast_message& message)
+{
+	const QByteArray& payload = encodedPayload(message, client->encoding);
+	MessageDeflater& deflater = *client->deflater;
+	if (deflater.contextTakeover())
+		return deflater.compress(payload);
+
+	// Without context takeover the output only depends on the settings,
+	// so clients sharing them can share the compressed payload too
+	int key = client->encoding << 8 | (deflater.level() + 1) << 4
+		| deflater.windowBits();
+	QHash<int, QByteArray>::iterator cached =
+		message.encoded->deflated.find(key);
+	if (cached == message.encoded->deflated.end())
+		cached = message.encoded->deflated.insert(key,
+			deflater.compress(payload));
+
+	return cached.value();
+}
+
+const QByteArray& WSServer::encodedPayload(const broadcast_message& message,
+	message_encoding encoding)
+{
+	encoded_payloads* encoded = message.encoded.data();
+	if (encoding == encoding_json)
+	{
+		if (encoded->utf8.isEmpty())
+			encoded->utf8 = message.message.toUtf8();
+		return encoded->utf8;
+	}
+
+	// Messages JsonWriter wrote without a CBOR form (no binary client was
+	// connected yet) and plain JSON strings are converted here
+	if (encoded->cbor.isEmpty())
+	{
+		if (message.data)
+		{
+			encoded->cbor = Cbor::FromData(message.data);
+		}
+		else
+		{
+			OBSDataAutoRelease data =
+				obs_data_create_from_json(message.message.toUtf8());
+			encoded->cbor = Cbor::FromData(data);
+		}
+	}
+	return encoded->cbor;
+}
+
+void WSServer::set_compression(client_config* client,
+	QSharedPointer<MessageDeflater> deflater)
+{
+	QMutexLocker locker(&_clMutex);
+	logCompressionStats(client);
+	client->deflater = deflater;
+}
+
+void WSServer::logCompressionStats(client_config* client)
+{
+	if (!client->deflater || client->deflater->bytesIn == 0)
+		return;
+
+	const MessageDeflater& deflater = *client->deflater;
+	blog(LOG_INFO, "client %s compression: %lld -> %lld bytes (%.1f%%), "
+		"%.2f ms spent deflating",
+		describe(client).toUtf8().constData(),
+		deflater.bytesIn, deflater.bytesOut,
+		100.0 * deflater.bytesOut / deflater.bytesIn,
+		deflater.deflateTimeNs / 1000000.0);
+}
+
+QString WSServer::describe(client_config* client)
+{
+	if (!client->socket)
+		return QString("local:%1").arg((quintptr)client->local_socket->socketDescriptor());
+
+	QHostAddress clientAddr = client->socket->peerAddress();
+	return QString("%1:%2").arg(Utils::FormatIPAddress(clientAddr))
+		.arg(client->socket->peerPort());
+}
+
+void WSServer::onBytesWritten(qint64 bytes)
+{
+	QMutexLocker locker(&_clMutex);
+	client_config* client = _clientMap.value(sender());
+	if (!client)
+		return;
+
+	client->bytes_in_flight = qMax<qint64>(0, client->bytes_in_flight - bytes);
+	pumpBulkLane(client);
 }
 
 void WSServer::add_audio_filter(ostws_audiofilter* audio_filter)
@@ -155,36 +767,386 @@ void WSServer::add_audio_filter(ostws_audiofilter* audio_filter)
 	_audioFilters.append(audio_filter);
 }
 
+// The audio broadcast cycle holds _audioFilterMutex for as long as it uses a
+// filter, so the filter can be freed as soon as this returns. The audio
+// thread never takes the mutex.
 void WSServer::remove_audio_filter(ostws_audiofilter* audio_filter)
 {
 	QMutexLocker locker(&_audioFilterMutex);
 	_audioFilters.removeAll(audio_filter);
 }
 
-void WSServer::onAudioBroadcastCycle()
+ostws_audiofilter* WSServer::find_audio_filter(obs_source_t* context)
 {
 	QMutexLocker locker(&_audioFilterMutex);
-	OBSDataAutoRelease obs_data = obs_data_create();
-	obs_data_set_string(obs_data, "update-type", "AudioUpdate");
+	for (ostws_audiofilter* audio_filter : _audioFilters)
+	{
+		if (audio_filter->context == context)
+			return audio_filter;
+	}
+	return nullptr;
+}
+
+// Ids and names of the audio filters, for reading compact AudioUpdates
+obs_data_array_t* WSServer::describe_audio_filters()
+{
+	obs_data_array_t* filters = obs_data_array_create();
+
+	QMutexLocker locker(&_audioFilterMutex);
+	for (auto audio_filter : _audioFilters)
+	{
+		obs_source_t* parent = obs_filter_get_parent(audio_filter->context);
+
+		OBSDataAutoRelease item = obs_data_create();
+		obs_data_set_int(item, "id", audio_filter->id);
+		obs_data_set_string(item, "source",
+			parent ? obs_source_get_name(parent) : "");
+		obs_data_set_string(item, "filter",
+			obs_source_get_name(audio_filter->context));
+
+		// The listing the worker keeps, the audio thread runs its own
+		// copy and never waits on this
+		OBSDataArrayAutoRelease thresholds = obs_data_array_create();
+		pthread_mutex_lock(&audio_filter->detection_mutex);
+		for (const audio_threshold& threshold : *audio_filter->thresholds)
+		{
+			OBSDataAutoRelease rule = obs_data_create();
+			obs_data_set_int(rule, "id", threshold.id);
+			obs_data_set_string(rule, "name", threshold.name.constData());
+			obs_data_set_bool(rule, "state", threshold.state);
+			obs_data_set_int(rule, "timestamp", threshold.stateTimestamp);
+			obs_data_array_push_back(thresholds, rule);
+		}
+
+		OBSDataArrayAutoRelease tones = obs_data_array_create();
+		for (const tone_detector& tone : *audio_filter->tones)
+		{
+			OBSDataAutoRelease detector = obs_data_create();
+			obs_data_set_int(detector, "id", tone.id);
+			obs_data_set_string(detector, "name", tone.name.constData());
+			obs_data_set_double(detector, "frequency", tone.frequency);
+			obs_data_set_bool(detector, "state", tone.state);
+			obs_data_set_int(detector, "timestamp", tone.stateTimestamp);
+			obs_data_array_push_back(tones, detector);
+		}
+		pthread_mutex_unlock(&audio_filter->detection_mutex);
+		obs_data_set_array(item, "thresholds", thresholds);
+		obs_data_set_array(item, "tones", tones);
+		obs_data_array_push_back(filters, item);
+	}
+	return filters;
+}
+
+void WSServer::add_video_filter(ostws_filter* video_filter)
+{
+	QMutexLocker locker(&_videoFilterMutex);
+	_videoFilters.append(video_filter);
+}
+
+void WSServer::remove_video_filter(ostws_filter* video_filter)
+{
+	QMutexLocker locker(&_videoFilterMutex);
+	_videoFilters.removeAll(video_filter);
+}
+
+ostws_filter* WSServer::find_video_filter(obs_source_t* context)
+{
+	QMutexLocker locker(&_videoFilterMutex);
+	for (ostws_filter* video_filter : _videoFilters)
+	{
+		if (video_filter->context == context)
+			return video_filter;
+	}
+	return nullptr;
+}
+
+/**
+ * Send the current detection state of every video filter to one client, as
+ * one DetectionState update per filter, so it doesn't have to wait for the
+ * next transition.
+ */
+void WSServer::push_detection_snapshot(client_config* client)
+{
+	QMutexLocker locker(&_videoFilterMutex);
+	for (ostws_filter* video_filter : _videoFilters)
+	{
+		OBSDataAutoRelease state =
+			ostws_filter_detection_state(video_filter, client);
+
+		OBSDataAutoRelease update = obs_data_create();
+		obs_data_set_string(update, "update-type", "DetectionState");
+		obs_data_apply(update, state);
+
+		send(client, {obs_data_get_json(update), global, control, update.Get()});
+	}
+}
+
+/**
+ * Send every logged event after `after` that the client's subscriptions
+ * accept, in order.
+ */
+replay_result WSServer::replay_events(client_config* client, quint64 after)
+{
+	QMutexLocker locker(&_clMutex);
+	replay_result result;
+	result.last_seq = _lastSeq;
+	result.oldest_seq = _eventLog.isEmpty()
+		? _lastSeq + 1 : _eventLog.head().seq;
+	result.replayed = 0;
+	// A sequence number from the future means the server restarted
+	result.gap = after + 1 < result.oldest_seq || after > _lastSeq;
+
+	for (const broadcast_message& message : _eventLog)
+	{
+		if (message.seq <= after)
+			continue;
+		if (message.recipient && client->id != message.recipient)
+			continue;
+		if (!accepts(client, message.type,
+			message.source, message.group, message.name))
+			continue;
+
+		send(client, message);
+		result.replayed++;
+	}
+	return result;
+}
+
+void WSServer::set_audio_rate(client_config* client, int rate)
+{
+	QMutexLocker locker(&_clMutex);
+	client->audio_interval = qRound(1000.0 / rate);
+	locker.unlock();
+
+	QMetaObject::invokeMethod(this, "updateAudioTimer", Qt::QueuedConnection);
+}
+
+void WSServer::updateAudioTimer()
+{
+	if (!_audioTimer)
+		return;
+
+	int interval = 1000 / AUDIO_DEFAULT_RATE;
+	QMutexLocker locker(&_clMutex);
+	for (client_config* client : _subscribers[audio])
+		interval = qMin(interval, client->audio_interval);
+	locker.unlock();
+
+	if (_audioTimer->interval() != interval)
+		_audioTimer->setInterval(interval);
+}
+
+static void write_audio_level(JsonWriter& writer, float level)
+{
+	// -inf (muted) has no JSON number
+	if (isfinite(level))
+		writer.writeDouble(nullptr, level);
+	else
+		writer.writeNull(nullptr);
+}
+
+void WSServer::onAudioBroadcastCycle()
+{
+	struct source_levels
+	{
+		uint32_t id;
+		QString name;
+		ostws_audio_levels levels;
+	};
 
-	const auto source_array = obs_data_array_create();
+	qint64 now = _audioClock.elapsed();
+	// A tick landing slightly before the end of a window still closes it
+	qint64 slack = _audioTimer->interval() / 2;
 
+	QMutexLocker locker(&_audioFilterMutex);
+	QList<source_levels> current;
 	for (auto audio_filter : _audioFilters)
 	{
-		const auto source_data = obs_data_create();
-		obs_data_set_string(source_data, "source", audio_filter->source_name);
-		obs_data_set_double(source_data, "magnitude", audio_filter->magnitude);
-		obs_data_set_double(source_data, "mul", audio_filter->mul);
-		obs_data_set_int(source_data, "nr_channels", audio_filter->nr_channels);
-		audio_filter->magnitude = AUDIO_MIN;
+		obs_source_t* parent = obs_filter_get_parent(audio_filter->context);
+		current.append({
+			audio_filter->id,
+			QString::fromUtf8(parent ? obs_source_get_name(parent) : ""),
+			ostws_audiofilter_take_levels(audio_filter)
+		});
+	}
+	locker.unlock();
+
+	QMutexLocker clientLocker(&_clMutex);
+	QSet<int> intervals;
+	for (client_config* client : _subscribers[audio])
+		intervals << client->audio_interval;
+
+	// Every rate in use takes the levels of this tick into its window
+	QSet<int> due;
+	for (auto window = _audioWindows.begin(); window != _audioWindows.end();)
+	{
+		if (intervals.contains(window.key()))
+			window++;
+		else
+			window = _audioWindows.erase(window);
+	}
+	for (int interval : intervals)
+	{
+		audio_window& window = _audioWindows[interval];
+		if (!window.end)
+			window.end = (now / interval + 1) * interval;
+
+		for (const source_levels& source : current)
+		{
+			auto levels = window.levels.find(source.id);
+			if (levels == window.levels.end())
+			{
+				window.levels.insert(source.id, source.levels);
+				continue;
+			}
+			levels->magnitude = fmax(levels->magnitude, source.levels.magnitude);
+			levels->peak = fmax(levels->peak, source.levels.peak);
+			levels->true_peak = fmax(levels->true_peak, source.levels.true_peak);
+			for (int i = 0; i < MAX_AUDIO_CHANNELS; i++)
+			{
+				levels->channel_magnitude[i] = fmax(levels->channel_magnitude[i],
+					source.levels.channel_magnitude[i]);
+				levels->channel_peak[i] = fmax(levels->channel_peak[i],
+					source.levels.channel_peak[i]);
+			}
+			levels->mul = source.levels.mul;
+			levels->nr_channels = source.levels.nr_channels;
+			levels->momentary = source.levels.momentary;
+			levels->short_term = source.levels.short_term;
+			levels->integrated = source.levels.integrated;
+			levels->loudness_range = source.levels.loudness_range;
+		}
+
+		if (now + slack >= window.end)
+		{
+			due << interval;
+			window.end += interval;
+			if (window.end <= now)
+				window.end = (now / interval + 1) * interval;
+		}
+	}
+
+	// Each source entry of a window is serialized once, clients of the
+	// same rate selecting the same sources share one message
+	bool compact = has_compact_clients();
+	bool cbor = has_cbor_clients();
+	QHash<int, QList<encoded_payloads>> entries;
+	QHash<QByteArray, broadcast_message> selections;
+	for (client_config* client : _subscribers[audio])
+	{
+		if (!due.contains(client->audio_interval))
+			continue;
+
+		const audio_window& window = _audioWindows[client->audio_interval];
+		QList<encoded_payloads>& windowEntries = entries[client->audio_interval];
+		if (windowEntries.isEmpty())
+		{
+			for (const source_levels& source : current)
+			{
+				ostws_audio_levels levels = window.levels.value(source.id);
+
+				JsonWriter& writer = JsonWriter::Begin(nullptr, cbor);
+				writer.writeString("source", source.name.toUtf8().constData());
+				writer.writeDouble("magnitude", levels.magnitude);
+				writer.writeDouble("peak", levels.peak);
+				writer.writeDouble("true_peak", levels.true_peak);
+				writer.writeDouble("mul", levels.mul);
+				writer.writeInt("nr_channels", levels.nr_channels);
+				writer.beginArray("channels");
+				for (int i = 0; i < levels.nr_channels; i++)
+				{
+					writer.beginObject();
+					writer.writeDouble("magnitude", levels.channel_magnitude[i]);
+					writer.writeDouble("peak", levels.channel_peak[i]);
+					writer.endObject();
+				}
+				writer.endArray();
+				writer.beginObject("loudness");
+				writer.writeDouble("momentary", levels.momentary);
+				writer.writeDouble("short_term", levels.short_term);
+				writer.writeDouble("integrated", levels.integrated);
+				writer.writeDouble("range", levels.loudness_range);
+				writer.endObject();
+				encoded_payloads entry;
+				entry.utf8 = writer.end();
+				entry.cbor = writer.cbor();
+				windowEntries << entry;
+			}
+		}
 
-		obs_data_array_push_back(source_array, source_data);
+		QByteArray selection(current.count(), '0');
+		for (int i = 0; i < current.count(); i++)
+		{
+			if (accepts(client, audio, current[i].name, QString(), QString()))
+				selection[i] = '1';
+		}
+		selection.append(QByteArray::number(client->audio_interval));
+
+		QHash<QByteArray, broadcast_message>::iterator message =
+			selections.find(selection);
+		if (message == selections.end())
+		{
+			JsonWriter& writer = JsonWriter::Begin("AudioUpdate", cbor);
+			writer.beginArray("sources");
+			for (int i = 0; i < current.count(); i++)
+			{
+				const encoded_payloads& entry = windowEntries[i];
+				if (selection[i] == '1')
+					writer.writeRaw(nullptr, entry.utf8.constData(),
+						entry.utf8.size(), entry.cbor.constData(),
+						entry.cbor.size());
+			}
+			writer.endArray();
+			broadcast_message update = json_message(writer, audio, control);
+
+			if (compact)
+			{
+				JsonWriter& compactWriter = JsonWriter::Begin("AudioUpdate",
+					cbor);
+				compactWriter.beginArray("levels");
+				for (int i = 0; i < current.count(); i++)
+				{
+					if (selection[i] != '1')
+						continue;
+
+					ostws_audio_levels levels = window.levels.value(current[i].id);
+					compactWriter.beginArray(nullptr);
+					compactWriter.writeInt(nullptr, current[i].id);
+					write_audio_level(compactWriter, levels.magnitude);
+					write_audio_level(compactWriter, levels.peak);
+					write_audio_level(compactWriter, levels.true_peak);
+					compactWriter.beginArray(nullptr);
+					for (int channel = 0; channel < levels.nr_channels; channel++)
+					{
+						write_audio_level(compactWriter,
+							levels.channel_magnitude[channel]);
+						write_audio_level(compactWriter,
+							levels.channel_peak[channel]);
+					}
+					compactWriter.endArray();
+					compactWriter.beginArray(nullptr);
+					write_audio_level(compactWriter, levels.momentary);
+					write_audio_level(compactWriter, levels.short_term);
+					write_audio_level(compactWriter, levels.integrated);
+					write_audio_level(compactWriter, levels.loudness_range);
+					compactWriter.endArray();
+					compactWriter.endArray();
+				}
+				compactWriter.endArray();
+				set_compact_form(update, compactWriter);
+			}
+
+			message = selections.insert(selection, update);
+		}
+
+		send(client, message.value());
 	}
-	obs_data_set_array(obs_data, "sources", source_array);
-	WSServer::Instance->broadcast_thread_safe({
-		obs_data_get_json(obs_data),
-		audio
-	});
+
+	for (int interval : due)
+		_audioWindows[interval].levels.clear();
+	clientLocker.unlock();
+
+	updateAudioTimer();
 }
 
 void WSServer::onNewConnection()
@@ -194,13 +1156,23 @@ void WSServer::onNewConnection()
 	{
 		connect(pSocket, SIGNAL(textMessageReceived(const QString&)),
 		        this, SLOT(onTextMessageReceived(QString)));
+		connect(pSocket, SIGNAL(binaryMessageReceived(const QByteArray&)),
+		        this, SLOT(onBinaryMessageReceived(QByteArray)));
 		connect(pSocket, SIGNAL(disconnected()),
 		        this, SLOT(onSocketDisconnected()));
+		connect(pSocket, SIGNAL(bytesWritten(qint64)),
+		        this, SLOT(onBytesWritten(qint64)));
 
-		QMutexLocker locker(&_clMutex);
-		_clients << pSocket;
-		client_config_map[pSocket] = {};
-		locker.unlock();
+		client_config* client = new client_config();
+		client->socket = pSocket;
+
+		// QWebSocketServer can't select a subprotocol, so the binary
+		// encoding is requested in the handshake URL (ws://host:port/?encoding=cbor)
+		QUrlQuery query(pSocket->requestUrl());
+		if (query.queryItemValue("encoding") == "cbor")
+			client->encoding = encoding_cbor;
+
+		addClient(pSocket, client);
 
 		QHostAddress clientAddr = pSocket->peerAddress();
 		QString clientIp = Utils::FormatIPAddress(clientAddr);
@@ -210,32 +1182,125 @@ void WSServer::onNewConnection()
 	}
 }
 
+void WSServer::addClient(QObject* transport, client_config* client)
+{
+	QMutexLocker locker(&_clMutex);
+	client->id = _nextClientId++;
+	_clients << client;
+	_clientMap[transport] = client;
+	if (client->encoding == encoding_cbor)
+		_cborClients.ref();
+}
+
+void WSServer::onNewLocalConnection()
+{
+	QLocalSocket* pSocket = _localServer->nextPendingConnection();
+	if (pSocket)
+	{
+		connect(pSocket, SIGNAL(readyRead()),
+		        this, SLOT(onLocalReadyRead()));
+		connect(pSocket, SIGNAL(disconnected()),
+		        this, SLOT(onSocketDisconnected()));
+		connect(pSocket, SIGNAL(bytesWritten(qint64)),
+		        this, SLOT(onBytesWritten(qint64)));
+
+		client_config* client = new client_config();
+		client->local_socket = pSocket;
+		addClient(pSocket, client);
+
+		blog(LOG_INFO, "new client connection on local socket");
+	}
+}
+
+void WSServer::onLocalReadyRead()
+{
+	QLocalSocket* pSocket = qobject_cast<QLocalSocket*>(sender());
+	client_config* client = _clientMap.value(pSocket);
+	if (!client)
+		return;
+
+	client->local_buffer.append(pSocket->readAll());
+	while (client->local_buffer.size() >= LOCAL_FRAME_HEADER_SIZE)
+	{
+		const uchar* header = (const uchar*)client->local_buffer.constData();
+		quint32 length = qFromBigEndian<quint32>(header);
+		char opcode = header[4];
+
+		if (length > LOCAL_FRAME_MAX_SIZE)
+		{
+			blog(LOG_ERROR, "local client sent an oversized frame, disconnecting");
+			pSocket->abort();
+			return;
+		}
+		if ((quint32)client->local_buffer.size() < LOCAL_FRAME_HEADER_SIZE + length)
+			return;
+
+		QByteArray payload = client->local_buffer.mid(LOCAL_FRAME_HEADER_SIZE, length);
+		client->local_buffer.remove(0, LOCAL_FRAME_HEADER_SIZE + length);
+
+		WSRequestHandler handler(client);
+		if (opcode == LOCAL_FRAME_BINARY)
+			handler.processIncomingBinaryMessage(payload);
+		else
+			handler.processIncomingMessage(payload);
+
+		// The request may have closed the socket
+		client = _clientMap.value(pSocket);
+		if (!client)
+			return;
+	}
+}
+
 void WSServer::onTextMessageReceived(QString message)
 {
 	QWebSocket* pSocket = qobject_cast<QWebSocket*>(sender());
-	if (pSocket)
+	client_config* client = _clientMap.value(pSocket);
+	if (client)
 	{
-		WSRequestHandler handler(pSocket);
-		handler.processIncomingMessage(message);
+		WSRequestHandler handler(client);
+		handler.processIncomingMessage(message.toUtf8());
 	}
 }
 
-void WSServer::onSocketDisconnected()
+void WSServer::onBinaryMessageReceived(QByteArray message)
 {
 	QWebSocket* pSocket = qobject_cast<QWebSocket*>(sender());
-	if (pSocket)
+	client_config* client = _clientMap.value(pSocket);
+	if (client)
 	{
-		QMutexLocker locker(&_clMutex);
-		_clients.removeAll(pSocket);
-		locker.unlock();
+		WSRequestHandler handler(client);
+		handler.processIncomingBinaryMessage(message);
+	}
+}
 
-		pSocket->deleteLater();
+void WSServer::onSocketDisconnected()
+{
+	QObject* pSocket = sender();
+	QMutexLocker locker(&_clMutex);
+	client_config* client = _clientMap.take(pSocket);
+	if (client)
+	{
+		_clients.removeAll(client);
+		for (QList<client_config*>& subscribers : _subscribers)
+			subscribers.removeAll(client);
+		if (client->compact_updates)
+			_compactClients.deref();
+		if (client->encoding == encoding_cbor)
+			_cborClients.deref();
+		logCompressionStats(client);
 
-		QHostAddress clientAddr = pSocket->peerAddress();
-		QString clientIp = Utils::FormatIPAddress(clientAddr);
+		blog(LOG_INFO, "client %s disconnected",
+			describe(client).toUtf8().constData());
 
-		blog(LOG_INFO, "client %s:%d disconnected",
-			clientIp.toUtf8().constData(), pSocket->peerPort());
+		quint64 clientId = client->id;
+		delete client;
+		locker.unlock();
+
+		// Outside _clMutex, the analyzer broadcasts while holding its own
+		if (AudioAnalyzer::Instance)
+			AudioAnalyzer::Instance->release_client(clientId);
+
+		pSocket->deleteLater();
 
 		// obs_frontend_push_ui_translation(obs_module_get_string);
 		// QString title = tr("OBSWebsocket.NotifyDisconnect.Title");
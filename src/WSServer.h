@@ -23,33 +23,186 @@ with this program. If not, see <https://www.gnu.org/licenses/>
 #include <QList>
 #include <QMutex>
 #include <QQueue>
+#include <QMap>
+#include <QSet>
+#include <QAtomicInt>
+#include <QSharedPointer>
+#include <QRegExp>
+#include <QElapsedTimer>
 
 #include "WSRequestHandler.h"
+#include "JsonWriter.h"
+#include "MessageDeflater.h"
+#include "AudioFilter.h"
 
-struct ostws_audiofilter;
+struct ostws_filter;
 
+QT_FORWARD_DECLARE_CLASS(QWebSocketServer)
+QT_FORWARD_DECLARE_CLASS(QWebSocket)
+QT_FORWARD_DECLARE_CLASS(QLocalServer)
+QT_FORWARD_DECLARE_CLASS(QLocalSocket)
+QT_FORWARD_DECLARE_CLASS(QThreadPool)
+QT_FORWARD_DECLARE_CLASS(QRunnable)
+QT_FORWARD_DECLARE_CLASS(QTimer)
+
+// Update types clients can subscribe to, global messages reach everyone
 enum broadcast_type
 {
-	global,
-	video,
-	audio
+	global = 0,
+	group_state = 1 << 0,
+	rectangle_state = 1 << 1,
+	video = 1 << 2,
+	audio = 1 << 3,
+	spectrum = 1 << 4,
+	threshold_state = 1 << 5,
+	tone_state = 1 << 6,
+	onset = 1 << 7,
+	beat = 1 << 8,
+	sync_offset = 1 << 9
 };
 
-struct client_config
+#define VIDEO_BROADCAST_TYPES (group_state | rectangle_state | video)
+#define AUDIO_BROADCAST_TYPES (audio | spectrum | threshold_state | tone_state \
+	| onset | beat | sync_offset)
+#define ALL_BROADCAST_TYPES (VIDEO_BROADCAST_TYPES | AUDIO_BROADCAST_TYPES)
+
+enum broadcast_priority
 {
-	bool video_broadcast = false;
-	bool audio_broadcast = false;
+	control,
+	bulk
+};
+
+enum message_encoding
+{
+	encoding_json,
+	encoding_cbor
+};
+
+// Encoded forms of one message, built on first use and shared by every
+// client the message is fanned out to
+struct encoded_payloads
+{
+	QByteArray utf8;
+	QByteArray cbor;
+	QHash<int, QByteArray> deflated;
 };
 
 struct broadcast_message
 {
 	QString message;
 	broadcast_type type = global;
+	broadcast_priority priority = control;
+	OBSData data;
+	// Keys matched against subscription patterns
+	QString source;
+	QString group;
+	QString name;
+	// Id of the only client_config the message goes to, 0 for all
+	quint64 recipient = 0;
+	QSharedPointer<encoded_payloads> encoded;
+	// Form with names replaced by numeric ids, for clients that enabled
+	// compact updates (see GetFilterLayout)
+	QString compact;
+	QSharedPointer<encoded_payloads> compact_encoded;
+	// Position in the event log, 0 for bulk and meter updates
+	quint64 seq = 0;
+	// Video frame the update was produced for, 0 if none
+	quint64 timestamp = 0;
+};
+
+// Result of replaying the event log to a client
+struct replay_result
+{
+	quint64 last_seq;
+	quint64 oldest_seq;
+	int replayed;
+	// Events after the requested one were already dropped from the log
+	bool gap;
 };
 
+// Message serialized up front by JsonWriter, the bytes double as its JSON
+// payload. CBOR clients get it re-parsed.
+broadcast_message json_message(const QByteArray& json, broadcast_type type,
+	broadcast_priority priority, const QString& source = QString(),
+	const QString& group = QString(), const QString& name = QString());
+void set_compact_form(broadcast_message& message, const QByteArray& json);
+// Same, ending the message of `writer` and taking its CBOR form too when it
+// wrote one (see has_cbor_clients)
+broadcast_message json_message(JsonWriter& writer, broadcast_type type,
+	broadcast_priority priority, const QString& source = QString(),
+	const QString& group = QString(), const QString& name = QString());
+void set_compact_form(broadcast_message& message, JsonWriter& writer);
+
+// Empty patterns match everything, others are wildcard patterns (* and ?)
+struct subscription
+{
+	int types = 0;
+	QRegExp source;
+	QRegExp group;
+	QRegExp name;
+};
+
+// AudioUpdate rates a client can ask for, in Hz (see SetAudio)
+#define AUDIO_DEFAULT_RATE 2
+#define AUDIO_MAX_RATE 60
+
+// Levels of every audio filter over one AudioUpdate window. Windows end on
+// multiples of the interval, so all clients at one rate share them.
+struct audio_window
+{
+	qint64 end = 0;
+	// Keyed by audio filter id
+	QHash<uint32_t, ostws_audio_levels> levels;
+};
+
+// Local socket framing: 4 byte big-endian payload length, 1 byte opcode
+#define LOCAL_FRAME_HEADER_SIZE 5
+#define LOCAL_FRAME_TEXT 1
+#define LOCAL_FRAME_BINARY 2
+
+// Exactly one of socket and local_socket is set
+struct client_config
+{
+	// Stays unique for the lifetime of the server, unlike the pointer
+	quint64 id = 0;
+	QWebSocket* socket = nullptr;
+	QLocalSocket* local_socket = nullptr;
+	QByteArray local_buffer;
+	message_encoding encoding = encoding_json;
+	QQueue<broadcast_message> bulk_queue;
+	qint64 bytes_in_flight = 0;
+	QSharedPointer<MessageDeflater> deflater;
+	bool compact_updates = false;
+	// Milliseconds between AudioUpdates
+	int audio_interval = 1000 / AUDIO_DEFAULT_RATE;
+	// Control updates of one flush are collected and sent as one Batch
+	bool batch_updates = false;
+	QList<broadcast_message> batch;
+
+	QList<subscription> subscriptions;
+	// Types with at least one subscription / with a match-all subscription
+	int topic_mask = 0;
+	int unfiltered_mask = 0;
+
+	// Requests are numbered as they arrive. With ordered_responses set,
+	// responses of a request are held back until every earlier request
+	// has completed.
+	quint64 next_ticket = 0;
+	bool ordered_responses = false;
+	quint64 next_response = 0;
+	QSet<quint64> finished_tickets;
+	QMap<quint64, QList<broadcast_message>> held_responses;
+};
+
+// Response or completion of a request handled on the worker pool
+struct pending_response
+{
+	quint64 client_id;
+	quint64 ticket;
+	bool finished;
+	broadcast_message message;
+};
 
-QT_FORWARD_DECLARE_CLASS(QWebSocketServer)
-QT_FORWARD_DECLARE_CLASS(QWebSocket)
 
 class WSServer : public QObject
 {
@@ -58,31 +211,106 @@ public:
 	explicit WSServer(QObject* parent = Q_NULLPTR);
 	virtual ~WSServer();
 	void Start(quint16 port);
+	void StartLocal(QString name);
 	void Stop();
 	void broadcast(QString message);
 	void broadcast(broadcast_message message);
 	void broadcast_thread_safe(QString message);
 	void broadcast_thread_safe(broadcast_message message);
+	void broadcast_thread_safe(const QList<broadcast_message>& messages);
+	void send(client_config* client, broadcast_message message);
+	void respond(quint64 client_id, quint64 ticket, broadcast_message message);
+	void complete_request(quint64 client_id, quint64 ticket);
+	void respond_thread_safe(quint64 client_id, quint64 ticket,
+		broadcast_message message);
+	void complete_request_thread_safe(quint64 client_id, quint64 ticket);
+	void set_ordered_responses(client_config* client, bool enable);
+	void set_compact_updates(client_config* client, bool enable);
+	void set_batching(client_config* client, bool enable);
+	void set_audio_rate(client_config* client, int rate);
+	bool has_compact_clients();
+	bool has_cbor_clients();
+	void run_request(QRunnable* request);
+	void set_compression(client_config* client,
+		QSharedPointer<MessageDeflater> deflater);
+	void set_subscriptions(client_config* client,
+		QList<subscription> subscriptions);
+	static bool accepts(const client_config* client, broadcast_type type,
+		const QString& source, const QString& group, const QString& name);
 	void add_audio_filter(ostws_audiofilter* audio_filter);
 	void remove_audio_filter(ostws_audiofilter* audio_filter);
-	static QHash<QWebSocket*, client_config> client_config_map;
+	ostws_audiofilter* find_audio_filter(obs_source_t* context);
+	obs_data_array_t* describe_audio_filters();
+	void add_video_filter(ostws_filter* video_filter);
+	void remove_video_filter(ostws_filter* video_filter);
+	ostws_filter* find_video_filter(obs_source_t* context);
+	void push_detection_snapshot(client_config* client);
+	replay_result replay_events(client_config* client, quint64 after);
 	static WSServer* Instance;
 
 private slots:
 	void onCycle();
 	void onNewConnection();
+	void onNewLocalConnection();
+	void onLocalReadyRead();
 	void onTextMessageReceived(QString message);
+	void onBinaryMessageReceived(QByteArray message);
 	void onSocketDisconnected();
+	void onBytesWritten(qint64 bytes);
 	void onAudioBroadcastCycle();
+	void updateAudioTimer();
+	void onResponsesReady();
 
 private:
+	void startCycleTimers();
+	void addClient(QObject* transport, client_config* client);
+	client_config* findClient(quint64 id);
+	void queueResponse(pending_response response);
+	void releaseHeldResponses(client_config* client, quint64 ticket);
+	void sendBatches();
+	broadcast_message buildBatch(client_config* client);
+	void pumpBulkLane(client_config* client);
+	qint64 writeMessage(client_config* client,
+		const broadcast_message& message);
+	const QByteArray& encodedPayload(const broadcast_message& message,
+		message_encoding encoding);
+	QByteArray deflatedPayload(client_config* client,
+		const broadcast_message& message);
+	static QString describe(client_config* client);
+	void logCompressionStats(client_config* client);
+
 	QWebSocketServer* _wsServer;
-	QList<QWebSocket*> _clients;
+	QLocalServer* _localServer;
+	bool _cycleTimersStarted;
+	QList<client_config*> _clients;
+	// Keyed by the QWebSocket or QLocalSocket of the client
+	QHash<QObject*, client_config*> _clientMap;
+	// Subscribed clients per broadcast_type bit
+	QHash<int, QList<client_config*>> _subscribers;
+	quint64 _nextClientId;
+	// Recent control broadcasts for Resume, guarded by _clMutex
+	QQueue<broadcast_message> _eventLog;
+	quint64 _lastSeq;
 	QMutex _clMutex;
 	QQueue<broadcast_message> _broadcastQueue;
 	QMutex _broadcastMutex;
+	QAtomicInt _flushPending;
+	// Set while onCycle drains the queue, guarded by _clMutex
+	bool _flushing;
+	QAtomicInt _compactClients;
+	QAtomicInt _cborClients;
+	QThreadPool* _requestPool;
+	QQueue<pending_response> _responseQueue;
+	QMutex _responseMutex;
 	QList<ostws_audiofilter*> _audioFilters;
 	QMutex _audioFilterMutex;
+	// Runs at the highest AudioUpdate rate any client asked for
+	QTimer* _audioTimer;
+	QElapsedTimer _audioClock;
+	// Open windows per interval, only used by onAudioBroadcastCycle
+	QMap<int, audio_window> _audioWindows;
+	QList<ostws_filter*> _videoFilters;
+	QMutex _videoFilterMutex;
 };
 
 #endif // WSSERVER_H
@@ -26,6 +26,7 @@ with this program. If not, see <https://www.gnu.org/licenses/>
 #include "WSServer.h"
 #include "WSEvents.h"
 #include "Config.h"
+#include "AudioAnalyzer.h"
 
 void ___source_dummy_addref(obs_source_t*) {}
 void ___sceneitem_dummy_addref(obs_sceneitem_t*) {}
@@ -59,10 +60,14 @@ bool obs_module_load(void) {
 
     WSServer::Instance = new WSServer();
     WSEvents::Instance = new WSEvents(WSServer::Instance);
+    AudioAnalyzer::Instance = new AudioAnalyzer();
 
     if (config->ServerEnabled)
         WSServer::Instance->Start(config->ServerPort);
 
+    if (config->LocalSocketEnabled)
+        WSServer::Instance->StartLocal(config->LocalSocketName);
+
 	ostws_filter_info = create_ostws_filter_info();
 	obs_register_source(&ostws_filter_info);
 
@@ -75,6 +80,8 @@ bool obs_module_load(void) {
 }
 
 void obs_module_unload() {
+    delete AudioAnalyzer::Instance;
+    AudioAnalyzer::Instance = nullptr;
     blog(LOG_INFO, "Unloaded");
 }
 
@@ -0,0 +1,125 @@
+/**
+ * Compares every audio_sum_squares_peak kernel the CPU runs against the
+ * scalar one: all lengths from 0 to 199 at each misalignment of a 16 byte
+ * boundary, then the channels of 1024 frame stereo and 5.1 buffers. The
+ * peaks must be identical and the sums within the rounding error of a
+ * float sum of that many terms. Then reports samples/s for each kernel on
+ * the 1024 frame buffers.
+ *
+ * Usage: audio_kernels_bench [iterations]
+ */
+
+#include <chrono>
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+#include "AudioKernels.h"
+
+#define MAX_LENGTH 200
+#define BUFFER_FRAMES 1024
+
+static uint32_t random_state = 12345;
+
+// Uniform in [-1, 1), with an occasional full scale sample so peaks land
+// in the vector and tail parts alike
+static float random_sample()
+{
+	random_state = random_state * 1664525u + 1013904223u;
+	if ((random_state >> 8) % 97 == 0)
+		return (random_state & 1) ? 1.0f : -1.0f;
+	return (float)((random_state >> 8) / 8388608.0 - 1.0);
+}
+
+static bool compare(const audio_sum_squares_peak_kernel& kernel,
+	const float* samples, size_t count, const char* label)
+{
+	const audio_sum_squares_peak_kernel* kernels;
+	audio_sum_squares_peak_kernels(&kernels);
+
+	float expected_sum, expected_peak;
+	kernels[0].func(samples, count, &expected_sum, &expected_peak);
+	float sum, peak;
+	kernel.func(samples, count, &sum, &peak);
+
+	// Both sums are within count * FLT_EPSILON of the exact one
+	double tolerance = 2.0 * count * FLT_EPSILON * expected_sum;
+	if (peak != expected_peak || fabs(sum - expected_sum) > tolerance)
+	{
+		fprintf(stderr, "%s, %s, %zu samples: sum %.9g peak %.9g, "
+			"scalar %.9g %.9g\n", kernel.name, label, count,
+			sum, peak, expected_sum, expected_peak);
+		return false;
+	}
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	long iterations = argc > 1 ? atol(argv[1]) : 200000;
+
+	const audio_sum_squares_peak_kernel* kernels;
+	size_t kernel_count = audio_sum_squares_peak_kernels(&kernels);
+
+	std::vector<float> samples(MAX_LENGTH + 4);
+	std::vector<float> planes(6 * BUFFER_FRAMES);
+	for (float& sample : samples)
+		sample = random_sample();
+	for (float& sample : planes)
+		sample = random_sample();
+
+	bool ok = true;
+	for (size_t k = 1; k < kernel_count; k++)
+	{
+		for (int offset = 0; offset < 4; offset++)
+		{
+			for (size_t count = 0; count < MAX_LENGTH; count++)
+				ok = compare(kernels[k], samples.data() + offset, count,
+					"short") && ok;
+		}
+		for (int channel = 0; channel < 6; channel++)
+			ok = compare(kernels[k],
+				planes.data() + channel * BUFFER_FRAMES, BUFFER_FRAMES,
+				channel < 2 ? "stereo" : "5.1") && ok;
+	}
+	if (!ok)
+		return 1;
+
+	static const struct
+	{
+		const char* name;
+		int channels;
+	} layouts[] = { { "stereo", 2 }, { "5.1", 6 } };
+
+	for (const auto& layout : layouts)
+	{
+		for (size_t k = 0; k < kernel_count; k++)
+		{
+			float total = 0.0f;
+			auto start = std::chrono::steady_clock::now();
+			for (long n = 0; n < iterations; n++)
+			{
+				for (int channel = 0; channel < layout.channels; channel++)
+				{
+					float sum, peak;
+					kernels[k].func(planes.data() + channel * BUFFER_FRAMES,
+						BUFFER_FRAMES, &sum, &peak);
+					total += sum + peak;
+				}
+			}
+			std::chrono::duration<double> elapsed =
+				std::chrono::steady_clock::now() - start;
+
+			double seconds = elapsed.count() > 0.0 ? elapsed.count() : 1e-9;
+			double samples_per_second = (double)iterations
+				* layout.channels * BUFFER_FRAMES / seconds;
+			printf("%-6s %-6s %8.1f ns/buffer %10.0f Msamples/s (%g)\n",
+				layout.name, kernels[k].name, seconds * 1e9 / iterations,
+				samples_per_second / 1e6, total);
+		}
+	}
+
+	return 0;
+}
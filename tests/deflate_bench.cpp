@@ -0,0 +1,231 @@
+/**
+ * CPU cost of MessageDeflater against the bytes it saves, for every level,
+ * windowBits value and context takeover setting, on the JSON form of the
+ * updates sent most: hex VideoUpdate pixels, AudioUpdate and its compact
+ * levels form. Each payload is a sequence of consecutive updates that
+ * change a little from one to the next, compressed in send order, so
+ * context takeover gets what it would from a real stream. The output is
+ * also inflated back to check it against the input.
+ *
+ * Usage: deflate_bench [iterations]
+ */
+
+#include <chrono>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include "JsonWriter.h"
+#include "MessageDeflater.h"
+
+// Consecutive updates in a payload sequence
+#define SEQUENCE_LENGTH 64
+
+// 64x64 minimap, a gradient with a marker moving across it
+static QByteArray video_update(int frame)
+{
+	static const char hex_digits[] = "0123456789ABCDEF";
+
+	JsonWriter& writer = JsonWriter::Begin("VideoUpdate");
+	writer.writeString("name", "minimap");
+	writer.writeString("group", "hud");
+	char* pixels = writer.writeStringInPlace("pixels", 64 * 64 * 8);
+	for (uint32_t y = 0; y < 64; y++)
+	{
+		for (uint32_t x = 0; x < 64; x++)
+		{
+			uint32_t color = 0xFF000000 | (x * 4) << 16 | (y * 4) << 8 | 0x40;
+			if (x / 4 == (uint32_t)frame % 16 && y / 4 == 8)
+				color = 0xFFFFFF00;
+			for (int nibble = 7; nibble >= 0; nibble--)
+			{
+				*pixels++ = hex_digits[color >> 28];
+				color <<= 4;
+			}
+		}
+	}
+	writer.writeInt("timestamp", 1234567890123LL + frame * 16666667LL);
+	return writer.end();
+}
+
+// Levels of source `source` in update `frame`, in dB
+static double level(int frame, int source, double offset)
+{
+	return -20.0 - 3.0 * source + offset + 6.0 * sin(frame * 0.37 + source);
+}
+
+static QByteArray audio_update(int frame)
+{
+	static const char* names[] = {"Desktop Audio", "Mic/Aux", "Game Capture",
+		"Music"};
+
+	JsonWriter& writer = JsonWriter::Begin("AudioUpdate");
+	writer.beginArray("sources");
+	for (int source = 0; source < 4; source++)
+	{
+		writer.beginObject();
+		writer.writeString("source", names[source]);
+		writer.writeDouble("magnitude", level(frame, source, 0.0));
+		writer.writeDouble("peak", level(frame, source, 9.0));
+		writer.writeDouble("true_peak", level(frame, source, 9.4));
+		writer.writeDouble("mul", 1.0);
+		writer.writeInt("nr_channels", 2);
+		writer.beginArray("channels");
+		for (int channel = 0; channel < 2; channel++)
+		{
+			writer.beginObject();
+			writer.writeDouble("magnitude", level(frame, source, -channel));
+			writer.writeDouble("peak", level(frame, source, 9.0 - channel));
+			writer.endObject();
+		}
+		writer.endArray();
+		writer.beginObject("loudness");
+		writer.writeDouble("momentary", level(frame, source, 1.0));
+		writer.writeDouble("short_term", level(frame / 8, source, 0.5));
+		writer.writeDouble("integrated", -23.0 - source);
+		writer.writeDouble("range", 6.5);
+		writer.endObject();
+		writer.endObject();
+	}
+	writer.endArray();
+	return writer.end();
+}
+
+static QByteArray compact_levels(int frame)
+{
+	JsonWriter& writer = JsonWriter::Begin("AudioUpdate");
+	writer.beginArray("levels");
+	for (int source = 0; source < 4; source++)
+	{
+		writer.beginArray(nullptr);
+		writer.writeInt(nullptr, source + 1);
+		writer.writeDouble(nullptr, level(frame, source, 0.0));
+		writer.writeDouble(nullptr, level(frame, source, 9.0));
+		writer.writeDouble(nullptr, level(frame, source, 9.4));
+		writer.beginArray(nullptr);
+		for (int channel = 0; channel < 2; channel++)
+		{
+			writer.writeDouble(nullptr, level(frame, source, -channel));
+			writer.writeDouble(nullptr, level(frame, source, 9.0 - channel));
+		}
+		writer.endArray();
+		writer.beginArray(nullptr);
+		writer.writeDouble(nullptr, level(frame, source, 1.0));
+		writer.writeDouble(nullptr, level(frame / 8, source, 0.5));
+		writer.writeDouble(nullptr, -23.0 - source);
+		writer.writeDouble(nullptr, 6.5);
+		writer.endArray();
+		writer.endArray();
+	}
+	writer.endArray();
+	return writer.end();
+}
+
+struct bench_case
+{
+	const char* name;
+	QByteArray (*write)(int frame);
+};
+
+static const bench_case cases[] = {
+	{"VideoUpdate 64x64 hex", video_update},
+	{"AudioUpdate 4 sources", audio_update},
+	{"AudioUpdate compact", compact_levels},
+};
+
+// Inflates a sequence the way a client does, one stream for all of it,
+// and compares it with the input
+static bool round_trip(const std::vector<QByteArray>& input, int windowBits,
+	bool contextTakeover, int level)
+{
+	MessageDeflater deflater(level, windowBits, contextTakeover);
+	z_stream stream;
+	memset(&stream, 0, sizeof(stream));
+	if (!deflater.isValid() || inflateInit2(&stream, -windowBits) != Z_OK)
+		return false;
+
+	bool ok = true;
+	std::vector<char> output;
+	for (const QByteArray& message : input)
+	{
+		QByteArray compressed = deflater.compress(message);
+		compressed.append("\x00\x00\xff\xff", 4);
+
+		output.resize(message.size() + 1);
+		stream.next_in = (Bytef*)compressed.constData();
+		stream.avail_in = compressed.size();
+		stream.next_out = (Bytef*)output.data();
+		stream.avail_out = output.size();
+		int result = inflate(&stream, Z_SYNC_FLUSH);
+		size_t written = output.size() - stream.avail_out;
+		if (result != Z_OK || stream.avail_in != 0
+			|| written != (size_t)message.size()
+			|| memcmp(output.data(), message.constData(), written) != 0)
+		{
+			ok = false;
+			break;
+		}
+	}
+	inflateEnd(&stream);
+	return ok;
+}
+
+static double seconds_since(std::chrono::steady_clock::time_point start)
+{
+	std::chrono::duration<double> elapsed =
+		std::chrono::steady_clock::now() - start;
+	return elapsed.count() > 0.0 ? elapsed.count() : 1e-9;
+}
+
+int main(int argc, char** argv)
+{
+	long iterations = argc > 1 ? atol(argv[1]) : 2000;
+
+	for (const bench_case& c : cases)
+	{
+		std::vector<QByteArray> sequence;
+		long sequenceBytes = 0;
+		for (int frame = 0; frame < SEQUENCE_LENGTH; frame++)
+		{
+			sequence.push_back(c.write(frame));
+			sequenceBytes += sequence.back().size();
+		}
+
+		printf("%s, %ld bytes/message\n", c.name,
+			sequenceBytes / SEQUENCE_LENGTH);
+		printf("  level windowBits takeover %12s %8s\n", "ns/message", "ratio");
+
+		for (int level = 0; level <= 9; level++)
+		{
+			for (int windowBits = 9; windowBits <= 15; windowBits++)
+			{
+				for (int takeover = 0; takeover <= 1; takeover++)
+				{
+					if (!round_trip(sequence, windowBits, takeover, level))
+					{
+						fprintf(stderr, "%s: level %d, windowBits %d, "
+							"takeover %d doesn't inflate back\n", c.name,
+							level, windowBits, takeover);
+						return 1;
+					}
+
+					MessageDeflater deflater(level, windowBits, takeover);
+					auto start = std::chrono::steady_clock::now();
+					for (long n = 0; n < iterations; n++)
+						deflater.compress(sequence[n % SEQUENCE_LENGTH]);
+					double seconds = seconds_since(start);
+
+					printf("  %5d %10d %8s %12.0f %8.2f\n", level, windowBits,
+						takeover ? "yes" : "no", seconds * 1e9 / iterations,
+						deflater.bytesOut > 0
+							? (double)deflater.bytesIn / deflater.bytesOut : 0.0);
+				}
+			}
+		}
+	}
+
+	return 0;
+}
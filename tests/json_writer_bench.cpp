@@ -0,0 +1,143 @@
+/**
+ * Messages per second for the hot updates in both encodings: JsonWriter
+ * writing the JSON and CBOR forms in one pass, against writing the JSON
+ * and converting it through obs_data_create_from_json and Cbor::FromData,
+ * which is what CBOR clients got before. Also checks the two CBOR forms
+ * are identical.
+ *
+ * Usage: json_writer_bench [iterations]
+ */
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Cbor.h"
+#include "JsonWriter.h"
+
+static JsonWriter& rectangle_update(bool cbor)
+{
+	JsonWriter& writer = JsonWriter::Begin("RectangleUpdate", cbor);
+	writer.writeString("name", "health");
+	writer.writeString("group", "hud");
+	writer.writeBool("state", true);
+	writer.writeBool("lastState", false);
+	writer.writeInt("timestamp", 1234567890123LL);
+	return writer;
+}
+
+// 64x64 rectangle, 32 KB of pixels
+static JsonWriter& video_update(bool cbor)
+{
+	static const char hex_digits[] = "0123456789ABCDEF";
+	const int length = 64 * 64 * 8;
+
+	JsonWriter& writer = JsonWriter::Begin("VideoUpdate", cbor);
+	writer.writeString("name", "minimap");
+	writer.writeString("group", "hud");
+	char* pixels = writer.writeStringInPlace("pixels", length);
+	for (int i = 0; i < length; i++)
+		pixels[i] = hex_digits[(i * 7) & 0xF];
+	writer.writeInt("timestamp", 1234567890123LL);
+	return writer;
+}
+
+static JsonWriter& audio_update(bool cbor)
+{
+	JsonWriter& writer = JsonWriter::Begin("AudioUpdate", cbor);
+	writer.beginArray("sources");
+	for (int source = 0; source < 4; source++)
+	{
+		writer.beginObject();
+		writer.writeString("source", "Desktop Audio");
+		writer.writeDouble("magnitude", -23.456789 - source);
+		writer.writeDouble("peak", -12.3456789);
+		writer.writeDouble("true_peak", -11.987654);
+		writer.writeDouble("mul", 1.0);
+		writer.writeInt("nr_channels", 2);
+		writer.beginArray("channels");
+		for (int channel = 0; channel < 2; channel++)
+		{
+			writer.beginObject();
+			writer.writeDouble("magnitude", -24.5 - channel);
+			writer.writeDouble("peak", -13.25 - channel);
+			writer.endObject();
+		}
+		writer.endArray();
+		writer.beginObject("loudness");
+		writer.writeDouble("momentary", -22.1);
+		writer.writeDouble("short_term", -23.4);
+		writer.writeDouble("integrated", -23.0);
+		writer.writeDouble("range", 6.5);
+		writer.endObject();
+		writer.endObject();
+	}
+	writer.endArray();
+	return writer;
+}
+
+struct bench_case
+{
+	const char* name;
+	JsonWriter& (*write)(bool cbor);
+};
+
+static const bench_case cases[] = {
+	{"RectangleUpdate", rectangle_update},
+	{"VideoUpdate 64x64", video_update},
+	{"AudioUpdate 4 sources", audio_update},
+};
+
+static QByteArray reparsed_cbor(const QByteArray& json)
+{
+	OBSDataAutoRelease data = obs_data_create_from_json(json.constData());
+	return Cbor::FromData(data);
+}
+
+static double seconds_since(std::chrono::steady_clock::time_point start)
+{
+	std::chrono::duration<double> elapsed =
+		std::chrono::steady_clock::now() - start;
+	return elapsed.count() > 0.0 ? elapsed.count() : 1e-9;
+}
+
+int main(int argc, char** argv)
+{
+	long iterations = argc > 1 ? atol(argv[1]) : 20000;
+
+	for (const bench_case& c : cases)
+	{
+		JsonWriter& writer = c.write(true);
+		QByteArray json = writer.end();
+		QByteArray cbor = writer.cbor();
+		if (cbor != reparsed_cbor(json))
+		{
+			fprintf(stderr, "%s: CBOR forms differ\n", c.name);
+			return 1;
+		}
+
+		long bytes = 0;
+		auto start = std::chrono::steady_clock::now();
+		for (long n = 0; n < iterations; n++)
+		{
+			JsonWriter& w = c.write(true);
+			bytes += w.end().size() + w.cbor().size();
+		}
+		double twin = iterations / seconds_since(start);
+
+		start = std::chrono::steady_clock::now();
+		for (long n = 0; n < iterations; n++)
+		{
+			QByteArray message = c.write(false).end();
+			bytes += message.size() + reparsed_cbor(message).size();
+		}
+		double reparsed = iterations / seconds_since(start);
+
+		printf("%-22s %6d bytes JSON %6d bytes CBOR  "
+			"%10.0f messages/s twin %10.0f messages/s re-parsed (%ld)\n",
+			c.name, json.size(), cbor.size(), twin, reparsed, bytes);
+	}
+
+	return 0;
+}
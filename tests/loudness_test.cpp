@@ -0,0 +1,128 @@
+/**
+ * EBU reference signals through the R128 meter, fed like OBS does in
+ * 1024 frame buffers of planar stereo at 48 kHz:
+ *
+ * - Tech 3341 cases 1 to 4: a 1 kHz sine at -23 and -33 dBFS (momentary,
+ *   short-term and integrated loudness) and the two sequences exercising
+ *   the absolute and relative gates (integrated loudness).
+ * - Tech 3342 cases 1 to 4: loudness range of sine sequences.
+ *
+ * Every value must be within 0.1 LU of the expected one.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <vector>
+
+#include "Loudness.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define SAMPLE_RATE 48000
+#define BUFFER_FRAMES 1024
+#define TOLERANCE 0.1
+
+// Part of a test signal: a 1 kHz sine in both channels
+struct segment
+{
+	double dbfs;
+	double seconds;
+};
+
+struct loudness_case
+{
+	const char* name;
+	std::vector<segment> segments;
+	// NAN for values the case doesn't check
+	double momentary;
+	double short_term;
+	double integrated;
+	double range;
+};
+
+static loudness_values measure(const std::vector<segment>& segments)
+{
+	loudness_meter* meter = new loudness_meter;
+	loudness_reset(meter, SAMPLE_RATE, 2);
+
+	std::vector<float> left(BUFFER_FRAMES);
+	std::vector<float> right(BUFFER_FRAMES);
+	float* planes[2] = { left.data(), right.data() };
+
+	// Frames of each level, the sine running on across the changes
+	std::vector<double> amplitudes;
+	for (const segment& part : segments)
+		amplitudes.insert(amplitudes.end(),
+			(size_t)(part.seconds * SAMPLE_RATE + 0.5),
+			pow(10.0, part.dbfs / 20.0));
+
+	for (size_t start = 0; start < amplitudes.size(); start += BUFFER_FRAMES)
+	{
+		size_t frames = amplitudes.size() - start;
+		if (frames > BUFFER_FRAMES)
+			frames = BUFFER_FRAMES;
+		for (size_t i = 0; i < frames; i++)
+		{
+			size_t n = start + i;
+			left[i] = right[i] = (float)(amplitudes[n]
+				* sin(2.0 * M_PI * 1000.0 * (double)(n % SAMPLE_RATE) / SAMPLE_RATE));
+		}
+		loudness_process(meter, planes, frames, 1.0f);
+	}
+
+	loudness_values values = meter->values;
+	delete meter;
+	return values;
+}
+
+static bool check(const char* name, const char* value, double measured,
+	double expected)
+{
+	if (isnan(expected))
+		return true;
+
+	bool ok = fabs(measured - expected) <= TOLERANCE;
+	printf("%-32s %-10s %8.3f expected %6.1f%s\n", name, value, measured,
+		expected, ok ? "" : "  FAILED");
+	return ok;
+}
+
+int main()
+{
+	const loudness_case cases[] = {
+		{ "Tech 3341 case 1", { { -23.0, 20.0 } },
+			-23.0, -23.0, -23.0, NAN },
+		{ "Tech 3341 case 2", { { -33.0, 20.0 } },
+			-33.0, -33.0, -33.0, NAN },
+		{ "Tech 3341 case 3",
+			{ { -36.0, 10.0 }, { -23.0, 60.0 }, { -36.0, 10.0 } },
+			NAN, NAN, -23.0, NAN },
+		{ "Tech 3341 case 4",
+			{ { -72.0, 10.0 }, { -36.0, 10.0 }, { -23.0, 60.0 },
+			{ -36.0, 10.0 }, { -72.0, 10.0 } },
+			NAN, NAN, -23.0, NAN },
+		{ "Tech 3342 case 1", { { -20.0, 20.0 }, { -30.0, 20.0 } },
+			NAN, NAN, NAN, 10.0 },
+		{ "Tech 3342 case 2", { { -20.0, 20.0 }, { -15.0, 20.0 } },
+			NAN, NAN, NAN, 5.0 },
+		{ "Tech 3342 case 3", { { -40.0, 20.0 }, { -20.0, 20.0 } },
+			NAN, NAN, NAN, 20.0 },
+		{ "Tech 3342 case 4",
+			{ { -50.0, 20.0 }, { -35.0, 20.0 }, { -20.0, 20.0 },
+			{ -35.0, 20.0 }, { -50.0, 20.0 } },
+			NAN, NAN, NAN, 15.0 },
+	};
+
+	bool ok = true;
+	for (const loudness_case& c : cases)
+	{
+		loudness_values values = measure(c.segments);
+		ok = check(c.name, "momentary", values.momentary, c.momentary) && ok;
+		ok = check(c.name, "short-term", values.short_term, c.short_term) && ok;
+		ok = check(c.name, "integrated", values.integrated, c.integrated) && ok;
+		ok = check(c.name, "range", values.range, c.range) && ok;
+	}
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,141 @@
+/**
+ * Requests per second through the text request fast path: scanning the
+ * request-type and message-id out of the message and looking up the
+ * handler. This is the whole cost for requests without fields; the others
+ * additionally pay for obs_data_create_from_json, which isn't measured here.
+ *
+ * Usage: request_bench [iterations]
+ */
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+#include "RequestHeader.h"
+
+struct request_case
+{
+	const char* name;
+	const char* message;
+	bool scans;
+	int index;
+	const char* message_id;
+};
+
+static const request_case cases[] = {
+	{"GetVersion",
+		"{\"request-type\":\"GetVersion\",\"message-id\":\"1\"}",
+		true, request_GetVersion, "1"},
+	{"GetSubscriptions, id first",
+		"{ \"message-id\": \"sub-17\", \"request-type\": \"GetSubscriptions\" }",
+		true, request_GetSubscriptions, "sub-17"},
+	{"SetSourceFilterSettings",
+		"{\"request-type\":\"SetSourceFilterSettings\",\"message-id\":\"42\","
+		"\"sourceName\":\"Game capture\",\"filterName\":\"OstWS video\","
+		"\"filterSettings\":{\"groups\":[{\"name\":\"hud\",\"rects\":"
+		"[[0,0,320,180],[960,0,320,180],[0,540,320,180]]},"
+		"{\"name\":\"minimap\",\"rects\":[[1600,800,320,280]]}],"
+		"\"note\":\"brackets in strings ] } are skipped\"}}",
+		true, request_SetSourceFilterSettings, "42"},
+	{"Unknown request",
+		"{\"request-type\":\"GetVersions\",\"message-id\":\"2\"}",
+		true, -1, "2"},
+	{"Escaped message-id",
+		"{\"request-type\":\"GetVersion\",\"message-id\":\"a\\\"b\"}",
+		false, -1, nullptr},
+	{"Trailing garbage",
+		"{\"request-type\":\"GetVersion\",\"message-id\":\"1\"} x",
+		false, -1, nullptr},
+};
+
+static const int case_count = sizeof(cases) / sizeof(cases[0]);
+
+static bool lookup(const request_header& header, int* index)
+{
+	char type[64];
+	if (header.type_length >= sizeof(type))
+		return false;
+	memcpy(type, header.type, header.type_length);
+	type[header.type_length] = 0;
+	*index = find_request(type);
+	return true;
+}
+
+static bool check(const request_case& c)
+{
+	request_header header;
+	bool scans = scan_request_header(c.message, strlen(c.message), &header);
+	if (scans != c.scans)
+	{
+		fprintf(stderr, "%s: scan returned %d\n", c.name, scans);
+		return false;
+	}
+	if (!scans)
+		return true;
+
+	int index = -1;
+	if (!lookup(header, &index) || index != c.index)
+	{
+		fprintf(stderr, "%s: found request %d instead of %d\n",
+			c.name, index, c.index);
+		return false;
+	}
+	if (std::string(header.message_id, header.message_id_length)
+		!= c.message_id)
+	{
+		fprintf(stderr, "%s: wrong message-id\n", c.name);
+		return false;
+	}
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	long iterations = argc > 1 ? atol(argv[1]) : 2000000;
+
+	bool ok = true;
+	for (int i = 0; i < case_count; i++)
+		ok = check(cases[i]) && ok;
+	for (int i = 0; i < request_count; i++)
+	{
+		static const char* const names[] = {
+#define X(name, async, params) #name,
+			REQUEST_HANDLERS(X)
+#undef X
+		};
+		if (find_request(names[i]) != i)
+		{
+			fprintf(stderr, "find_request(\"%s\") failed\n", names[i]);
+			ok = false;
+		}
+	}
+	if (!ok)
+		return 1;
+
+	for (int i = 0; i < case_count; i++)
+	{
+		const request_case& c = cases[i];
+		size_t length = strlen(c.message);
+		long found = 0;
+
+		auto start = std::chrono::steady_clock::now();
+		for (long n = 0; n < iterations; n++)
+		{
+			request_header header;
+			int index;
+			if (scan_request_header(c.message, length, &header)
+				&& lookup(header, &index) && index >= 0)
+				found++;
+		}
+		std::chrono::duration<double> elapsed =
+			std::chrono::steady_clock::now() - start;
+
+		double seconds = elapsed.count() > 0.0 ? elapsed.count() : 1e-9;
+		printf("%-28s %4zu bytes %12.0f requests/s (%ld found)\n",
+			c.name, length, iterations / seconds, found);
+	}
+
+	return 0;
+}
@@ -0,0 +1,148 @@
+/**
+ * Compares every audio_true_peak kernel the CPU runs, and the dispatcher,
+ * against the direct form of the BS.1770-4 Annex 2 filter: the signal
+ * zero-stuffed to 4x and convolved with the 48 taps, in double precision.
+ * Buffers are fed one after the other so the history carries across their
+ * boundaries:
+ *
+ * - noise in buffers of 1 to 13 frames, shorter and longer than the 11
+ *   samples of history, then in 1024 frame buffers;
+ * - the inter-sample peak signal of BS.1770: a full scale sine at fs / 4
+ *   with a 45 degree phase offset, whose samples peak at -3 dB while the
+ *   true peak is 0 dB.
+ *
+ * Every buffer's peak must be within TOLERANCE of the reference.
+ */
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+#include "AudioKernels.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define TAPS 48
+#define TOLERANCE 1e-5
+
+// BS.1770-4 Annex 2, phase p of the polyphase form is taps p, p + 4, ...
+static const double taps[TAPS] = {
+	0.0017089843750, -0.0291748046875, -0.0189208984375, -0.0083007812500,
+	0.0109863281250, 0.0292968750000, 0.0330810546875, 0.0148925781250,
+	-0.0196533203125, -0.0517578125000, -0.0582275390625, -0.0266113281250,
+	0.0332031250000, 0.0891113281250, 0.1015625000000, 0.0476074218750,
+	-0.0594482421875, -0.1665039062500, -0.2003173828125, -0.1022949218750,
+	0.1373291015625, 0.4650878906250, 0.7797851562500, 0.9721679687500,
+	0.9721679687500, 0.7797851562500, 0.4650878906250, 0.1373291015625,
+	-0.1022949218750, -0.2003173828125, -0.1665039062500, -0.0594482421875,
+	0.0476074218750, 0.1015625000000, 0.0891113281250, 0.0332031250000,
+	-0.0266113281250, -0.0582275390625, -0.0517578125000, -0.0196533203125,
+	0.0148925781250, 0.0330810546875, 0.0292968750000, 0.0109863281250,
+	-0.0083007812500, -0.0189208984375, -0.0291748046875, 0.0017089843750,
+};
+
+// Largest output of the 4x signal for input samples [start, end)
+static double reference_peak(const std::vector<float>& signal, size_t start,
+	size_t end)
+{
+	double peak = 0.0;
+	for (size_t m = 4 * start; m < 4 * end; m++)
+	{
+		double sum = 0.0;
+		for (size_t k = 0; k < TAPS && k <= m; k++)
+		{
+			// Zero-stuffed: only every fourth input is a sample
+			if ((m - k) % 4 == 0)
+				sum += taps[k] * signal[(m - k) / 4];
+		}
+		peak = fmax(peak, fabs(sum));
+	}
+	return peak;
+}
+
+static bool check(const char* label, const char* name,
+	float (*func)(const float*, size_t, float*),
+	const std::vector<float>& signal, const std::vector<size_t>& buffers)
+{
+	float history[AUDIO_TRUE_PEAK_HISTORY] = {};
+	size_t start = 0;
+	for (size_t length : buffers)
+	{
+		float peak = func(signal.data() + start, length, history);
+		double expected = reference_peak(signal, start, start + length);
+		if (fabs(peak - expected) > TOLERANCE)
+		{
+			fprintf(stderr, "%s, %s: %zu frames at %zu, peak %.9g "
+				"expected %.9g\n", label, name, length, start, peak,
+				expected);
+			return false;
+		}
+		start += length;
+	}
+	return true;
+}
+
+static uint32_t random_state = 12345;
+
+static float random_sample()
+{
+	random_state = random_state * 1664525u + 1013904223u;
+	return (float)((random_state >> 8) / 8388608.0 - 1.0);
+}
+
+int main()
+{
+	std::vector<float> noise;
+	std::vector<size_t> short_buffers;
+	for (int round = 0; round < 4; round++)
+	{
+		for (size_t length = 1; length <= 13; length++)
+			short_buffers.push_back(length);
+	}
+	std::vector<size_t> long_buffers(4, 1024);
+
+	std::vector<float> isp;
+	for (int n = 0; n < 4096; n++)
+		isp.push_back((float)sin(2.0 * M_PI * n / 4.0 + M_PI / 4.0));
+
+	size_t short_total = 0;
+	for (size_t length : short_buffers)
+		short_total += length;
+	noise.resize(short_total > 4096 ? short_total : 4096);
+	for (float& sample : noise)
+		sample = random_sample();
+
+	const audio_true_peak_kernel* kernels;
+	size_t kernel_count = audio_true_peak_kernels(&kernels);
+
+	bool ok = true;
+	for (size_t k = 0; k <= kernel_count; k++)
+	{
+		const char* name = k < kernel_count ? kernels[k].name : "audio_true_peak";
+		float (*func)(const float*, size_t, float*) =
+			k < kernel_count ? kernels[k].func : audio_true_peak;
+
+		ok = check("noise, short buffers", name, func, noise, short_buffers) && ok;
+		ok = check("noise, 1024 frames", name, func, noise, long_buffers) && ok;
+		ok = check("sine at fs/4, 45 degrees", name, func, isp, long_buffers) && ok;
+	}
+
+	// The sample peak is 0.707, past the first buffer the true peak is
+	// within the passband ripple of 1
+	float history[AUDIO_TRUE_PEAK_HISTORY] = {};
+	audio_true_peak(isp.data(), 1024, history);
+	float peak = audio_true_peak(isp.data() + 1024, 1024, history);
+	printf("sine at fs/4, 45 degrees: sample peak %.2f dBFS, true peak %.2f dBTP\n",
+		20.0 * log10(sqrt(0.5)), 20.0 * log10(peak));
+	if (fabs(20.0 * log10(peak)) > 0.2)
+	{
+		fprintf(stderr, "true peak of the inter-sample peak signal is off\n");
+		ok = false;
+	}
+
+	printf("%zu kernels checked\n", kernel_count);
+	return ok ? 0 : 1;
+}